@@ -182,6 +182,17 @@ struct sysfail_session_s {
 
     // Discover threads using the strategy configured in the plan
     void (*discover_threads)(sysfail_session_t*);
+
+    // Replace syscall outcomes of the running session with those of the
+    // given plan, atomically across threads. Failure-injected threads stay
+    // so (only `syscall_outcomes` of the given plan are used, the session
+    // keeps its seed). Plan is not retained, caller may free it once this
+    // returns.
+    void (*update)(sysfail_session_t*, const sysfail_plan_t*);
+
+    // Seed in effect, starting a session with this seed (see
+    // `sysfail_start_seeded`) reproduces injection decisions
+    uint64_t (*seed)(sysfail_session_t*);
 };
 
 /**
@@ -196,4 +207,10 @@ struct sysfail_session_s {
  */
 sysfail_session_t* sysfail_start(const sysfail_plan_t*);
 
+/**
+ * Same as `sysfail_start`, with injection decisions drawn from the given seed
+ * (0 => random, same as `sysfail_start`).
+ */
+sysfail_session_t* sysfail_start_seeded(const sysfail_plan_t*, uint64_t seed);
+
 #endif
\ No newline at end of file
@@ -17,6 +17,7 @@
 #ifndef _SYSFAIL_HH
 #define _SYSFAIL_HH
 
+#include <cerrno>
 #include <chrono>
 #include <memory>
 #include <map>
@@ -27,6 +28,11 @@
 #include <variant>
 #include <signal.h>
 #include <stdexcept>
+#include <optional>
+#include <iosfwd>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 namespace sysfail {
     // Syscall number
@@ -90,6 +96,330 @@ namespace sysfail {
         InvocationPredicate p(P p);
     }
 
+    // Schedules vary failure / delay probability of an outcome over time.
+    // The schedule's level (in [0, 1]) scales both `fail.p` and `delay.p`.
+    // Time is measured from when the plan takes effect (session start or
+    // Session::update), using a coarse monotonic clock (a few ms of
+    // resolution), so schedules are meant for changes over 10s of ms and up.
+    namespace schedule {
+        using std::chrono::milliseconds;
+
+        // Level is always 1, probabilities apply as given
+        struct Constant {};
+
+        // Level moves linearly from `from` to `to` over `over`, and stays at
+        // `to` afterwards
+        struct Ramp {
+            const double from;
+            const double to;
+            const milliseconds over;
+
+            Ramp(double from, double to, milliseconds over);
+        };
+
+        // Outage every `period`: level is 1 for `on` (starting `offset` into
+        // each period) and 0 for the rest of the period.
+        // Eg. disk goes bad for 30s every 10 min: Square(30s, 10min)
+        struct Square {
+            const milliseconds on;
+            const milliseconds period;
+            const milliseconds offset;
+
+            Square(
+                milliseconds on,
+                milliseconds period,
+                milliseconds offset = milliseconds(0));
+        };
+
+        // Incident windows that start at random (Poisson arrivals, `mean_gap`
+        // apart on average) and last for `duration`: level is 1 during an
+        // incident and 0 otherwise. Time is divided into `duration` long
+        // slots, each of which is an incident independently, so incidents
+        // are aligned to slots and back-to-back incidents merge.
+        // Same `seed` reproduces the same incidents (0 => derived from the
+        // plan's seed).
+        struct Incidents {
+            const milliseconds mean_gap;
+            const milliseconds duration;
+            const uint64_t seed;
+
+            Incidents(
+                milliseconds mean_gap,
+                milliseconds duration,
+                uint64_t seed = 0);
+        };
+
+        // Piecewise-constant level, each step sets level from its time
+        // onwards (level is 0 before the first step). Steps repeat every
+        // `period` if it is non-zero.
+        struct Steps {
+            struct Step {
+                milliseconds at;
+                double level;
+            };
+            const std::vector<Step> steps;
+            const milliseconds period;
+
+            Steps(
+                std::vector<Step> steps,
+                milliseconds period = milliseconds(0));
+        };
+
+        using Schedule = std::variant<Constant, Ramp, Square, Incidents, Steps>;
+    }
+
+    // Caps on injection regardless of how often the syscall is made. Limits
+    // apply process-wide (across threads) and reset when the plan is
+    // replaced (Session::update). 0 means unlimited.
+    struct Limit {
+        // Failures injected per second (at most 1 second worth of burst)
+        const uint32_t failures_per_sec;
+        // Total delay injected per second, delays are cut short (or skipped)
+        // once this is used up
+        const std::chrono::microseconds delay_per_sec;
+        // Failures injected over the lifetime of the plan
+        const uint64_t max_failures;
+
+        Limit(
+            uint32_t failures_per_sec = 0,
+            std::chrono::microseconds delay_per_sec = std::chrono::microseconds(0),
+            uint64_t max_failures = 0);
+    };
+
+    // Shapes throughput of read / write-family syscalls (read, write, pread64,
+    // pwrite64, readv, writev, sendto, recvfrom, sendmsg, recvmsg) to a byte
+    // rate. Bytes a call transfers are charged once it returns, calls made
+    // while the budget is overdrawn are delayed or shortened. Budgets reset
+    // when the plan is replaced (Session::update).
+    struct Throttle {
+        enum class Mode {
+            // Wait until the budget is paid up
+            Delay,
+            // Cut the byte count (or whole iovecs for readv / writev) down to
+            // what the budget allows, waiting only when (nearly) nothing is
+            // left. Message-oriented calls (sendto, recvfrom, sendmsg,
+            // recvmsg) are delayed instead, cutting them would truncate
+            // datagrams.
+            Shorten
+        };
+
+        const uint64_t bytes_per_sec;
+        const Mode mode;
+        // Bytes that may go through at once after idling (0 => 10ms worth)
+        const uint64_t burst;
+        // A budget per fd (calls on fds beyond 65535 aren't throttled), or one
+        // shared by all fds. Budgets can't be keyed by fd class, but a shared
+        // budget on an outcome limited to a class (`Outcome::fd_class`) is
+        // one for that class.
+        const bool per_fd;
+
+        Throttle(
+            uint64_t bytes_per_sec,
+            Mode mode = Mode::Delay,
+            uint64_t burst = 0,
+            bool per_fd = true);
+    };
+
+    // Emulates a storage device behind positional I/O (read, write, pread64,
+    // pwrite64, readv, writev). Each call is held for the time the device
+    // would take to serve it: a seek when its offset doesn't follow on from
+    // where the previous call on the fd ended, plus transfer of the bytes
+    // requested. Up to `queue_depth` calls are served at once, later ones
+    // queue behind them. The model is shared by all threads and reset when
+    // the plan is replaced (Session::update).
+    struct Device {
+        const std::chrono::microseconds seek;
+        const uint64_t bytes_per_sec;
+        const uint32_t queue_depth;
+
+        static constexpr uint32_t max_queue_depth = 64;
+
+        Device(
+            std::chrono::microseconds seek,
+            uint64_t bytes_per_sec,
+            uint32_t queue_depth = 1);
+    };
+
+    // Caps how many threads may be inside the syscall at once, like a device
+    // with a limited queue depth. Callers beyond the limit wait their turn in
+    // FIFO order. Outcomes naming the same `queue` share its slots (eg. read,
+    // pread64 and readv of one disk), otherwise each syscall has a queue of
+    // its own. Queues last as long as the session, replacing the plan
+    // (Session::update) only changes their limit.
+    struct Concurrency {
+        const uint32_t limit;
+        const std::string queue;
+
+        Concurrency(uint32_t limit, const std::string& queue = "");
+    };
+
+    // Targets outcomes at kinds of fds, eg. sockets only or files under
+    // /data, without a user predicate inspecting the fd on every call. The
+    // session classifies fds as the threads it injects into create them
+    // (open, socket, accept, pipe, dup etc, and sees them closed), and
+    // others (inherited, created by threads it doesn't watch) on first use.
+    // An fd closed and reused by threads the session doesn't watch keeps
+    // its earlier class.
+    namespace fds {
+        enum class Kind : uint8_t { File = 1, Dir, Socket, Pipe, Other };
+
+        // Matches the fd in the first argument of the call
+        struct Class {
+            // Kinds matched (empty => any)
+            const std::vector<Kind> kinds;
+            // Files and directories under any of these paths (empty => any
+            // fd, including ones that have no path), resolved with symlinks
+            // followed when the fd is first matched
+            const std::vector<std::string> under;
+            // Open flags that must all be set (eg. O_DIRECT, O_WRONLY), as
+            // fcntl(F_GETFL) reports them for files and directories
+            const int flags;
+
+            Class(
+                const std::vector<Kind>& kinds,
+                const std::vector<std::string>& under = {},
+                int flags = 0);
+        };
+    }
+
+    // Emulates the network between the process and its peers (eg. a degraded
+    // link to one replica, over loopback) for connect, sendto, sendmsg,
+    // recvfrom and recvmsg. A call's peer is the address it is made to
+    // (connect, and sendto / sendmsg given one), or else the peer of its
+    // socket, as the session saw it connected or accepted (or getpeername
+    // says, for sockets it didn't see). Of the links of an outcome, the one
+    // with the longest prefix matching the peer applies (of equally long
+    // ones, a link naming the peer's port wins over one naming no port).
+    namespace net {
+        struct Link {
+            // Peer prefixes, "address[/bits][:port]" with IPv6 addresses in
+            // brackets when followed by a port, eg. "10.1.0.0/16",
+            // "127.0.0.2:7000" or "[::1]:7000". IPv4 prefixes match
+            // IPv4-mapped IPv6 peers too.
+            const std::vector<std::string> peers;
+            // Delay of every call on the link, before connect and sends,
+            // after receives
+            const std::chrono::microseconds latency;
+            // Added to latency, uniform in [0, jitter]
+            const std::chrono::microseconds jitter;
+            // Probability of a call failing with `error` (after its
+            // latency), 1 => a partition
+            const double loss;
+            // eg. EAGAIN, ETIMEDOUT or ECONNRESET
+            const Errno error;
+
+            Link(
+                const std::vector<std::string>& peers,
+                std::chrono::microseconds latency,
+                std::chrono::microseconds jitter = {},
+                double loss = 0,
+                Errno error = EAGAIN);
+        };
+    }
+
+    // Deterministic alternative to failure probability: calls are picked by
+    // their index among eligible calls of the syscall (counting from 0),
+    // either per thread or across all threads. Picked calls fail (error and
+    // before / after placement are chosen as usual), others don't. Counts
+    // start over when the plan is replaced (Session::update).
+    namespace trigger {
+        enum class Scope { Thread, Global };
+
+        // Only the call at index `k`
+        struct Nth {
+            const uint64_t k;
+            const Scope scope;
+
+            Nth(uint64_t k, Scope scope = Scope::Thread);
+        };
+
+        // Every `n`-th call (indices n-1, 2n-1, ...)
+        struct Every {
+            const uint64_t n;
+            const Scope scope;
+
+            Every(uint64_t n, Scope scope = Scope::Thread);
+        };
+
+        // Calls with index in [from, to)
+        struct Window {
+            const uint64_t from;
+            const uint64_t to;
+            const Scope scope;
+
+            Window(uint64_t from, uint64_t to, Scope scope = Scope::Thread);
+        };
+
+        using Trigger = std::variant<Nth, Every, Window>;
+    }
+
+    // Distribution injected delays are drawn from. Each is compiled to an
+    // inverse-CDF table when the plan takes effect, so drawing a delay costs
+    // a lookup (with tails resolved beyond the millionth slowest call).
+    namespace latency {
+        using std::chrono::microseconds;
+
+        // Uniform over [0, Outcome::max_delay]
+        struct Uniform {};
+
+        struct Exponential {
+            const microseconds mean;
+
+            Exponential(microseconds mean);
+        };
+
+        // exp(N(ln(median), sigma^2))
+        struct LogNormal {
+            const microseconds median;
+            const double sigma;
+
+            LogNormal(microseconds median, double sigma);
+        };
+
+        // Heavy-tailed, at least `scale`, shape (alpha) closer to 1 means a
+        // heavier tail
+        struct Pareto {
+            const microseconds scale;
+            const double shape;
+
+            Pareto(microseconds scale, double shape);
+        };
+
+        // Mixture of a fast and a slow mode (eg. cache hit / miss), the slow
+        // one is drawn with probability `slow_p`
+        struct Bimodal {
+            const LogNormal fast;
+            const LogNormal slow;
+            const double slow_p;
+
+            Bimodal(LogNormal fast, LogNormal slow, double slow_p);
+        };
+
+        // Histogram of observed latencies, delays are spread uniformly within
+        // a bucket (the first bucket starts at 0)
+        struct Empirical {
+            struct Bucket {
+                microseconds upto;
+                double weight;
+            };
+            const std::vector<Bucket> buckets;
+
+            Empirical(std::vector<Bucket> buckets);
+
+            // Reads "<bucket upper bound in us> <count>" lines ('#' starts a
+            // comment), eg. as exported by a profiler
+            static Empirical load(std::istream& in);
+        };
+
+        using Distribution = std::variant<
+            Uniform,
+            Exponential,
+            LogNormal,
+            Pareto,
+            Bimodal,
+            Empirical>;
+    }
+
     /**
      * Outcome of a syscall
      */
@@ -98,7 +428,8 @@ namespace sysfail {
         const Probability fail;
         // Probability of delay
         const Probability delay;
-        // Maximum delay in microseconds
+        // Maximum delay in microseconds (for distributions other than
+        // Uniform, 0 => uncapped, where delays saturate at a day)
         const std::chrono::microseconds max_delay;
         // Errors to be presented to the call=site when failure is injected
         // and relative weights. Higher weight makes the error more likely. This
@@ -107,6 +438,40 @@ namespace sysfail {
         const std::map<Errno, double> error_weights;
         // Eligibility predicate for the syscall
         InvocationPredicate eligible;
+        // Variation of failure / delay probability over time
+        const schedule::Schedule schedule = schedule::Constant{};
+        // Rate-limits and budget for injection
+        const Limit limit = {};
+        // Fail calls picked by index instead of by `fail.p` (schedule then
+        // only scales delay probability)
+        const std::optional<trigger::Trigger> trigger = std::nullopt;
+        // Distribution of injected delays
+        const latency::Distribution latency = latency::Uniform{};
+        // Bandwidth shaping of the calls not failed
+        const std::optional<Throttle> throttle = std::nullopt;
+        // Storage device the calls not failed are served by
+        const std::optional<Device> device = std::nullopt;
+        // Slots the calls not failed (before the syscall) must take a turn in
+        const std::optional<Concurrency> concurrency = std::nullopt;
+        // Only calls on fds of this class are eligible (checked before
+        // `eligible`)
+        const std::optional<fds::Class> fd_class = std::nullopt;
+        // Only calls on paths matching one of these globs are eligible (empty
+        // => any). For calls taking a path: open, openat, openat2, creat,
+        // stat, lstat, newfstatat, statx, access, faccessat, faccessat2,
+        // unlink, unlinkat, rename, renameat, renameat2, mkdir, mkdirat,
+        // rmdir, truncate, readlink and readlinkat. The path is matched as
+        // passed to the call (relative paths are not resolved), against the
+        // first path for renames. Globs of all outcomes are compiled into one
+        // automaton when the plan takes effect. `*`
+        // and `?` match within a path component, `**` across components
+        // (`a/**/b` matches a/b too), `[a-z]` / `[!a-z]` match a character
+        // of (not of) a set, and `\` escapes.
+        const std::vector<std::string> paths = {};
+        // Only calls to peers on one of these links are eligible (empty =>
+        // any), and the link's latency and loss apply to them on top of
+        // `fail` and `delay` (see net::Link)
+        const std::vector<net::Link> links = {};
     };
 
     namespace thread_discovery {
@@ -130,6 +495,180 @@ namespace sysfail {
         using Strategy = std::variant<ProcPoll, None>;
     }
 
+    namespace observe {
+        // Aggregate syscall time by the user call-stack that issued the
+        // syscall. Stacks are unwound using frame-pointers, so frames compiled
+        // with `-fomit-frame-pointer` are skipped over. See
+        // Session::dump_stacks.
+        struct Stacks {
+            // Maximum frames captured per stack, deeper frames are dropped
+            const uint32_t max_frames;
+            // Unique stacks tracked per thread, syscalls with stacks beyond
+            // this are aggregated under a single `[overflow]` stack.
+            const uint32_t capacity;
+
+            Stacks(
+                uint32_t max_frames = 32,
+                uint32_t capacity = 1024
+            ) : max_frames(max_frames), capacity(capacity) {
+                if (max_frames == 0 || max_frames > 128) {
+                    throw std::invalid_argument("Frames must be in [1, 128]");
+                }
+                if (capacity == 0) {
+                    throw std::invalid_argument("Capacity must be positive");
+                }
+            }
+        };
+
+        // Value reported against each stack in folded output
+        enum class Metric {
+            // Total nanoseconds spent in syscalls (including injected delay)
+            Time,
+            // Number of syscalls
+            Count
+        };
+
+        // Attribute injected failures to the application call-site that
+        // received them, see Session::call_sites.
+        struct CallSites {
+            // Return-addresses captured per call-site (leaf first)
+            const uint32_t max_frames;
+            // Unique call-sites tracked per thread, failures injected at
+            // call-sites beyond this are not attributed
+            const uint32_t capacity;
+
+            CallSites(
+                uint32_t max_frames = 4,
+                uint32_t capacity = 256
+            ) : max_frames(max_frames), capacity(capacity) {
+                if (max_frames == 0 || max_frames > 16) {
+                    throw std::invalid_argument("Frames must be in [1, 16]");
+                }
+                if (capacity == 0) {
+                    throw std::invalid_argument("Capacity must be positive");
+                }
+            }
+        };
+
+        // Code location, resolved after the fact against the process mapping
+        struct Frame {
+            // Runtime address
+            uintptr_t addr;
+            // Path of the mapped module (empty if unmapped)
+            std::string module;
+            // Offset in the module file (usable with addr2line etc)
+            uintptr_t offset;
+            // Function name when available, `module+0xoffset` otherwise
+            std::string symbol;
+        };
+
+        struct CallSite {
+            // Syscall that was failed
+            Syscall call;
+            // Call-stack that made the syscall (leaf first)
+            std::vector<Frame> frames;
+            // Number of failures injected at this call-site
+            uint64_t injected;
+            // Syscall the thread made right after it received the failure
+            // and how many times (eg. the same syscall for a retry, or
+            // SYS_close when it gives up on the fd). Key -1 accounts for
+            // syscalls that could not be tracked individually.
+            std::map<Syscall, uint64_t> followed_by;
+        };
+
+        // Publish live per-syscall counters (trapped, injected, delayed,
+        // error of delays waited),
+        // thread count and thread-discovery scan time in a shared-memory
+        // segment (/dev/shm/sysfail.<pid>), watch it with `sysfail-top <pid>`.
+        struct LiveStats {};
+
+        // Measure interception overhead on the calling thread while the
+        // session starts (before any thread is failure-injected), see
+        // Session::overhead. The thread is measured whether the selector
+        // picks it or not, and calibration leaves no trace in the session
+        // (thread ordinals, recorded decisions, profiles or live stats).
+        struct Calibrate {
+            // Syscalls timed, both with and without interception
+            const uint32_t syscalls;
+            // Enable + disable round-trips timed
+            const uint32_t toggles;
+
+            Calibrate(
+                uint32_t syscalls = 10000,
+                uint32_t toggles = 100
+            ) : syscalls(syscalls), toggles(toggles) {
+                if (syscalls == 0 || toggles == 0) {
+                    throw std::invalid_argument("Iterations must be positive");
+                }
+            }
+        };
+
+        // Record every injection decision (failure and / or delay) made for
+        // a failure-injected thread, see Session::recorded. Logs are kept
+        // in memory, 24 bytes per decision.
+        struct Record {};
+
+        struct Latency {
+            std::chrono::nanoseconds median;
+            std::chrono::nanoseconds p99;
+        };
+
+        struct Overhead {
+            // Syscall (getppid) latency without interception
+            Latency raw;
+            // Latency added by intercepting a syscall (SIGSYS delivery,
+            // dispatch and return), over the median raw latency. Does not
+            // include failure-injection decisions or injected delay.
+            Latency trap;
+            // Enabling and then disabling failure-injection on a thread
+            Latency toggle;
+        };
+
+        // Observability features, all of them are off by default
+        struct Config {
+            const std::optional<Stacks> stacks = std::nullopt;
+            const std::optional<CallSites> call_sites = std::nullopt;
+            const std::optional<LiveStats> live_stats = std::nullopt;
+            const std::optional<Calibrate> calibrate = std::nullopt;
+            const std::optional<Record> record = std::nullopt;
+        };
+    }
+
+    // Injection decisions recorded by a session (observe::Record), which
+    // a later session can apply instead of sampling (Plan::replay).
+    //
+    // Decisions are identified by the thread (numbered in the order threads
+    // were enabled) and the decision index within the thread (syscalls that
+    // matched an eligible outcome, counting from 0). Replay reproduces a
+    // run as long as threads are enabled in the same order and the plan
+    // has the same outcomes (which decide what counts as a decision).
+    namespace trace {
+        struct Event {
+            uint32_t thread;
+            uint64_t index;
+            Syscall call;
+            // Error the syscall was failed with (0 => not failed)
+            Errno fail;
+            bool fail_after;
+            std::chrono::microseconds delay;
+            bool delay_after;
+
+            bool operator==(const Event&) const = default;
+        };
+
+        struct Trace {
+            // Ordered by thread, then by index
+            std::vector<Event> events;
+            // Decisions that could not be recorded (out of memory)
+            uint64_t dropped = 0;
+
+            // Compact binary format, stable across versions of the library
+            void save(std::ostream& out) const;
+
+            static Trace load(std::istream& in);
+        };
+    }
+
     /**
      * Plan for failure injection
      */
@@ -140,20 +679,44 @@ namespace sysfail {
         const std::function<bool(pid_t)> selector;
         // Strategy for thread discovery
         const thread_discovery::Strategy thd_disc;
+        // Observability features (profiling etc)
+        const observe::Config observe;
+        // Seed for injection decisions (0 => random, see Session::seed).
+        // Each thread draws from its own stream, identified by the order in
+        // which threads were enabled and the number of decisions the thread
+        // made so far, so a thread that makes the same syscalls sees the same
+        // faults regardless of what other threads do.
+        const uint64_t seed;
+        // Apply recorded decisions instead of sampling outcomes. Decisions
+        // not in the trace don't inject anything, and probabilities,
+        // schedules and limits of outcomes are not used.
+        const std::shared_ptr<const trace::Trace> replay;
 
         Plan(
             const std::unordered_map<Syscall, const Outcome>& outcomes,
             const std::function<bool(pid_t)>& selector,
-            const thread_discovery::Strategy& thd_disc
-        ) : outcomes(outcomes), selector(selector), thd_disc(thd_disc) {}
+            const thread_discovery::Strategy& thd_disc,
+            const observe::Config& observe = {},
+            uint64_t seed = 0,
+            const std::shared_ptr<const trace::Trace>& replay = nullptr
+        ) : outcomes(outcomes),
+            selector(selector),
+            thd_disc(thd_disc),
+            observe(observe),
+            seed(seed),
+            replay(replay) {}
         Plan(const Plan& plan):
             outcomes(plan.outcomes),
             selector(plan.selector),
-            thd_disc(plan.thd_disc) {}
+            thd_disc(plan.thd_disc),
+            observe(plan.observe),
+            seed(plan.seed),
+            replay(plan.replay) {}
         Plan() :
             outcomes({}),
             selector([](pid_t) { return false; }),
-            thd_disc(thread_discovery::None{}) {}
+            thd_disc(thread_discovery::None{}),
+            seed(0) {}
     };
 
     /**
@@ -162,6 +725,15 @@ namespace sysfail {
      * Plan controls the failure and delay injection behavior while APIs on the
      * session allow test / application to control behavior at thread or
      * process level.
+     *
+     * A signal handler returns through rt_sigreturn, which on a thread
+     * being failure-injected is itself dispatched to sysfail's SIGSYS
+     * handler, so handlers must not block SIGSYS. While a session is active
+     * SIGSYS is taken out of the sa_mask of handlers that block it (eg. Go
+     * runtime's, which block every signal), including ones installed later
+     * by failure-injected threads. sigaction on those threads reports such
+     * masks as they were installed, and they are restored when the session
+     * ends.
      */
     class Session {
         std::shared_mutex lck;
@@ -186,6 +758,35 @@ namespace sysfail {
         // application to trigger a single isolated poll to discover threads and
         // can be used regardless of the thread-discovery strategy in the plan.
         void discover_threads();
+        // Write syscall time (or count) aggregated by call-stack in folded
+        // format (one `root;...;leaf value` line per stack), which can be fed
+        // directly to flamegraph.pl. Covers both live threads and threads
+        // that have been removed. Requires `observe.stacks` in the plan.
+        void dump_stacks(
+            std::ostream& out,
+            observe::Metric metric = observe::Metric::Time);
+        // Call-sites that received injected failures, most failed first.
+        // Covers both live threads and threads that have been removed.
+        // Requires `observe.call_sites` in the plan.
+        std::vector<observe::CallSite> call_sites();
+        // Replace outcomes (by syscall) of the running session with those of
+        // the given plan. Takes effect atomically across threads, threads
+        // that are failure-injected stay so (selector, thread-discovery,
+        // observability and replay settings of the given plan are not
+        // used). Returns once no thread can observe the old outcomes any
+        // longer.
+        void update(const Plan& plan);
+        // Injection decisions made so far (by live threads as well as
+        // threads that have been removed). Requires `observe.record` in the
+        // plan.
+        trace::Trace recorded();
+        // Seed in effect (picked at random if the plan did not specify one),
+        // running a plan with this seed reproduces injection decisions.
+        uint64_t seed();
+        // Interception overhead measured when the session started, eg. to
+        // correct measured latencies. Requires `observe.calibrate` in the
+        // plan.
+        observe::Overhead overhead();
     };
 }
 
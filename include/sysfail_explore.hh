@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SYSFAIL_EXPLORE_HH
+#define _SYSFAIL_EXPLORE_HH
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "sysfail.hh"
+
+// Systematic exploration of error-handling paths: the test body is run once
+// without faults to count fault points (eligible calls of each syscall), and
+// then once per point (or combination of points) with just that call failed,
+// each run in a forked worker with its own Session.
+//
+// A recorded trace (see observe::Record) that fails the body can likewise be
+// minimized, by replaying subsets of its faults in forked workers.
+//
+// Alternatively, `branch` runs the body once, and forks at every fault point
+// it reaches: the child takes the failure (and keeps branching, up to
+// `depth` failures) while the parent carries on with success. Only the
+// paths the body actually takes are explored, and each prefix is run once.
+//
+// The drivers fork, so they must be called from a single-threaded process
+// that does not have a Session running (or other children to reap).
+namespace sysfail::explore {
+    // The call at `index` among eligible calls of `call` (counting from 0,
+    // across threads, as counted by Scope::Global triggers)
+    struct Point {
+        Syscall call;
+        uint64_t index;
+
+        auto operator<=>(const Point&) const = default;
+    };
+
+    enum class Verdict {
+        Passed,
+        // body returned false or threw
+        Failed,
+        // worker died (signal, or exited without reporting)
+        Crashed,
+        // worker did not finish within the timeout (and was killed)
+        Hung,
+        // body passed, but took longer than allowed by `slowdown`
+        Slow
+    };
+
+    struct Result {
+        std::vector<Point> points;
+        Verdict verdict;
+        std::chrono::nanoseconds elapsed;
+    };
+
+    struct Config {
+        // Syscalls to explore and the error each is failed with
+        const std::map<Syscall, Errno> errors;
+        // Points failed together in one run (1 => every point alone,
+        // 2 => also every pair of points), at most `max_depth` for `branch`
+        const uint32_t depth = 1;
+        // Concurrent workers (0 => one per CPU), for `branch` this bounds
+        // branches alive at once
+        const uint32_t workers = 0;
+        // Workers running longer than this are killed
+        const std::chrono::milliseconds timeout = std::chrono::seconds(10);
+        // Passing runs slower than this multiple of the fault-free run are
+        // reported as Slow (0 => never)
+        const double slowdown = 0;
+        // Threads the body starts are found (and failure-injected) with this
+        const thread_discovery::Strategy thd_disc = thread_discovery::None{};
+    };
+
+    struct Report {
+        // Eligible calls by syscall in the fault-free run
+        std::map<Syscall, uint64_t> calls;
+        // Time the fault-free run took
+        std::chrono::nanoseconds baseline;
+        // Runs made with faults
+        uint64_t runs = 0;
+        // Runs that did not pass, in the order points were enumerated
+        std::vector<Result> results;
+        // Points a branch reached while all workers were busy, and did not
+        // branch at (only `branch` skips points)
+        uint64_t skipped = 0;
+    };
+
+    const uint32_t max_depth = 8;
+
+    struct Minimal {
+        // Smallest subset of the recorded faults found to still fail the
+        // body (no single fault of it can be dropped)
+        trace::Trace faults;
+        // How the body fails with just these faults
+        Verdict verdict;
+        // Time the fault-free replay took
+        std::chrono::nanoseconds baseline;
+        // Replays made
+        uint64_t runs = 0;
+    };
+
+    // Test body, returns false (or throws) to signal failure
+    using Body = std::function<bool()>;
+
+    // The plan a trace was recorded with, replaying the given faults instead
+    // (see Plan::replay)
+    using PlanFor = std::function<
+        Plan(const std::shared_ptr<const trace::Trace>& replay)>;
+
+    // Throws std::runtime_error if the body does not pass without faults.
+    Report run(const Config& cfg, const Body& body);
+
+    // Explores by forking at fault points (see above). The body must stay
+    // single-threaded (`thd_disc` must be None). The fault-free run itself
+    // is not subject to the timeout, it only waits for a free worker before
+    // branching, while branches skip points when none is free. Slowdowns
+    // are judged against a separate fault-free run (made first, in a
+    // worker), with time spent waiting for workers and forking left out.
+    //
+    // Throws std::runtime_error if the body does not pass without faults.
+    Report branch(const Config& cfg, const Body& body);
+
+    // Shrinks the faults of a trace that fails the body (including crashes,
+    // hangs and slowdowns) by delta-debugging: subsets are replayed in
+    // forked workers until a minimal failing one is found. Only `workers`,
+    // `timeout` and `slowdown` of the config apply, the plan comes from
+    // `plan_for`. Replay must be deterministic for the result to be minimal.
+    //
+    // Throws std::runtime_error if the body does not pass without faults, or
+    // does not fail with all of them.
+    Minimal minimize(
+        const Config& cfg,
+        const trace::Trace& failing,
+        const PlanFor& plan_for,
+        const Body& body);
+}
+
+#endif
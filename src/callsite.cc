@@ -0,0 +1,236 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+
+#include "callsite.hh"
+
+namespace {
+    uint64_t hash_site(sysfail::Syscall call, const uintptr_t* f, uint32_t depth) {
+        uint64_t h = 0x9e3779b97f4a7c15ULL ^ (static_cast<uint64_t>(call) << 32);
+        for (uint32_t i = 0; i < depth; i++) {
+            h ^= f[i];
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+        }
+        return h ? h : 1; // 0 marks an empty slot
+    }
+
+    uint32_t pow2_at_least(uint32_t n) {
+        uint32_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    const int header_sz = 5;
+}
+
+sysfail::CallSiteTable::CallSiteTable(
+    const observe::CallSites& cfg
+) : max_frames(cfg.max_frames),
+    capacity(cfg.capacity),
+    mask(pow2_at_least(cfg.capacity * 2) - 1),
+    slots(std::make_unique<Slot[]>(mask + 1)),
+    frames(std::make_unique_for_overwrite<uintptr_t[]>(
+        static_cast<size_t>(cfg.capacity) * cfg.max_frames)) {}
+
+void sysfail::CallSiteTable::next(Syscall call) {
+    if (!pending) return;
+    if (busy.test_and_set(std::memory_order_acquire)) return;
+
+    auto s = pending;
+    pending = nullptr;
+    auto recorded = false;
+    for (auto& f : s->followups) {
+        if (f.count == 0) f.call = call;
+        if (f.call == call) {
+            f.count++;
+            recorded = true;
+            break;
+        }
+    }
+    if (!recorded) s->other++;
+
+    busy.clear(std::memory_order_release);
+}
+
+void sysfail::CallSiteTable::injected(
+    Syscall call,
+    const uintptr_t* f,
+    uint32_t depth
+) {
+    if (busy.test_and_set(std::memory_order_acquire)) return;
+
+    auto h = hash_site(call, f, depth);
+    pending = nullptr;
+    for (auto i = h & mask; ; i = (i + 1) & mask) {
+        auto& s = slots[i];
+        if (s.hash == h &&
+            s.call == call &&
+            s.depth == depth &&
+            std::equal(f, f + depth, &frames[s.frames_at])) {
+            pending = &s;
+            break;
+        }
+        if (s.hash == 0) {
+            if (used < capacity) {
+                s.frames_at = used++ * max_frames;
+                s.call = call;
+                s.depth = depth;
+                std::copy(f, f + depth, &frames[s.frames_at]);
+                s.hash = h;
+                pending = &s;
+            }
+            break;
+        }
+    }
+    if (pending) pending->injected++;
+
+    busy.clear(std::memory_order_release);
+}
+
+size_t sysfail::CallSiteTable::copy_size() const {
+    return static_cast<size_t>(capacity) *
+        (header_sz + 2 * followup_slots + max_frames);
+}
+
+void sysfail::CallSiteTable::copy(std::vector<uint64_t>& out) {
+    while (busy.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    for (uint32_t i = 0; i <= mask; i++) {
+        const auto& s = slots[i];
+        if (s.hash == 0) continue;
+        auto followups = std::count_if(
+            std::begin(s.followups),
+            std::end(s.followups),
+            [](const auto& f) { return f.count > 0; });
+        out.push_back(s.call);
+        out.push_back(s.depth);
+        out.push_back(s.injected);
+        out.push_back(s.other);
+        out.push_back(followups);
+        for (const auto& f : s.followups) {
+            if (f.count == 0) continue;
+            out.push_back(f.call);
+            out.push_back(f.count);
+        }
+        out.insert(
+            out.end(),
+            &frames[s.frames_at],
+            &frames[s.frames_at] + s.depth);
+    }
+    busy.clear(std::memory_order_release);
+}
+
+sysfail::CallSiteProfile::CallSiteProfile(
+    const observe::CallSites& cfg,
+    const Mapping& m
+) : cfg(cfg), unwinder(m) {}
+
+sysfail::CallSiteTable* sysfail::CallSiteProfile::attach() {
+    auto t = std::make_unique<CallSiteTable>(cfg);
+    auto ptr = t.get();
+    std::lock_guard<std::mutex> l(mtx);
+    live.emplace(ptr, std::move(t));
+    return ptr;
+}
+
+void sysfail::CallSiteProfile::merge(
+    const std::vector<uint64_t>& raw,
+    std::map<Key, Totals>& into
+) {
+    for (size_t i = 0; i < raw.size(); ) {
+        auto call = static_cast<Syscall>(raw[i]);
+        auto depth = raw[i + 1];
+        auto followups = raw[i + 4];
+        auto frames_at = i + header_sz + 2 * followups;
+        auto& t = into[{
+            call,
+            std::vector<uintptr_t>(
+                raw.begin() + frames_at,
+                raw.begin() + frames_at + depth)}];
+        t.injected += raw[i + 2];
+        for (size_t f = 0; f < followups; f++) {
+            auto at = i + header_sz + 2 * f;
+            t.followed_by[static_cast<Syscall>(raw[at])] += raw[at + 1];
+        }
+        if (raw[i + 3]) t.followed_by[-1] += raw[i + 3];
+        i = frames_at + depth;
+    }
+}
+
+void sysfail::CallSiteProfile::detach(CallSiteTable* t) {
+    std::unique_ptr<CallSiteTable> owned;
+    {
+        std::lock_guard<std::mutex> l(mtx);
+        auto it = live.find(t);
+        if (it == live.end()) return;
+        owned = std::move(it->second);
+        live.erase(it);
+    }
+    std::vector<uint64_t> raw;
+    raw.reserve(owned->copy_size());
+    owned->copy(raw);
+    std::lock_guard<std::mutex> l(mtx);
+    merge(raw, retired);
+}
+
+void sysfail::CallSiteProfile::record(
+    CallSiteTable* t,
+    Syscall call,
+    const greg_t* regs
+) {
+    uintptr_t frames[16];
+    auto depth = unwinder.capture(regs, frames, cfg.max_frames);
+    t->injected(call, frames, depth);
+}
+
+std::vector<sysfail::observe::CallSite> sysfail::CallSiteProfile::report() {
+    std::map<Key, Totals> totals;
+    {
+        std::lock_guard<std::mutex> l(mtx);
+        totals = retired;
+        for (const auto& [ptr, t] : live) {
+            std::vector<uint64_t> raw;
+            raw.reserve(t->copy_size());
+            t->copy(raw);
+            merge(raw, totals);
+        }
+    }
+
+    auto m = get_mmap(getpid()).value_or(Mapping{});
+    std::vector<observe::CallSite> sites;
+    for (const auto& [key, t] : totals) {
+        observe::CallSite site{key.first, {}, t.injected, t.followed_by};
+        for (auto addr : key.second) {
+            observe::Frame f{addr, "", 0, m.symbolize(addr)};
+            if (auto r = m.find(addr)) {
+                f.module = r->path;
+                f.offset = addr - r->start + r->offset;
+            }
+            site.frames.push_back(std::move(f));
+        }
+        sites.push_back(std::move(site));
+    }
+    std::stable_sort(
+        sites.begin(),
+        sites.end(),
+        [](const auto& a, const auto& b) { return a.injected > b.injected; });
+    return sites;
+}
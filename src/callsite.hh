@@ -0,0 +1,112 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CALLSITE_HH
+#define _CALLSITE_HH
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <ucontext.h>
+
+#include "sysfail.hh"
+#include "map.hh"
+#include "stack.hh"
+
+namespace sysfail {
+    // Fixed-capacity per-thread table of call-sites that received injected
+    // failures. Only the owning thread writes to it, readers (report) briefly
+    // lock it to take a copy.
+    class CallSiteTable {
+        static constexpr int followup_slots = 6;
+
+        struct Followup {
+            Syscall call;
+            uint64_t count;
+        };
+
+        struct Slot {
+            uint64_t hash;
+            Syscall call;
+            uint32_t depth;
+            uint32_t frames_at;
+            uint64_t injected;
+            Followup followups[followup_slots];
+            uint64_t other; // followups that didn't fit
+        };
+
+        const uint32_t max_frames;
+        const uint32_t capacity;
+        const uint32_t mask;
+        std::unique_ptr<Slot[]> slots;
+        std::unique_ptr<uintptr_t[]> frames;
+        uint32_t used = 0;
+        Slot* pending = nullptr; // site of the last injected failure
+        std::atomic_flag busy = ATOMIC_FLAG_INIT;
+
+    public:
+        CallSiteTable(const observe::CallSites& cfg);
+
+        // Called from the handler for every intercepted syscall, attributes
+        // the syscall to the call-site that received the previous failure.
+        void next(Syscall call);
+
+        // Called from the handler when a failure is injected
+        void injected(Syscall call, const uintptr_t* f, uint32_t depth);
+
+        // Appends `call, depth, injected, other, followups, (call, count)...,
+        // frames...` records to `out`. Does not allocate while holding the
+        // table.
+        void copy(std::vector<uint64_t>& out);
+
+        size_t copy_size() const;
+    };
+
+    class CallSiteProfile {
+        struct Totals {
+            uint64_t injected = 0;
+            std::map<Syscall, uint64_t> followed_by;
+        };
+        using Key = std::pair<Syscall, std::vector<uintptr_t>>;
+
+        const observe::CallSites cfg;
+        const Unwinder unwinder;
+        std::mutex mtx;
+        std::unordered_map<CallSiteTable*, std::unique_ptr<CallSiteTable>> live;
+        std::map<Key, Totals> retired;
+
+        void merge(const std::vector<uint64_t>& raw, std::map<Key, Totals>& into);
+
+    public:
+        CallSiteProfile(const observe::CallSites& cfg, const Mapping& m);
+
+        // Per-thread table, must be detached before the thread is forgotten
+        CallSiteTable* attach();
+
+        // Folds the thread's call-sites into process-wide totals
+        void detach(CallSiteTable* t);
+
+        void record(CallSiteTable* t, Syscall call, const greg_t* regs);
+
+        // Resolves frames against the current process mapping
+        std::vector<observe::CallSite> report();
+    };
+}
+
+#endif
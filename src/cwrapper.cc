@@ -20,31 +20,10 @@ extern "C" {
 }
 #include "session.hh"
 
-extern "C" {
+namespace {
     using namespace sysfail;
 
-    int sysfail_syscall(const greg_t* regs) {
-        return static_cast<int>(regs[REG_RAX]);
-    }
-
-    greg_t sysfail_syscall_arg(const greg_t* regs, int arg) {
-        switch (arg) {
-            case 0: return regs[REG_RDI];
-            case 1: return regs[REG_RSI];
-            case 2: return regs[REG_RDX];
-            case 3: return regs[REG_R10];
-            case 4: return regs[REG_R8];
-            case 5: return regs[REG_R9];
-            default:
-                std::cerr << "Invalid syscall argument index: " << arg
-                          << ", aborting." << std::endl;
-                std::abort();
-        }
-    }
-
-    sysfail_session_t* sysfail_start(const sysfail_plan_t *c_plan) {
-        if (!c_plan) return nullptr;
-
+    Plan to_plan(const sysfail_plan_t *c_plan, uint64_t seed) {
         std::unordered_map<Syscall, const Outcome> outcomes;
         for (auto o = c_plan->syscall_outcomes; o != nullptr; o = o->next) {
             std::map<Errno, double> error_weights;
@@ -89,10 +68,43 @@ extern "C" {
                 }
             }()};
 
-        auto session = new sysfail::Session({
-            outcomes,
-            selector,
-            tdisc_strategy});
+        return {outcomes, selector, tdisc_strategy, {}, seed};
+    }
+}
+
+extern "C" {
+    using namespace sysfail;
+
+    int sysfail_syscall(const greg_t* regs) {
+        return static_cast<int>(regs[REG_RAX]);
+    }
+
+    greg_t sysfail_syscall_arg(const greg_t* regs, int arg) {
+        switch (arg) {
+            case 0: return regs[REG_RDI];
+            case 1: return regs[REG_RSI];
+            case 2: return regs[REG_RDX];
+            case 3: return regs[REG_R10];
+            case 4: return regs[REG_R8];
+            case 5: return regs[REG_R9];
+            default:
+                std::cerr << "Invalid syscall argument index: " << arg
+                          << ", aborting." << std::endl;
+                std::abort();
+        }
+    }
+
+    sysfail_session_t* sysfail_start(const sysfail_plan_t *c_plan) {
+        return sysfail_start_seeded(c_plan, 0);
+    }
+
+    sysfail_session_t* sysfail_start_seeded(
+        const sysfail_plan_t *c_plan,
+        uint64_t seed
+    ) {
+        if (!c_plan) return nullptr;
+
+        auto session = new sysfail::Session(to_plan(c_plan, seed));
         return new sysfail_session_t{
             .data = session,
             .stop = [](sysfail_session_t* s) {
@@ -113,6 +125,14 @@ extern "C" {
             },
             .discover_threads = [](sysfail_session_t* s) {
                 static_cast<sysfail::Session*>(s->data)->discover_threads();
+            },
+            .update = [](sysfail_session_t* s, const sysfail_plan_t* p) {
+                if (!p) return;
+                auto session = static_cast<sysfail::Session*>(s->data);
+                session->update(to_plan(p, session->seed()));
+            },
+            .seed = [](sysfail_session_t* s) {
+                return static_cast<sysfail::Session*>(s->data)->seed();
             }};
     }
 }
@@ -0,0 +1,114 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cpuid.h>
+#include <mutex>
+#include <time.h>
+#include <x86intrin.h>
+
+#include "delay.hh"
+#include "syscall.hh"
+
+using namespace std::chrono_literals;
+
+namespace {
+    using std::chrono::nanoseconds;
+
+    // 0 => TSC is not usable, spin on the clock instead
+    std::atomic<double> ns_per_tick{0};
+    // sleeps end this much ahead of the deadline, to be spun out
+    std::atomic<int64_t> slack_ns{100'000};
+
+    // Served by the vDSO, so never trapped
+    nanoseconds now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return std::chrono::seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec);
+    }
+
+    // Ticks at a constant rate regardless of frequency scaling and sleep
+    // states
+    bool invariant_tsc() {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+        return edx & (1 << 8);
+    }
+
+    void sleep_until(nanoseconds t) {
+        timespec ts{
+            static_cast<time_t>(t.count() / 1'000'000'000),
+            static_cast<long>(t.count() % 1'000'000'000)};
+        // absolute deadline, so resuming after a signal doesn't extend it
+        while (sysfail::syscall(
+                   CLOCK_MONOTONIC,
+                   TIMER_ABSTIME,
+                   reinterpret_cast<uint64_t>(&ts),
+                   0,
+                   0,
+                   0,
+                   SYS_clock_nanosleep) == -EINTR);
+    }
+
+    // The TSC is cheaper to read than the clock, but its rate is only
+    // estimated, so the clock has the final say (each round spins out most
+    // of what is left)
+    void spin_until(nanoseconds t) {
+        auto npt = ns_per_tick.load(std::memory_order_relaxed);
+        for (auto rest = t - now(); rest > 0ns; rest = t - now()) {
+            if (npt > 0) {
+                auto end = __rdtsc() + static_cast<uint64_t>(rest.count() / npt);
+                while (__rdtsc() < end) _mm_pause();
+            } else {
+                _mm_pause();
+            }
+        }
+    }
+}
+
+void sysfail::delay::calibrate() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+        if (invariant_tsc()) {
+            auto t0 = now();
+            auto c0 = __rdtsc();
+            while (now() - t0 < 1ms) _mm_pause();
+            auto t1 = now();
+            auto c1 = __rdtsc();
+            ns_per_tick.store(
+                static_cast<double>((t1 - t0).count()) / (c1 - c0));
+        }
+        // timer slack plus wake-up latency, the worst one seen is kept so
+        // sleeps rarely overshoot (bounded, to not spin for too long)
+        nanoseconds worst(0);
+        for (int i = 0; i < 8; i++) {
+            auto target = now() + 20us;
+            sleep_until(target);
+            worst = std::max(worst, now() - target);
+        }
+        slack_ns.store(std::min<nanoseconds>(worst + 2us, 1ms).count());
+    });
+}
+
+std::chrono::nanoseconds sysfail::delay::wait(std::chrono::nanoseconds d) {
+    auto start = now();
+    auto deadline = start + d;
+    auto slack = nanoseconds(slack_ns.load(std::memory_order_relaxed));
+    if (d > slack) sleep_until(deadline - slack);
+    spin_until(deadline);
+    return now() - start;
+}
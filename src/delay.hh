@@ -0,0 +1,35 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DELAY_HH
+#define _DELAY_HH
+
+#include <chrono>
+
+// Injected delays, precise down to a few microseconds: the bulk of a delay
+// is slept (absolute-deadline raw clock_nanosleep, so the sleep is neither
+// trapped nor stretched by interruptions) and the remainder, which a sleep
+// would overshoot, is spun on the TSC.
+namespace sysfail::delay {
+    // Measures TSC rate and sleep overshoot (once per process, later calls
+    // return right away). Not handler-safe, sessions calibrate on start.
+    void calibrate();
+
+    // Waits for `d` and returns the time actually waited, handler-safe
+    std::chrono::nanoseconds wait(std::chrono::nanoseconds d);
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "device.hh"
+#include "helpers.hh"
+#include "iov.hh"
+#include "syscall.hh"
+
+sysfail::Device::Device(
+    std::chrono::microseconds seek,
+    uint64_t bytes_per_sec,
+    uint32_t queue_depth
+) : seek(seek), bytes_per_sec(bytes_per_sec), queue_depth(queue_depth) {
+    if (seek.count() < 0) {
+        throw std::invalid_argument("Device seek time must not be negative");
+    }
+    if (bytes_per_sec == 0) {
+        throw std::invalid_argument("Device transfer rate must be positive");
+    }
+    if (queue_depth == 0 || queue_depth > max_queue_depth) {
+        throw std::invalid_argument(
+            "Device queue depth must be in [1, " +
+            std::to_string(max_queue_depth) + "]");
+    }
+}
+
+sysfail::DeviceModel::DeviceModel(
+    const Device& d
+) : seek_ns(std::chrono::nanoseconds(d.seek).count()),
+    ns_per_byte(1e9 / d.bytes_per_sec),
+    queue_depth(d.queue_depth),
+    next_offset(new std::atomic<int64_t>[max_fds]),
+    busy_until(new std::atomic<int64_t>[d.queue_depth]) {
+    for (size_t i = 0; i < max_fds; i++) next_offset[i] = -1;
+    for (uint32_t i = 0; i < queue_depth; i++) busy_until[i] = 0;
+}
+
+bool sysfail::DeviceModel::supports(Syscall call) {
+    switch (call) {
+        case SYS_read:
+        case SYS_write:
+        case SYS_pread64:
+        case SYS_pwrite64:
+        case SYS_readv:
+        case SYS_writev:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool sysfail::DeviceModel::seeks(const greg_t* regs, int64_t bytes) {
+    auto fd = regs[REG_RDI];
+    if (fd < 0 || static_cast<size_t>(fd) >= max_fds) return false;
+    int64_t offset;
+    auto call = regs[REG_RAX];
+    if (call == SYS_pread64 || call == SYS_pwrite64) {
+        offset = regs[REG_R10];
+    } else {
+        // position of the fd, the call is made from there (raw, so it isn't
+        // trapped)
+        offset = sysfail::syscall(fd, 0, SEEK_CUR, 0, 0, 0, SYS_lseek);
+        if (offset < 0) return false; // eg. a pipe, always sequential
+    }
+    auto prev = next_offset[fd].exchange(
+        offset + bytes,
+        std::memory_order_relaxed);
+    return prev != offset;
+}
+
+std::chrono::nanoseconds sysfail::DeviceModel::admit(
+    const greg_t* regs,
+    std::chrono::nanoseconds now
+) {
+    auto call = regs[REG_RAX];
+    int64_t bytes = 0;
+    if (call == SYS_readv || call == SYS_writev) {
+        auto read = iov::lengths(regs, [&](size_t len) {
+            bytes += len;
+            return true;
+        });
+        // the kernel fails the call, nothing is transferred
+        if (!read) bytes = 0;
+    } else {
+        bytes = regs[REG_RDX];
+    }
+    auto service = std::llround(bytes * ns_per_byte) +
+        (seeks(regs, bytes) ? seek_ns : 0);
+
+    // take the slot that frees up first, starting on it once it does
+    while (true) {
+        uint32_t slot = 0;
+        auto earliest = std::numeric_limits<int64_t>::max();
+        for (uint32_t i = 0; i < queue_depth; i++) {
+            auto b = busy_until[i].load(std::memory_order_relaxed);
+            if (b < earliest) {
+                earliest = b;
+                slot = i;
+            }
+        }
+        auto done = std::max(earliest, now.count()) + service;
+        if (busy_until[slot].compare_exchange_weak(
+                earliest,
+                done,
+                std::memory_order_relaxed)) {
+            return std::chrono::nanoseconds(done - now.count());
+        }
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _DEVICE_HH
+#define _DEVICE_HH
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <sys/ucontext.h>
+
+#include "sysfail.hh"
+
+namespace sysfail {
+    // Serves calls for an outcome's Device, safe to use from the handler (does
+    // not allocate or block). The device is a set of queue slots, each busy
+    // until the call it serves is done; a call takes the slot that frees up
+    // first.
+    class DeviceModel {
+        const int64_t seek_ns;
+        const double ns_per_byte;
+        const uint32_t queue_depth;
+        // offset the last call on each fd ended at (-1 => none yet), calls on
+        // fds beyond max_fds never seek
+        std::unique_ptr<std::atomic<int64_t>[]> next_offset;
+        std::unique_ptr<std::atomic<int64_t>[]> busy_until;
+
+        // Whether the call starts away from where the previous one ended
+        bool seeks(const greg_t* regs, int64_t bytes);
+
+    public:
+        explicit DeviceModel(const Device& d);
+
+        static bool supports(Syscall call);
+
+        // Time the call must be held for until the device is done with it
+        // (readv / writev whose iovecs can't be read transfer nothing)
+        std::chrono::nanoseconds admit(
+            const greg_t* regs,
+            std::chrono::nanoseconds now);
+    };
+}
+
+#endif
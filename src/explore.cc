@@ -0,0 +1,896 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <thread>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sysfail_explore.hh"
+#include "session.hh"
+#include "syscall.hh"
+
+using namespace std::chrono_literals;
+
+namespace {
+    using namespace sysfail;
+    using namespace sysfail::explore;
+    using Clock = std::chrono::steady_clock;
+
+    // What a worker reports back over its pipe
+    struct Ran {
+        uint8_t passed;
+        int64_t elapsed_ns;
+    };
+
+    using Counters = std::map<Syscall, std::shared_ptr<std::atomic<uint64_t>>>;
+
+    // Fails calls at the given indices of each syscall, and counts the rest.
+    // Syscalls without indices are only counted. Calls are only counted (or
+    // failed) while `armed`, so session start / stop doesn't shift indices.
+    Plan mk_plan(
+        const Config& cfg,
+        const std::map<Syscall, std::vector<uint64_t>>& fail_at,
+        Counters& counters,
+        const std::shared_ptr<std::atomic<bool>>& armed
+    ) {
+        std::unordered_map<Syscall, const Outcome> outcomes;
+        for (const auto& [call, indices] : fail_at) {
+            auto c = std::make_shared<std::atomic<uint64_t>>(0);
+            counters[call] = c;
+            outcomes.insert({call, Outcome{
+                {indices.empty() ? 0.0 : 1.0, 0},
+                {0, 0},
+                0us,
+                {{cfg.errors.at(call), 1}},
+                [c, indices, armed](const greg_t*) {
+                    if (!armed->load()) return false;
+                    auto i = c->fetch_add(1);
+                    return std::binary_search(indices.begin(), indices.end(), i);
+                }}});
+        }
+        return Plan(outcomes, [](pid_t) { return true; }, cfg.thd_disc);
+    }
+
+    // Makes the plan a worker runs the body under
+    using Setup = std::function<
+        Plan(Counters&, const std::shared_ptr<std::atomic<bool>>& armed)>;
+
+    Setup failing_at(
+        const Config& cfg,
+        const std::map<Syscall, std::vector<uint64_t>>& fail_at
+    ) {
+        return [&cfg, fail_at](Counters& counters, const auto& armed) {
+            return mk_plan(cfg, fail_at, counters, armed);
+        };
+    }
+
+    // Passing results slower than allowed become Slow
+    void judge(
+        const Config& cfg,
+        std::chrono::nanoseconds baseline,
+        Result& r
+    ) {
+        if (r.verdict == Verdict::Passed &&
+            cfg.slowdown > 0 &&
+            r.elapsed > baseline * cfg.slowdown) {
+            r.verdict = Verdict::Slow;
+        }
+    }
+
+    void write_all(int fd, const void* buf, size_t len) {
+        auto p = static_cast<const char*>(buf);
+        while (len > 0) {
+            auto w = ::write(fd, p, len);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return;
+            p += w;
+            len -= w;
+        }
+    }
+
+    bool read_all(int fd, void* buf, size_t len) {
+        auto p = static_cast<char*>(buf);
+        while (len > 0) {
+            auto r = ::read(fd, p, len);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            p += r;
+            len -= r;
+        }
+        return true;
+    }
+
+    // Runs the body in a worker (forked child), never returns. Reports pass
+    // / fail and time, followed by call counts (in syscall order).
+    [[noreturn]] void work(int fd, const Setup& setup, const Body& body) {
+        Ran ran{0, 0};
+        Counters counters;
+        auto armed = std::make_shared<std::atomic<bool>>(false);
+        {
+            Session s(setup(counters, armed));
+            auto start = Clock::now();
+            armed->store(true);
+            try {
+                ran.passed = body() ? 1 : 0;
+            } catch (...) {
+                ran.passed = 0;
+            }
+            armed->store(false);
+            ran.elapsed_ns = (Clock::now() - start).count();
+        }
+        write_all(fd, &ran, sizeof(ran));
+        for (const auto& [call, c] : counters) {
+            uint64_t n = c->load();
+            write_all(fd, &n, sizeof(n));
+        }
+        _exit(0);
+    }
+
+    struct Worker {
+        pid_t pid;
+        int fd;
+        size_t run;
+        Clock::time_point deadline;
+    };
+
+    Worker spawn(
+        const Config& cfg,
+        const Setup& setup,
+        const Body& body,
+        size_t run,
+        const std::vector<Worker>& others
+    ) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            throw std::runtime_error(
+                std::string("Failed to create pipe: ") + std::strerror(errno));
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+        auto pid = fork();
+        if (pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            throw std::runtime_error(
+                std::string("Failed to fork: ") + std::strerror(errno));
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            for (const auto& w : others) close(w.fd);
+            work(fds[1], setup, body);
+        }
+        // siblings forked later must not hold the write end, or a worker
+        // that dies would not be noticed
+        close(fds[1]);
+        return {pid, fds[0], run, Clock::now() + cfg.timeout};
+    }
+
+    // Reaps the worker, `counts` receives call counts if it reported
+    Result reap(
+        const Worker& w,
+        bool timed_out,
+        size_t syscalls,
+        std::vector<uint64_t>* counts
+    ) {
+        Result r{{}, Verdict::Crashed, 0ns};
+        if (timed_out) {
+            kill(w.pid, SIGKILL);
+            r.verdict = Verdict::Hung;
+        } else if (Ran ran; read_all(w.fd, &ran, sizeof(ran))) {
+            r.verdict = ran.passed ? Verdict::Passed : Verdict::Failed;
+            r.elapsed = std::chrono::nanoseconds(ran.elapsed_ns);
+            if (counts) {
+                counts->resize(syscalls);
+                if (!read_all(w.fd, counts->data(), syscalls * sizeof(uint64_t))) {
+                    r.verdict = Verdict::Crashed;
+                }
+            }
+        }
+        close(w.fd);
+        int status;
+        while (waitpid(w.pid, &status, 0) < 0 && errno == EINTR);
+        return r;
+    }
+
+    // Enumerates combinations of `size` out of `n` points, in lexicographic
+    // order, for sizes 1 up to `depth`
+    class Combinations {
+        const size_t n;
+        const uint32_t depth;
+        std::vector<size_t> c;
+
+    public:
+        Combinations(size_t n, uint32_t depth) : n(n), depth(depth), c{0} {
+            if (n == 0) c.clear();
+        }
+
+        const std::vector<size_t>* current() const {
+            return c.empty() ? nullptr : &c;
+        }
+
+        void advance() {
+            auto k = c.size();
+            for (size_t i = k; i-- > 0;) {
+                if (c[i] < n - k + i) {
+                    c[i]++;
+                    for (auto j = i + 1; j < k; j++) c[j] = c[j - 1] + 1;
+                    return;
+                }
+            }
+            if (k < depth && k < n) {
+                c.resize(k + 1);
+                for (size_t j = 0; j <= k; j++) c[j] = j;
+            } else {
+                c.clear();
+            }
+        }
+    };
+
+    using Events = std::vector<trace::Event>;
+
+    Setup replaying(const PlanFor& plan_for, const Events& events) {
+        auto t = std::make_shared<const trace::Trace>(trace::Trace{events, 0});
+        return [&plan_for, t](Counters&, const auto&) { return plan_for(t); };
+    }
+
+    // Replays candidates (`workers` at once), and returns the first one (in
+    // order) that does not pass along with its result. Candidates after a
+    // reproducing one are not started (or are killed), those before it still
+    // run, so the pick does not depend on timing.
+    std::optional<std::pair<size_t, Result>> first_failing(
+        const Config& cfg,
+        std::chrono::nanoseconds baseline,
+        const std::vector<Events>& candidates,
+        const PlanFor& plan_for,
+        const Body& body,
+        uint64_t& runs
+    ) {
+        auto workers = cfg.workers
+            ? cfg.workers
+            : std::max(1u, std::thread::hardware_concurrency());
+        std::optional<std::pair<size_t, Result>> found;
+        std::vector<Worker> running;
+        size_t next = 0;
+        auto wanted = [&](size_t i) { return !found || i < found->first; };
+
+        while ((next < candidates.size() && wanted(next)) || !running.empty()) {
+            while (next < candidates.size() &&
+                   wanted(next) &&
+                   running.size() < workers) {
+                running.push_back(spawn(
+                    cfg,
+                    replaying(plan_for, candidates[next]),
+                    body,
+                    next,
+                    running));
+                next++;
+                runs++;
+            }
+
+            std::vector<pollfd> fds;
+            auto now = Clock::now();
+            auto deadline = running.front().deadline;
+            for (const auto& w : running) {
+                fds.push_back({w.fd, POLLIN, 0});
+                deadline = std::min(deadline, w.deadline);
+            }
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - now) + 1ms;
+            if (poll(fds.data(), fds.size(), std::max(wait.count(), 0L)) < 0 &&
+                errno != EINTR) {
+                throw std::runtime_error(
+                    std::string("Failed to poll workers: ") +
+                    std::strerror(errno));
+            }
+
+            now = Clock::now();
+            std::vector<Worker> still_running;
+            for (size_t i = 0; i < running.size(); i++) {
+                const auto& w = running[i];
+                auto timed_out = now >= w.deadline;
+                if (fds[i].revents || timed_out) {
+                    auto r = reap(w, timed_out && !fds[i].revents, 0, nullptr);
+                    judge(cfg, baseline, r);
+                    if (r.verdict != Verdict::Passed && wanted(w.run)) {
+                        found = {w.run, std::move(r)};
+                    }
+                } else {
+                    still_running.push_back(w);
+                }
+            }
+            running.clear();
+            for (const auto& w : still_running) {
+                if (wanted(w.run)) {
+                    running.push_back(w);
+                } else {
+                    reap(w, true, 0, nullptr);
+                }
+            }
+        }
+        return found;
+    }
+
+    // Runs the body once without faults (in a worker), returns its time.
+    // `counts` receives eligible calls (in syscall order).
+    std::chrono::nanoseconds fault_free(
+        const Config& cfg,
+        const Body& body,
+        std::vector<uint64_t>* counts
+    ) {
+        std::map<Syscall, std::vector<uint64_t>> count_only;
+        for (const auto& [call, err] : cfg.errors) count_only[call] = {};
+
+        auto w = spawn(cfg, failing_at(cfg, count_only), body, 0, {});
+        pollfd p{w.fd, POLLIN, 0};
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            cfg.timeout);
+        while (poll(&p, 1, wait.count()) < 0 && errno == EINTR);
+        auto r = reap(w, p.revents == 0, cfg.errors.size(), counts);
+        if (r.verdict != Verdict::Passed) {
+            throw std::runtime_error("Test body does not pass without faults");
+        }
+        return r.elapsed;
+    }
+
+    // Shared (across forks) by all processes of a `branch` exploration,
+    // followed by the fault-free run's call counts (in syscall order)
+    struct Shared {
+        // Branches that may still be started (futex word)
+        std::atomic<int32_t> free;
+
+        uint64_t* calls() {
+            return reinterpret_cast<uint64_t*>(this + 1);
+        }
+    };
+
+    static_assert(std::atomic<int32_t>::is_always_lock_free);
+
+    void release(Shared* sh) {
+        sh->free.fetch_add(1);
+        sysfail::syscall(
+            reinterpret_cast<uint64_t>(&sh->free),
+            FUTEX_WAKE,
+            1,
+            0,
+            0,
+            0,
+            SYS_futex);
+    }
+
+    // Takes a free slot, waits for one only if asked to. Called from the
+    // handler, so raw syscalls only.
+    bool acquire(Shared* sh, bool wait) {
+        while (true) {
+            auto f = sh->free.load();
+            while (f > 0) {
+                if (sh->free.compare_exchange_weak(f, f - 1)) return true;
+            }
+            if (!wait) return false;
+            // bounded wait, a slot released by the driver on behalf of a
+            // dead branch may come without a wake-up
+            timespec ts{0, 10'000'000};
+            sysfail::syscall(
+                reinterpret_cast<uint64_t>(&sh->free),
+                FUTEX_WAIT,
+                static_cast<uint32_t>(f),
+                reinterpret_cast<uint64_t>(&ts),
+                0,
+                0,
+                SYS_futex);
+        }
+    }
+
+    // What every `branch` process reports (one write, below PIPE_BUF, so
+    // records from concurrent writers do not interleave)
+    struct Record {
+        enum Kind : uint8_t { Start, Finish };
+
+        Kind kind;
+        uint8_t passed;
+        uint8_t depth;
+        int32_t pid;
+        int64_t elapsed_ns;
+        uint64_t skipped;
+        Point points[max_depth];
+    };
+
+    static_assert(sizeof(Record) <= PIPE_BUF);
+
+    // State of the current `branch` process, copied by every fork
+    struct Branching {
+        const Config& cfg;
+        Shared* const shared;
+        const int fd;
+        std::map<Syscall, uint64_t> calls;
+        bool armed = false;
+        bool root = true;
+        uint8_t depth = 0;
+        Point path[max_depth];
+        Clock::time_point start;
+        // Time spent waiting for a free slot and forking (by this process
+        // and, for a branch, its ancestors before it was forked)
+        std::chrono::nanoseconds paused{0};
+        uint64_t skipped = 0;
+    };
+
+    void send(const Branching& b, Record::Kind kind, bool passed) {
+        Record r{};
+        r.kind = kind;
+        r.passed = passed ? 1 : 0;
+        r.depth = b.depth;
+        r.pid = sysfail::syscall(0, 0, 0, 0, 0, 0, SYS_getpid);
+        r.elapsed_ns = (Clock::now() - b.start - b.paused).count();
+        r.skipped = b.skipped;
+        std::copy(b.path, b.path + b.depth, r.points);
+        sysfail::syscall(
+            b.fd,
+            reinterpret_cast<uint64_t>(&r),
+            sizeof(r),
+            0,
+            0,
+            0,
+            SYS_write);
+    }
+
+    // Eligibility predicate of `call`: forks at the fault point, the child
+    // is eligible (takes the failure) while the parent is not.
+    bool fork_at(Branching& b, Syscall call) {
+        if (!b.armed) return false;
+        auto index = b.calls[call]++;
+        if (b.depth == b.cfg.depth) return false;
+        auto before = Clock::now();
+        auto got = acquire(b.shared, b.root);
+        auto pid = got ? _Fork() : -1;
+        // not the body's time, in the parent or the child
+        b.paused += Clock::now() - before;
+        if (!got) {
+            b.skipped++;
+            return false;
+        }
+        if (pid < 0) {
+            release(b.shared);
+            b.skipped++;
+            return false;
+        }
+        if (pid > 0) return false;
+        sysfail::rearm_forked();
+        // keeps the root's start and pauses, the branch shares its prefix
+        b.root = false;
+        b.path[b.depth++] = {call, index};
+        send(b, Record::Start, false);
+        return true;
+    }
+
+    // Runs the fault-free body, which branches as it goes, never returns
+    [[noreturn]] void explore_from_root(Branching& b, const Body& body) {
+        std::unordered_map<Syscall, const Outcome> outcomes;
+        for (const auto& [call, err] : b.cfg.errors) {
+            b.calls[call] = 0;
+            outcomes.insert({call, Outcome{
+                {1, 0},
+                {0, 0},
+                0us,
+                {{err, 1}},
+                [&b, call](const greg_t*) { return fork_at(b, call); }}});
+        }
+        Session s(Plan(
+            outcomes,
+            [](pid_t) { return true; },
+            thread_discovery::None{}));
+        b.start = Clock::now();
+        b.armed = true;
+        bool passed;
+        try {
+            passed = body();
+        } catch (...) {
+            passed = false;
+        }
+        b.armed = false;
+        if (b.root) {
+            size_t i = 0;
+            for (const auto& [call, n] : b.calls) b.shared->calls()[i++] = n;
+        } else {
+            release(b.shared);
+        }
+        send(b, Record::Finish, passed);
+        // only the process that drops the Session may tear it down, and
+        // this may be a branch, so exit without unwinding
+        _exit(0);
+    }
+}
+
+sysfail::explore::Report sysfail::explore::run(
+    const Config& cfg,
+    const Body& body
+) {
+    if (cfg.depth == 0) {
+        throw std::invalid_argument("Depth must be positive");
+    }
+    if (cfg.errors.empty()) {
+        throw std::invalid_argument("No syscalls to explore");
+    }
+
+    Report report;
+    {
+        std::vector<uint64_t> counts;
+        report.baseline = fault_free(cfg, body, &counts);
+        size_t i = 0;
+        for (const auto& [call, err] : cfg.errors) {
+            report.calls[call] = counts[i++];
+        }
+    }
+
+    std::vector<Point> points;
+    for (const auto& [call, n] : report.calls) {
+        for (uint64_t i = 0; i < n; i++) points.push_back({call, i});
+    }
+
+    auto workers = cfg.workers
+        ? cfg.workers
+        : std::max(1u, std::thread::hardware_concurrency());
+    Combinations combos(points.size(), cfg.depth);
+    std::map<size_t, std::vector<Point>> in_flight;
+    std::vector<std::pair<size_t, Result>> failed;
+    std::vector<Worker> running;
+
+    auto finish = [&](const Worker& w, bool timed_out) {
+        auto r = reap(w, timed_out, 0, nullptr);
+        r.points = std::move(in_flight[w.run]);
+        in_flight.erase(w.run);
+        judge(cfg, report.baseline, r);
+        if (r.verdict != Verdict::Passed) {
+            failed.emplace_back(w.run, std::move(r));
+        }
+    };
+
+    while (combos.current() || !running.empty()) {
+        while (combos.current() && running.size() < workers) {
+            std::vector<Point> picked;
+            std::map<Syscall, std::vector<uint64_t>> fail_at;
+            for (auto i : *combos.current()) {
+                picked.push_back(points[i]);
+                fail_at[points[i].call].push_back(points[i].index);
+            }
+            combos.advance();
+            auto run = report.runs++;
+            running.push_back(
+                spawn(cfg, failing_at(cfg, fail_at), body, run, running));
+            in_flight[run] = std::move(picked);
+        }
+
+        std::vector<pollfd> fds;
+        auto now = Clock::now();
+        auto deadline = running.front().deadline;
+        for (const auto& w : running) {
+            fds.push_back({w.fd, POLLIN, 0});
+            deadline = std::min(deadline, w.deadline);
+        }
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - now) + 1ms;
+        if (poll(fds.data(), fds.size(), std::max(wait.count(), 0L)) < 0 &&
+            errno != EINTR) {
+            throw std::runtime_error(
+                std::string("Failed to poll workers: ") + std::strerror(errno));
+        }
+
+        now = Clock::now();
+        std::vector<Worker> still_running;
+        for (size_t i = 0; i < running.size(); i++) {
+            if (fds[i].revents) {
+                finish(running[i], false);
+            } else if (now >= running[i].deadline) {
+                finish(running[i], true);
+            } else {
+                still_running.push_back(running[i]);
+            }
+        }
+        running = std::move(still_running);
+    }
+
+    std::sort(
+        failed.begin(),
+        failed.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (auto& [run, r] : failed) report.results.push_back(std::move(r));
+    return report;
+}
+
+sysfail::explore::Report sysfail::explore::branch(
+    const Config& cfg,
+    const Body& body
+) {
+    if (cfg.depth == 0 || cfg.depth > max_depth) {
+        throw std::invalid_argument(
+            "Depth must be between 1 and " + std::to_string(max_depth));
+    }
+    if (cfg.errors.empty()) {
+        throw std::invalid_argument("No syscalls to explore");
+    }
+    if (!std::holds_alternative<thread_discovery::None>(cfg.thd_disc)) {
+        throw std::invalid_argument("Branching needs a single-threaded body");
+    }
+
+    // the fault-free run branches as it goes, so its time is not a baseline
+    // (it waits for and forks every branch), a separate run is measured
+    auto baseline = fault_free(cfg, body, nullptr);
+
+    auto shared_sz = sizeof(Shared) + cfg.errors.size() * sizeof(uint64_t);
+    auto mem = mmap(
+        nullptr,
+        shared_sz,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS,
+        -1,
+        0);
+    if (mem == MAP_FAILED) {
+        throw std::runtime_error(
+            std::string("Failed to map shared state: ") + std::strerror(errno));
+    }
+    auto shared = new (mem) Shared{};
+    shared->free = cfg.workers
+        ? cfg.workers
+        : std::max(1u, std::thread::hardware_concurrency());
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        munmap(mem, shared_sz);
+        throw std::runtime_error(
+            std::string("Failed to create pipe: ") + std::strerror(errno));
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    // branches outlive their parents, they must be reaped here
+    int was_subreaper = 0;
+    prctl(PR_GET_CHILD_SUBREAPER, &was_subreaper);
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+    auto root = fork();
+    if (root == 0) {
+        close(fds[0]);
+        Branching b{.cfg = cfg, .shared = shared, .fd = fds[1]};
+        explore_from_root(b, body);
+    }
+    auto root_err = errno;
+    close(fds[1]);
+
+    Report report;
+    std::optional<Result> from_root;
+    struct Branch {
+        std::vector<Point> points;
+        Clock::time_point deadline;
+        bool finished = false;
+        bool killed = false;
+    };
+    std::map<pid_t, Branch> branches;
+    std::vector<Result> results;
+
+    std::vector<char> pending;
+    bool eof = false;
+    auto drain = [&]() {
+        char buf[4096];
+        while (!eof) {
+            auto r = read(fds[0], buf, sizeof(buf));
+            if (r > 0) {
+                pending.insert(pending.end(), buf, buf + r);
+            } else if (r == 0) {
+                eof = true;
+            } else if (errno != EINTR) {
+                break;
+            }
+        }
+        size_t off = 0;
+        for (; off + sizeof(Record) <= pending.size(); off += sizeof(Record)) {
+            Record rec;
+            std::memcpy(&rec, pending.data() + off, sizeof(rec));
+            std::vector<Point> points(rec.points, rec.points + rec.depth);
+            if (rec.kind == Record::Finish) report.skipped += rec.skipped;
+            if (rec.kind == Record::Start) {
+                report.runs++;
+                branches[rec.pid] = {
+                    std::move(points),
+                    Clock::now() + cfg.timeout};
+            } else if (rec.pid == root) {
+                from_root = Result{
+                    {},
+                    rec.passed ? Verdict::Passed : Verdict::Failed,
+                    std::chrono::nanoseconds(rec.elapsed_ns)};
+            } else {
+                branches[rec.pid].finished = true;
+                results.push_back({
+                    std::move(points),
+                    rec.passed ? Verdict::Passed : Verdict::Failed,
+                    std::chrono::nanoseconds(rec.elapsed_ns)});
+            }
+        }
+        pending.erase(pending.begin(), pending.begin() + off);
+    };
+
+    auto reaped = [&](pid_t pid) {
+        // anything it wrote before exiting is in the pipe by now
+        drain();
+        if (pid == root) return;
+        auto it = branches.find(pid);
+        if (it == branches.end()) {
+            // died before it could report, but it held a slot all the same
+            release(shared);
+            return;
+        }
+        if (!it->second.finished) {
+            release(shared);
+            results.push_back({
+                std::move(it->second.points),
+                it->second.killed ? Verdict::Hung : Verdict::Crashed,
+                0ns});
+        }
+        branches.erase(it);
+    };
+
+    while (root > 0) {
+        auto now = Clock::now();
+        auto deadline = now + 100ms;
+        for (const auto& [pid, b] : branches) {
+            if (!b.finished && !b.killed) {
+                deadline = std::min(deadline, b.deadline);
+            }
+        }
+        if (!eof) {
+            pollfd p{fds[0], POLLIN, 0};
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - now) + 1ms;
+            poll(&p, 1, std::max(wait.count(), 0L));
+            drain();
+        }
+
+        int status;
+        pid_t pid;
+        // once every writer is gone, only exits are left to wait for
+        while ((pid = waitpid(-1, &status, eof ? 0 : WNOHANG)) > 0) {
+            reaped(pid);
+        }
+        if (pid < 0 && errno == ECHILD) break;
+
+        now = Clock::now();
+        for (auto& [pid, b] : branches) {
+            if (!b.finished && !b.killed && now >= b.deadline) {
+                kill(pid, SIGKILL);
+                b.killed = true;
+            }
+        }
+    }
+
+    prctl(PR_SET_CHILD_SUBREAPER, was_subreaper);
+    close(fds[0]);
+    if (root < 0) {
+        munmap(mem, shared_sz);
+        throw std::runtime_error(
+            std::string("Failed to fork: ") + std::strerror(root_err));
+    }
+    size_t i = 0;
+    for (const auto& [call, err] : cfg.errors) {
+        report.calls[call] = shared->calls()[i++];
+    }
+    munmap(mem, shared_sz);
+    if (!from_root || from_root->verdict != Verdict::Passed) {
+        throw std::runtime_error("Test body does not pass without faults");
+    }
+    report.baseline = baseline;
+
+    for (auto& r : results) judge(cfg, report.baseline, r);
+    std::erase_if(
+        results,
+        [](const auto& r) { return r.verdict == Verdict::Passed; });
+    std::sort(
+        results.begin(),
+        results.end(),
+        [](const auto& a, const auto& b) { return a.points < b.points; });
+    report.results = std::move(results);
+    return report;
+}
+
+sysfail::explore::Minimal sysfail::explore::minimize(
+    const Config& cfg,
+    const trace::Trace& failing,
+    const PlanFor& plan_for,
+    const Body& body
+) {
+    Minimal m{{}, Verdict::Passed, 0ns, 0};
+
+    // the fault-free replay's time is the baseline for Slow
+    {
+        auto w = spawn(cfg, replaying(plan_for, {}), body, 0, {});
+        pollfd p{w.fd, POLLIN, 0};
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            cfg.timeout);
+        while (poll(&p, 1, wait.count()) < 0 && errno == EINTR);
+        auto r = reap(w, p.revents == 0, 0, nullptr);
+        m.runs++;
+        if (r.verdict != Verdict::Passed) {
+            throw std::runtime_error("Test body does not pass without faults");
+        }
+        m.baseline = r.elapsed;
+    }
+
+    auto all = first_failing(
+        cfg,
+        m.baseline,
+        {failing.events},
+        plan_for,
+        body,
+        m.runs);
+    if (!all) {
+        throw std::runtime_error("Trace does not reproduce the failure");
+    }
+    m.verdict = all->second.verdict;
+
+    // ddmin: try halves (then quarters, ...) of the faults, and their
+    // complements, keeping whichever still fails, until no single chunk
+    // can be dropped
+    auto faults = failing.events;
+    size_t n = 2;
+    while (faults.size() >= 2) {
+        std::vector<Events> chunks;
+        for (size_t i = 0; i < n; i++) {
+            chunks.emplace_back(
+                faults.begin() + faults.size() * i / n,
+                faults.begin() + faults.size() * (i + 1) / n);
+        }
+        if (auto f = first_failing(
+                cfg, m.baseline, chunks, plan_for, body, m.runs)) {
+            faults = std::move(chunks[f->first]);
+            m.verdict = f->second.verdict;
+            n = 2;
+            continue;
+        }
+        if (n > 2) {
+            std::vector<Events> complements;
+            for (size_t i = 0; i < n; i++) {
+                Events c;
+                for (size_t j = 0; j < n; j++) {
+                    if (j != i) c.insert(c.end(), chunks[j].begin(), chunks[j].end());
+                }
+                complements.push_back(std::move(c));
+            }
+            if (auto f = first_failing(
+                    cfg, m.baseline, complements, plan_for, body, m.runs)) {
+                faults = std::move(complements[f->first]);
+                m.verdict = f->second.verdict;
+                n = std::max<size_t>(n - 1, 2);
+                continue;
+            }
+        }
+        if (n >= faults.size()) break;
+        n = std::min(n * 2, faults.size());
+    }
+    m.faults.events = std::move(faults);
+    return m;
+}
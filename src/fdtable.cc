@@ -0,0 +1,373 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "fdtable.hh"
+#include "helpers.hh"
+#include "syscall.hh"
+
+namespace {
+    using sysfail::fds::Kind;
+
+    // kind (8 bits) | path id (16) | paths registered when resolved (16) |
+    // open flags (24), kind 0 => unknown
+    uint64_t pack(Kind kind, int flags, uint32_t path, uint32_t seen) {
+        return static_cast<uint64_t>(kind) |
+            static_cast<uint64_t>(path) << 8 |
+            static_cast<uint64_t>(seen) << 24 |
+            static_cast<uint64_t>(flags & 0xffffff) << 40;
+    }
+
+    uint32_t seen(uint64_t e) {
+        return (e >> 24) & 0xffff;
+    }
+
+    bool has_path(uint64_t e) {
+        auto k = static_cast<Kind>(e & 0xff);
+        return k == Kind::File || k == Kind::Dir;
+    }
+
+    Kind kind_of(uint32_t mode) {
+        switch (mode & S_IFMT) {
+            case S_IFREG: return Kind::File;
+            case S_IFDIR: return Kind::Dir;
+            case S_IFSOCK: return Kind::Socket;
+            case S_IFIFO: return Kind::Pipe;
+            default: return Kind::Other;
+        }
+    }
+
+    // "/data/" and "/data" are the same path, "/" stays as is
+    std::string normalize(const std::string& p) {
+        auto n = p;
+        while (n.size() > 1 && n.back() == '/') n.pop_back();
+        return n;
+    }
+
+    bool under(const char* path, size_t len, const std::string& dir) {
+        if (len < dir.size() || path[0] != '/') return false;
+        for (size_t i = 0; i < dir.size(); i++) {
+            if (path[i] != dir[i]) return false;
+        }
+        return len == dir.size() || dir.size() == 1 || path[dir.size()] == '/';
+    }
+}
+
+sysfail::fds::Class::Class(
+    const std::vector<Kind>& kinds,
+    const std::vector<std::string>& under,
+    int flags
+) : kinds(kinds), under(under), flags(flags) {
+    for (const auto& p : under) {
+        if (p.empty() || p[0] != '/') {
+            throw std::invalid_argument("Fd class path must be absolute: " + p);
+        }
+    }
+}
+
+sysfail::FdTable::FdTable() : paths(new std::string[FdMatch::max_paths]) {}
+
+bool sysfail::FdTable::takes_fd(Syscall call) {
+    switch (call) {
+        case SYS_read:
+        case SYS_write:
+        case SYS_pread64:
+        case SYS_pwrite64:
+        case SYS_readv:
+        case SYS_writev:
+        case SYS_preadv:
+        case SYS_pwritev:
+        case SYS_preadv2:
+        case SYS_pwritev2:
+        case SYS_close:
+        case SYS_fstat:
+        case SYS_lseek:
+        case SYS_ioctl:
+        case SYS_fcntl:
+        case SYS_flock:
+        case SYS_fsync:
+        case SYS_fdatasync:
+        case SYS_ftruncate:
+        case SYS_fallocate:
+        case SYS_sync_file_range:
+        case SYS_getdents64:
+        case SYS_sendfile:
+        case SYS_connect:
+        case SYS_accept:
+        case SYS_accept4:
+        case SYS_sendto:
+        case SYS_recvfrom:
+        case SYS_sendmsg:
+        case SYS_recvmsg:
+        case SYS_sendmmsg:
+        case SYS_recvmmsg:
+        case SYS_shutdown:
+        case SYS_bind:
+        case SYS_listen:
+        case SYS_getsockopt:
+        case SYS_setsockopt:
+        case SYS_getsockname:
+        case SYS_getpeername:
+            return true;
+        default:
+            return false;
+    }
+}
+
+uint32_t sysfail::FdTable::path_id(const char* path, size_t len) const {
+    auto count = path_count.load(std::memory_order_acquire);
+    uint32_t best = 0;
+    size_t best_len = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const auto& p = paths[i];
+        if ((best == 0 || p.size() > best_len) && under(path, len, p)) {
+            best = i + 1;
+            best_len = p.size();
+        }
+    }
+    return best;
+}
+
+uint32_t sysfail::FdTable::resolve(int64_t fd, uint32_t count) const {
+    if (count == 0) return 0;
+    // "/proc/self/fd/<fd>", formatted without allocating
+    char link[32] = "/proc/self/fd/";
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + fd % 10;
+        fd /= 10;
+    } while (fd > 0);
+    size_t at = 14;
+    while (n > 0) link[at++] = digits[--n];
+    link[at] = '\0';
+
+    char path[4096];
+    auto len = sysfail::syscall(
+        reinterpret_cast<uint64_t>(link),
+        reinterpret_cast<uint64_t>(path),
+        sizeof(path),
+        0,
+        0,
+        0,
+        SYS_readlink);
+    if (len <= 0) return 0;
+    return path_id(path, len);
+}
+
+uint64_t sysfail::FdTable::classify(int64_t fd) const {
+    struct stat st;
+    auto r = sysfail::syscall(
+        fd,
+        reinterpret_cast<uint64_t>(&st),
+        0,
+        0,
+        0,
+        0,
+        SYS_fstat);
+    if (r < 0) return 0;
+    auto flags = sysfail::syscall(fd, F_GETFL, 0, 0, 0, 0, SYS_fcntl);
+    auto kind = kind_of(st.st_mode);
+    auto count = path_count.load(std::memory_order_acquire);
+    auto path = (kind == Kind::File || kind == Kind::Dir)
+        ? resolve(fd, count)
+        : 0;
+    return pack(kind, flags < 0 ? 0 : flags, path, count);
+}
+
+void sysfail::FdTable::created(
+    std::atomic<uint64_t>* table,
+    int64_t fd,
+    fds::Kind kind,
+    int flags
+) {
+    if (fd < 0 || static_cast<size_t>(fd) >= max_fds) return;
+    auto count = path_count.load(std::memory_order_acquire);
+    table[fd].store(pack(kind, flags, 0, count), std::memory_order_relaxed);
+}
+
+void sysfail::FdTable::copy(
+    std::atomic<uint64_t>* table,
+    int64_t from,
+    int64_t to
+) {
+    if (to < 0 || static_cast<size_t>(to) >= max_fds || from == to) return;
+    auto e = (from >= 0 && static_cast<size_t>(from) < max_fds)
+        ? table[from].load(std::memory_order_relaxed)
+        : 0;
+    table[to].store(e, std::memory_order_relaxed);
+}
+
+void sysfail::FdTable::observe(Syscall call, const greg_t* regs) {
+    auto table = entries.load(std::memory_order_acquire);
+    if (!table) return;
+    auto ret = regs[REG_RAX];
+    auto fds = [](greg_t arr) { return reinterpret_cast<const int*>(arr); };
+    auto clear = [&](uint64_t fd) {
+        if (fd < max_fds) table[fd].store(0, std::memory_order_relaxed);
+    };
+    switch (call) {
+        case SYS_close:
+            // the fd is gone even if close failed (eg. EINTR)
+            clear(regs[REG_RDI]);
+            return;
+        case SYS_close_range:
+            if (ret < 0) return;
+            for (auto fd = static_cast<uint64_t>(regs[REG_RDI]);
+                 fd <= static_cast<uint64_t>(regs[REG_RSI]) && fd < max_fds;
+                 fd++) {
+                clear(fd);
+            }
+            return;
+        default:
+            break;
+    }
+    if (ret < 0) return;
+    switch (call) {
+        case SYS_open:
+        case SYS_openat:
+        case SYS_openat2:
+        case SYS_creat:
+        case SYS_memfd_create:
+            // classified on first lookup, like an unseen fd (the open flags
+            // don't tell what was opened, eg. a directory opened without
+            // O_DIRECTORY), the fd number may have been seen before
+            clear(ret);
+            break;
+        case SYS_socket:
+        case SYS_accept:
+            created(table, ret, Kind::Socket, 0);
+            break;
+        case SYS_accept4:
+            created(table, ret, Kind::Socket, regs[REG_R10]);
+            break;
+        case SYS_socketpair:
+            created(table, fds(regs[REG_R10])[0], Kind::Socket, 0);
+            created(table, fds(regs[REG_R10])[1], Kind::Socket, 0);
+            break;
+        case SYS_pipe:
+        case SYS_pipe2: {
+            auto f = call == SYS_pipe2 ? regs[REG_RSI] : 0;
+            created(table, fds(regs[REG_RDI])[0], Kind::Pipe, f | O_RDONLY);
+            created(table, fds(regs[REG_RDI])[1], Kind::Pipe, f | O_WRONLY);
+            break;
+        }
+        case SYS_eventfd:
+        case SYS_eventfd2:
+        case SYS_epoll_create:
+        case SYS_epoll_create1:
+        case SYS_timerfd_create:
+        case SYS_signalfd:
+        case SYS_signalfd4:
+        case SYS_inotify_init:
+        case SYS_inotify_init1:
+            created(table, ret, Kind::Other, 0);
+            break;
+        case SYS_dup:
+        case SYS_dup2:
+        case SYS_dup3:
+            copy(table, regs[REG_RDI], ret);
+            break;
+        case SYS_fcntl:
+            if (regs[REG_RSI] == F_DUPFD || regs[REG_RSI] == F_DUPFD_CLOEXEC) {
+                copy(table, regs[REG_RDI], ret);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+sysfail::FdMatch sysfail::FdTable::compile(const fds::Class& c) {
+    FdMatch m{this, 0, c.flags, c.under.empty(), {}};
+    for (auto k : c.kinds) m.kinds |= 1u << static_cast<uint32_t>(k);
+
+    std::lock_guard<std::mutex> l(mtx);
+    if (!owned) {
+        owned.reset(new std::atomic<uint64_t>[max_fds]);
+        for (size_t i = 0; i < max_fds; i++) owned[i] = 0;
+        entries.store(owned.get(), std::memory_order_release);
+    }
+    auto count = path_count.load();
+    for (const auto& p : c.under) {
+        auto n = normalize(p);
+        uint32_t i = 0;
+        while (i < count && paths[i] != n) i++;
+        if (i == count) {
+            if (count == FdMatch::max_paths) {
+                throw std::invalid_argument(
+                    "Too many fd class paths (max " +
+                    std::to_string(FdMatch::max_paths) + ")");
+            }
+            paths[count++] = n;
+        }
+    }
+    path_count.store(count, std::memory_order_release);
+    // registered paths under any of the class' paths, a file's longest
+    // matching path is then one of these
+    for (uint32_t i = 0; i < count; i++) {
+        for (const auto& p : c.under) {
+            if (under(paths[i].data(), paths[i].size(), normalize(p))) {
+                m.paths.set(i + 1);
+            }
+        }
+    }
+    return m;
+}
+
+uint64_t sysfail::FdTable::lookup(int64_t fd) {
+    if (fd < 0) return 0;
+    auto table = entries.load(std::memory_order_acquire);
+    if (!table || static_cast<size_t>(fd) >= max_fds) return classify(fd);
+    auto& slot = table[fd];
+    auto e = slot.load(std::memory_order_relaxed);
+    if (e == 0) {
+        e = classify(fd);
+        slot.store(e, std::memory_order_relaxed);
+    } else if (has_path(e)) {
+        auto count = path_count.load(std::memory_order_acquire);
+        if (seen(e) < count) {
+            e = pack(kind(e), flags(e), resolve(fd, count), count);
+            slot.store(e, std::memory_order_relaxed);
+        }
+    }
+    return e;
+}
+
+sysfail::fds::Kind sysfail::FdTable::kind(uint64_t e) {
+    return static_cast<Kind>(e & 0xff);
+}
+
+int sysfail::FdTable::flags(uint64_t e) {
+    return static_cast<int>(e >> 40);
+}
+
+uint32_t sysfail::FdTable::path(uint64_t e) {
+    return (e >> 8) & 0xffff;
+}
+
+bool sysfail::FdMatch::matches(int64_t fd) const {
+    auto e = table->lookup(fd);
+    if (e == 0) return false;
+    if (kinds && !(kinds & (1u << static_cast<uint32_t>(FdTable::kind(e))))) {
+        return false;
+    }
+    if ((FdTable::flags(e) & flags) != flags) return false;
+    return any_path || paths.test(FdTable::path(e));
+}
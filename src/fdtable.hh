@@ -0,0 +1,110 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _FDTABLE_HH
+#define _FDTABLE_HH
+
+#include <atomic>
+#include <bitset>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/ucontext.h>
+
+#include "sysfail.hh"
+
+namespace sysfail {
+    class FdTable;
+
+    // An outcome's fds::Class, compiled against the session's table
+    struct FdMatch {
+        static constexpr size_t max_paths = 1024;
+
+        FdTable* table;
+        // bit per fds::Kind
+        uint32_t kinds;
+        int flags;
+        bool any_path;
+        // path ids (see FdTable) under one of the class' paths
+        std::bitset<max_paths + 1> paths;
+
+        bool matches(int64_t fd) const;
+    };
+
+    // Classification of the process' fds, a flat table indexed by fd. Each
+    // entry packs kind, open flags and the longest registered path the fd is
+    // under. The handler keeps entries up to date cheaply: sockets, pipes
+    // and the like are filled as they are created, duplicates copied and
+    // closed fds cleared. Opened fds (whose open flags don't tell what was
+    // opened) and fds the table hasn't seen are classified on first lookup
+    // (raw fstat, fcntl and readlink of /proc/self/fd).
+    //
+    // The table is built when a plan first compiles an fd class, until then
+    // nothing is kept (fds created before are classified on lookup too).
+    //
+    // Paths are registered by plans (never removed), entries remember how
+    // many paths there were when they were resolved and are resolved again
+    // once there are more.
+    class FdTable {
+        // null until built, `owned` keeps it
+        std::atomic<std::atomic<uint64_t>*> entries{nullptr};
+        std::unique_ptr<std::atomic<uint64_t>[]> owned;
+
+        std::mutex mtx; // serializes path registration
+        std::unique_ptr<std::string[]> paths;
+        std::atomic<uint32_t> path_count{0};
+
+        // Longest registered path (id, from 1) the path is under, 0 => none
+        uint32_t path_id(const char* path, size_t len) const;
+
+        // Path id of the fd's file, by readlink
+        uint32_t resolve(int64_t fd, uint32_t count) const;
+
+        uint64_t classify(int64_t fd) const;
+
+        void created(
+            std::atomic<uint64_t>* table,
+            int64_t fd,
+            fds::Kind kind,
+            int flags);
+
+        void copy(std::atomic<uint64_t>* table, int64_t from, int64_t to);
+
+    public:
+        FdTable();
+
+        static bool takes_fd(Syscall call);
+
+        // Records fds the call created or closed (after it returned)
+        void observe(Syscall call, const greg_t* regs);
+
+        // Registers the class' paths (building the table if need be),
+        // throws std::invalid_argument if there are too many paths
+        FdMatch compile(const fds::Class& c);
+
+        // Packed entry of the fd, 0 => not open (or can't be classified)
+        uint64_t lookup(int64_t fd);
+
+        static fds::Kind kind(uint64_t entry);
+
+        static int flags(uint64_t entry);
+
+        static uint32_t path(uint64_t entry);
+    };
+}
+
+#endif
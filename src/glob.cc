@@ -0,0 +1,302 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <bitset>
+#include <map>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "glob.hh"
+#include "syscall.hh"
+
+namespace {
+    using Bytes = std::bitset<256>;
+
+    // Thompson-style NFA, node 0 starts every glob
+    struct Nfa {
+        struct Node {
+            std::vector<std::pair<Bytes, uint32_t>> edges;
+            std::vector<uint32_t> eps;
+            std::vector<uint32_t> accept; // outcomes
+        };
+        std::vector<Node> nodes{1};
+
+        uint32_t add() {
+            nodes.emplace_back();
+            return nodes.size() - 1;
+        }
+
+        // bytes of a path component
+        static Bytes in_component() {
+            Bytes b;
+            b.set();
+            b.reset('/');
+            b.reset(0);
+            return b;
+        }
+
+        static Bytes any() {
+            Bytes b;
+            b.set();
+            b.reset(0);
+            return b;
+        }
+
+        void add_glob(const std::string& g, uint32_t outcome) {
+            auto invalid = [&](const char* why) {
+                return std::invalid_argument(
+                    std::string("Invalid path glob (") + why + "): " + g);
+            };
+            auto cur = add();
+            nodes[0].eps.push_back(cur);
+            size_t i = 0;
+            auto step = [&](const Bytes& b) {
+                auto n = add();
+                nodes[cur].edges.emplace_back(b, n);
+                cur = n;
+            };
+            while (i < g.size()) {
+                auto c = g[i];
+                if (c == '*' && i + 1 < g.size() && g[i + 1] == '*') {
+                    i += 2;
+                    if (i < g.size() && g[i] == '/') {
+                        // (.*/)? => zero or more whole components
+                        i++;
+                        auto after = add();
+                        auto inside = add();
+                        nodes[cur].eps.push_back(after);
+                        nodes[cur].eps.push_back(inside);
+                        nodes[inside].edges.emplace_back(any(), inside);
+                        Bytes slash;
+                        slash.set('/');
+                        nodes[inside].edges.emplace_back(slash, after);
+                        cur = after;
+                    } else {
+                        auto loop = add();
+                        nodes[cur].eps.push_back(loop);
+                        nodes[loop].edges.emplace_back(any(), loop);
+                        cur = loop;
+                    }
+                } else if (c == '*') {
+                    i++;
+                    auto loop = add();
+                    nodes[cur].eps.push_back(loop);
+                    nodes[loop].edges.emplace_back(in_component(), loop);
+                    cur = loop;
+                } else if (c == '?') {
+                    i++;
+                    step(in_component());
+                } else if (c == '[') {
+                    i++;
+                    bool negate = i < g.size() && (g[i] == '!' || g[i] == '^');
+                    if (negate) i++;
+                    Bytes set;
+                    bool first = true;
+                    while (i < g.size() && (first || g[i] != ']')) {
+                        first = false;
+                        unsigned char lo = g[i++];
+                        unsigned char hi = lo;
+                        if (i + 1 < g.size() && g[i] == '-' && g[i + 1] != ']') {
+                            hi = g[i + 1];
+                            i += 2;
+                        }
+                        if (lo > hi) throw invalid("reversed range");
+                        for (unsigned b = lo; b <= hi; b++) set.set(b);
+                    }
+                    if (i == g.size()) throw invalid("unterminated [");
+                    i++;
+                    if (negate) set = ~set & in_component();
+                    step(set & any());
+                } else {
+                    if (c == '\\') {
+                        if (++i == g.size()) throw invalid("trailing \\");
+                    }
+                    Bytes b;
+                    b.set(static_cast<unsigned char>(g[i++]));
+                    step(b);
+                }
+            }
+            nodes[cur].accept.push_back(outcome);
+        }
+
+        void close(std::vector<uint32_t>& set) const {
+            std::vector<uint32_t> todo(set);
+            std::vector<bool> in(nodes.size());
+            for (auto n : set) in[n] = true;
+            while (!todo.empty()) {
+                auto n = todo.back();
+                todo.pop_back();
+                for (auto e : nodes[n].eps) {
+                    if (!in[e]) {
+                        in[e] = true;
+                        set.push_back(e);
+                        todo.push_back(e);
+                    }
+                }
+            }
+            std::sort(set.begin(), set.end());
+        }
+    };
+}
+
+sysfail::PathGlobs::PathGlobs(
+    const std::vector<std::vector<std::string>>& globs
+) {
+    Nfa nfa;
+    for (uint32_t o = 0; o < globs.size(); o++) {
+        for (const auto& g : globs[o]) nfa.add_glob(g, o);
+    }
+
+    // bytes every edge treats alike share a class
+    std::vector<const Bytes*> sets;
+    for (const auto& n : nfa.nodes) {
+        for (const auto& [b, _] : n.edges) sets.push_back(&b);
+    }
+    std::map<std::vector<bool>, uint8_t> by_signature;
+    std::vector<unsigned> representative;
+    for (unsigned b = 0; b < 256; b++) {
+        std::vector<bool> sig(sets.size());
+        for (size_t i = 0; i < sets.size(); i++) sig[i] = sets[i]->test(b);
+        auto [it, added] = by_signature.emplace(sig, by_signature.size());
+        if (added) representative.push_back(b);
+        byte_class[b] = it->second;
+    }
+    classes = representative.size();
+
+    // subset construction, state 0 is the dead (empty) set
+    std::map<std::vector<uint32_t>, uint32_t> ids;
+    std::vector<std::vector<uint32_t>> states{{}, {0}};
+    nfa.close(states[1]);
+    ids[states[0]] = dead;
+    ids[states[1]] = start;
+    for (uint32_t s = 0; s < states.size(); s++) {
+        std::vector<uint32_t> acc;
+        for (auto n : states[s]) {
+            const auto& a = nfa.nodes[n].accept;
+            acc.insert(acc.end(), a.begin(), a.end());
+        }
+        std::sort(acc.begin(), acc.end());
+        acc.erase(std::unique(acc.begin(), acc.end()), acc.end());
+        accept.push_back(acc);
+
+        for (uint32_t c = 0; c < classes; c++) {
+            std::vector<uint32_t> to;
+            for (auto n : states[s]) {
+                for (const auto& [b, t] : nfa.nodes[n].edges) {
+                    if (b.test(representative[c])) to.push_back(t);
+                }
+            }
+            std::sort(to.begin(), to.end());
+            to.erase(std::unique(to.begin(), to.end()), to.end());
+            nfa.close(to);
+            auto [it, added] = ids.emplace(to, states.size());
+            if (added) {
+                if (states.size() == max_states) {
+                    throw std::invalid_argument(
+                        "Path globs compile to more than " +
+                        std::to_string(max_states) + " states");
+                }
+                states.push_back(std::move(to));
+            }
+            next.push_back(it->second);
+        }
+    }
+}
+
+bool sysfail::PathGlobs::matches(
+    uint32_t outcome,
+    const char* path,
+    size_t len
+) const {
+    auto s = start;
+    for (size_t i = 0; i < len && path[i] != '\0'; i++) {
+        s = next[s * classes + byte_class[static_cast<uint8_t>(path[i])]];
+        if (s == dead) return false;
+    }
+    const auto& a = accept[s];
+    return std::binary_search(a.begin(), a.end(), outcome);
+}
+
+int sysfail::PathGlobs::path_arg(Syscall call) {
+    switch (call) {
+        case SYS_open:
+        case SYS_creat:
+        case SYS_stat:
+        case SYS_lstat:
+        case SYS_access:
+        case SYS_unlink:
+        case SYS_rename:
+        case SYS_mkdir:
+        case SYS_rmdir:
+        case SYS_truncate:
+        case SYS_readlink:
+            return REG_RDI;
+        case SYS_openat:
+        case SYS_openat2:
+        case SYS_newfstatat:
+        case SYS_statx:
+        case SYS_faccessat:
+        case SYS_faccessat2:
+        case SYS_unlinkat:
+        case SYS_renameat:
+        case SYS_renameat2:
+        case SYS_mkdirat:
+        case SYS_readlinkat:
+            return REG_RSI;
+        default:
+            return -1;
+    }
+}
+
+int64_t sysfail::PathGlobs::read_path(
+    const greg_t* regs,
+    char* buf,
+    size_t size
+) {
+    auto reg = path_arg(regs[REG_RAX]);
+    if (reg < 0) return -1;
+    auto addr = static_cast<uint64_t>(regs[reg]);
+    auto pid = sysfail::syscall(0, 0, 0, 0, 0, 0, SYS_getpid);
+    // a page at a time (a read can't span into an unmapped page), until the
+    // path ends
+    size_t got = 0;
+    while (got < size) {
+        auto page_left = 4096 - (addr + got) % 4096;
+        iovec local{buf + got, std::min(page_left, size - got)};
+        iovec remote{reinterpret_cast<void*>(addr + got), local.iov_len};
+        auto r = sysfail::syscall(
+            pid,
+            reinterpret_cast<uint64_t>(&local),
+            1,
+            reinterpret_cast<uint64_t>(&remote),
+            1,
+            0,
+            SYS_process_vm_readv);
+        if (r <= 0) return got > 0 ? got : -1;
+        auto end = std::find(buf + got, buf + got + r, '\0');
+        got += r;
+        if (end != buf + got) return end - buf;
+    }
+    return got;
+}
+
+bool sysfail::PathMatch::matches(const greg_t* regs) const {
+    char path[PathGlobs::max_path];
+    auto len = PathGlobs::read_path(regs, path, sizeof(path));
+    return len >= 0 && globs->matches(outcome, path, len);
+}
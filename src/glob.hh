@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _GLOB_HH
+#define _GLOB_HH
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/ucontext.h>
+#include <vector>
+
+#include "sysfail.hh"
+
+namespace sysfail {
+    // Path globs of all outcomes of a plan, compiled into a single DFA (over
+    // classes of bytes the globs don't tell apart). A path is matched in one
+    // pass, its final state tells which outcomes have a glob that matched.
+    class PathGlobs {
+        static constexpr size_t max_states = 1 << 16;
+        static constexpr uint32_t dead = 0, start = 1;
+
+        std::array<uint8_t, 256> byte_class;
+        uint32_t classes;
+        // next state by (state, class)
+        std::vector<uint32_t> next;
+        // outcomes (sorted) whose globs accept in the state
+        std::vector<std::vector<uint32_t>> accept;
+
+    public:
+        static constexpr size_t max_path = 4096;
+
+        // `globs[i]` are the globs of outcome i, throws std::invalid_argument
+        // for a malformed glob (or if they compile to too many states)
+        explicit PathGlobs(const std::vector<std::vector<std::string>>& globs);
+
+        bool matches(uint32_t outcome, const char* path, size_t len) const;
+
+        // Register of the call's path argument, -1 => the call has none
+        static int path_arg(Syscall call);
+
+        // Reads the path argument of the call without faulting (returns -1 if
+        // it can't be read), up to `size` bytes, not NUL terminated
+        static int64_t read_path(const greg_t* regs, char* buf, size_t size);
+    };
+
+    // An outcome's globs, in the plan's PathGlobs
+    struct PathMatch {
+        std::shared_ptr<const PathGlobs> globs;
+        uint32_t outcome;
+
+        bool matches(const greg_t* regs) const;
+    };
+}
+
+#endif
@@ -28,6 +28,10 @@ template<class... Ts> cases(Ts...) -> cases<Ts...>;
 namespace sysfail {
     const std::filesystem::path tasks_dir =
         std::filesystem::path("/proc/self/task");
+
+    // Bound of the per-fd tables the handler keeps (fd classes, peers,
+    // throttle budgets and device offsets), fds beyond aren't tracked
+    constexpr size_t max_fds = 65536;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _IOV_HH
+#define _IOV_HH
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <sys/uio.h>
+#include <ucontext.h>
+
+#include "stack.hh"
+
+namespace sysfail::iov {
+    // iovecs read per round, bounds the handler's stack use
+    constexpr int64_t chunk = 32;
+
+    // Calls `f(len)` with the length of each buffer of a readv / writev
+    // (array in rsi, count in rdx), in order, until it returns false. The
+    // array is read without faulting, a chunk at a time. Returns false if
+    // the count is out of [0, IOV_MAX] or the array is unreadable, in
+    // which case the lengths seen so far must be disregarded.
+    template <typename F> bool lengths(const greg_t* regs, F&& f) {
+        auto addr = static_cast<uintptr_t>(regs[REG_RSI]);
+        auto cnt = static_cast<int64_t>(regs[REG_RDX]);
+        if (cnt < 0 || cnt > IOV_MAX) return false;
+
+        SafeReader r;
+        iovec iov[chunk];
+        for (int64_t i = 0; i < cnt; i += chunk) {
+            auto n = std::min(chunk, cnt - i);
+            if (!r.read(addr + i * sizeof(iovec), iov, n * sizeof(iovec))) {
+                return false;
+            }
+            for (int64_t j = 0; j < n; j++) {
+                if (!f(iov[j].iov_len)) return true;
+            }
+        }
+        return true;
+    }
+}
+
+#endif
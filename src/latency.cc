@@ -0,0 +1,202 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <istream>
+#include <sstream>
+
+#include "latency.hh"
+#include "helpers.hh"
+
+namespace {
+    using namespace sysfail::latency;
+
+    double cdf(const LogNormal& d, double x) {
+        if (x <= 0) return 0;
+        auto z = (std::log(x) - std::log(d.median.count())) / d.sigma;
+        return 0.5 * std::erfc(-z / std::sqrt(2.0));
+    }
+
+    double cdf(const Bimodal& d, double x) {
+        return (1 - d.slow_p) * cdf(d.fast, x) + d.slow_p * cdf(d.slow, x);
+    }
+
+    // Smallest x with cdf(x) >= u, for distributions without a closed-form
+    // inverse (only evaluated when the plan is compiled)
+    template <typename D> double bisect(const D& d, double u) {
+        double lo = 0, hi = 1;
+        while (cdf(d, hi) < u && hi < 1e15) hi *= 2;
+        for (int i = 0; i < 100 && hi - lo > 1e-3; i++) {
+            auto mid = (lo + hi) / 2;
+            (cdf(d, mid) < u ? lo : hi) = mid;
+        }
+        return hi;
+    }
+
+    double quantile(const Empirical& d, double u) {
+        double total = 0;
+        for (const auto& b : d.buckets) total += b.weight;
+        auto want = u * total;
+        double below = 0, from = 0;
+        for (const auto& b : d.buckets) {
+            double upto = b.upto.count();
+            if (b.weight > 0 && below + b.weight >= want) {
+                return from + (upto - from) * (want - below) / b.weight;
+            }
+            below += b.weight;
+            from = upto;
+        }
+        return from;
+    }
+
+    // Quantile `u` (in [0, 1]) of `d`, capped at `max`
+    double quantile(const Distribution& dist, double u, double max) {
+        auto q = std::visit(cases(
+            [&](const Uniform&) {
+                return u * max;
+            },
+            [&](const Exponential& d) {
+                return -d.mean.count() * std::log1p(-u);
+            },
+            [&](const LogNormal& d) {
+                return bisect(d, u);
+            },
+            [&](const Pareto& d) {
+                return d.scale.count() * std::pow(1 - u, -1 / d.shape);
+            },
+            [&](const Bimodal& d) {
+                return bisect(d, u);
+            },
+            [&](const Empirical& d) {
+                return quantile(d, u);
+            }),
+            dist);
+        return std::min(q, max);
+    }
+}
+
+sysfail::latency::Exponential::Exponential(microseconds mean) : mean(mean) {
+    if (mean.count() <= 0) {
+        throw std::invalid_argument("Mean latency must be positive");
+    }
+}
+
+sysfail::latency::LogNormal::LogNormal(
+    microseconds median,
+    double sigma
+) : median(median), sigma(sigma) {
+    if (median.count() <= 0 || !(sigma > 0)) {
+        throw std::invalid_argument(
+            "Log-normal latency needs positive median and sigma");
+    }
+}
+
+sysfail::latency::Pareto::Pareto(
+    microseconds scale,
+    double shape
+) : scale(scale), shape(shape) {
+    if (scale.count() <= 0 || !(shape > 0)) {
+        throw std::invalid_argument(
+            "Pareto latency needs positive scale and shape");
+    }
+}
+
+sysfail::latency::Bimodal::Bimodal(
+    LogNormal fast,
+    LogNormal slow,
+    double slow_p
+) : fast(fast), slow(slow), slow_p(slow_p) {
+    if (!(slow_p >= 0 && slow_p <= 1)) {
+        throw std::invalid_argument("Slow-mode probability must be in [0, 1]");
+    }
+}
+
+sysfail::latency::Empirical::Empirical(
+    std::vector<Bucket> buckets
+) : buckets(std::move(buckets)) {
+    double total = 0;
+    microseconds last(-1);
+    for (const auto& b : this->buckets) {
+        if (b.upto <= last || b.upto.count() < 0) {
+            throw std::invalid_argument(
+                "Histogram bounds must be non-negative and increasing");
+        }
+        if (!(b.weight >= 0)) {
+            throw std::invalid_argument("Histogram counts must not be negative");
+        }
+        last = b.upto;
+        total += b.weight;
+    }
+    if (!(total > 0)) {
+        throw std::invalid_argument("Histogram is empty");
+    }
+}
+
+sysfail::latency::Empirical sysfail::latency::Empirical::load(
+    std::istream& in
+) {
+    std::vector<Bucket> buckets;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        int64_t upto;
+        double count;
+        if (!(fields >> upto)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            throw std::invalid_argument("Malformed histogram line: " + line);
+        }
+        if (!(fields >> count) || !(fields >> std::ws).eof()) {
+            throw std::invalid_argument("Malformed histogram line: " + line);
+        }
+        buckets.push_back({microseconds(upto), count});
+    }
+    return Empirical(std::move(buckets));
+}
+
+sysfail::latency::Table::Table(
+    const Distribution& d,
+    std::chrono::microseconds cap
+) {
+    double max = cap.count() > 0 || std::holds_alternative<Uniform>(d)
+        ? cap.count()
+        : uncapped.count();
+    knots.reserve(levels * (N + 1));
+    double scale = 1;
+    for (size_t k = 0; k < levels; k++, scale *= 16) {
+        for (size_t i = 0; i <= N; i++) {
+            // the very last quantile is infinite for unbounded
+            // distributions, stand in the middle of its step instead
+            double step = k == levels - 1 && i == N ? N - 0.5 : i;
+            auto u = 1 - 1 / scale + step / (N * scale);
+            knots.push_back(quantile(d, u, max));
+        }
+    }
+}
+
+std::chrono::microseconds sysfail::latency::Table::sample(double u) const {
+    size_t k = 0;
+    double scale = 1;
+    while (k < levels - 1 && u >= 1 - 1 / (scale * 16)) {
+        k++;
+        scale *= 16;
+    }
+    auto x = (u - (1 - 1 / scale)) * scale * N;
+    auto i = std::min(static_cast<size_t>(std::max(x, 0.0)), N - 1);
+    auto f = x - i;
+    auto q = &knots[k * (N + 1) + i];
+    return std::chrono::microseconds(std::llround(q[0] + (q[1] - q[0]) * f));
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LATENCY_HH
+#define _LATENCY_HH
+
+#include <chrono>
+#include <vector>
+
+#include "sysfail.hh"
+
+namespace sysfail::latency {
+    // Inverse-CDF of a distribution, linearly interpolated between quantiles.
+    // Quantiles are tabulated in levels, level k spans [1 - 16^-k, 1) in N
+    // steps and is used up to where level k + 1 starts, so each level
+    // resolves a 16 times thinner slice of the tail.
+    class Table {
+        static constexpr size_t N = 256;
+        static constexpr size_t levels = 6;
+
+        // N + 1 quantiles per level
+        std::vector<double> knots;
+
+    public:
+        // Bound of uncapped delays, heavy tails (eg. Pareto with shape < 1)
+        // would otherwise run past what microseconds can hold
+        static constexpr std::chrono::microseconds uncapped =
+            std::chrono::hours(24);
+
+        // `cap` bounds delays (0 => `uncapped`)
+        Table(const Distribution& d, std::chrono::microseconds cap);
+
+        // Delay at quantile `u` in [0, 1), does not allocate
+        std::chrono::microseconds sample(double u) const;
+    };
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "limit.hh"
+
+using std::chrono::nanoseconds;
+
+namespace {
+    constexpr int64_t ns_per_sec = 1'000'000'000;
+
+    // Cached tokens are given up after this, so a thread that stops
+    // injecting doesn't sit on a share of the rate for long
+    constexpr int64_t cache_ttl_ns = 100'000'000;
+
+    // Threads take 1/16th of a second worth of tokens at a time
+    int64_t batch(int64_t rate) {
+        return std::max<int64_t>(1, rate / 16);
+    }
+}
+
+sysfail::Limit::Limit(
+    uint32_t failures_per_sec,
+    std::chrono::microseconds delay_per_sec,
+    uint64_t max_failures
+) : failures_per_sec(failures_per_sec),
+    delay_per_sec(delay_per_sec),
+    max_failures(max_failures) {
+    if (delay_per_sec.count() < 0) {
+        throw std::invalid_argument("Delay limit must not be negative");
+    }
+}
+
+sysfail::TokenBucket::TokenBucket(
+    int64_t rate,
+    nanoseconds now
+) : rate(rate), tokens(rate), refilled_at(now.count()) {}
+
+void sysfail::TokenBucket::refill(nanoseconds now) {
+    auto last = refilled_at.load();
+    auto elapsed = now.count() - last;
+    if (elapsed <= 0) return;
+
+    int64_t add, next;
+    if (elapsed >= ns_per_sec) {
+        add = rate;
+        next = now.count();
+    } else {
+        add = static_cast<__int128>(elapsed) * rate / ns_per_sec;
+        if (add == 0) return;
+        // only account for time that produced whole tokens, the remainder
+        // counts towards the next one
+        next = last + static_cast<__int128>(add) * ns_per_sec / rate;
+    }
+    // one of the racing threads gets to add tokens for this interval
+    if (!refilled_at.compare_exchange_strong(last, next)) return;
+
+    auto cur = tokens.load();
+    while (!tokens.compare_exchange_weak(cur, std::min(cur + add, rate)));
+}
+
+int64_t sysfail::TokenBucket::take(int64_t want, nanoseconds now) {
+    refill(now);
+    auto cur = tokens.load();
+    int64_t got;
+    do {
+        if (cur <= 0) return 0;
+        got = std::min(cur, want);
+    } while (!tokens.compare_exchange_weak(cur, cur - got));
+    return got;
+}
+
+std::chrono::nanoseconds sysfail::TokenBucket::next_refill() const {
+    return nanoseconds(refilled_at.load() + (ns_per_sec + rate - 1) / rate);
+}
+
+std::atomic<uint64_t> sysfail::Limiter::ids{1};
+
+sysfail::Limiter::Limiter(
+    const Limit& l,
+    nanoseconds now
+) : id(ids.fetch_add(1)),
+    fail_batch(batch(l.failures_per_sec)),
+    delay_batch(batch(l.delay_per_sec.count())),
+    budgeted(l.max_failures != 0),
+    budget(l.max_failures) {
+    if (l.failures_per_sec) {
+        failures = std::make_unique<TokenBucket>(l.failures_per_sec, now);
+    }
+    if (l.delay_per_sec.count()) {
+        delays = std::make_unique<TokenBucket>(l.delay_per_sec.count(), now);
+    }
+}
+
+bool sysfail::Limiter::limits(const Limit& l) {
+    return l.failures_per_sec || l.delay_per_sec.count() || l.max_failures;
+}
+
+sysfail::TokenCache::Entry* sysfail::Limiter::entry(
+    TokenCache* c,
+    nanoseconds now
+) {
+    auto e = &c->entries[id % TokenCache::slots];
+    if (e->id != id || now.count() >= e->expires_at) {
+        *e = {};
+        e->id = id;
+        e->expires_at = now.count() + cache_ttl_ns;
+    }
+    return e;
+}
+
+bool sysfail::Limiter::allow_failure(TokenCache* c, nanoseconds now) {
+    if (budgeted && budget.load(std::memory_order_relaxed) == 0) return false;
+
+    TokenCache::Entry* e = nullptr;
+    if (failures) {
+        e = entry(c, now);
+        if (e->failures == 0) {
+            if (now.count() < e->failures_retry_at) return false;
+            e->failures = failures->take(fail_batch, now);
+            if (e->failures == 0) {
+                e->failures_retry_at = failures->next_refill().count();
+                return false;
+            }
+        }
+    }
+
+    if (budgeted) {
+        auto b = budget.load();
+        do {
+            if (b == 0) return false;
+        } while (!budget.compare_exchange_weak(b, b - 1));
+    }
+    if (e) e->failures--;
+    return true;
+}
+
+std::chrono::microseconds sysfail::Limiter::allow_delay(
+    TokenCache* c,
+    std::chrono::microseconds want,
+    nanoseconds now
+) {
+    if (!delays) return want;
+
+    auto e = entry(c, now);
+    if (e->delay_us < want.count() && now.count() >= e->delay_retry_at) {
+        auto got = delays->take(
+            std::max(want.count() - e->delay_us, delay_batch),
+            now);
+        if (got == 0) e->delay_retry_at = delays->next_refill().count();
+        e->delay_us += got;
+    }
+    auto grant = std::min(want.count(), e->delay_us);
+    e->delay_us -= grant;
+    return std::chrono::microseconds(grant);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIMIT_HH
+#define _LIMIT_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "sysfail.hh"
+#include "schedule.hh"
+
+namespace sysfail {
+    // Lock-free token bucket refilled lazily by whoever takes from it,
+    // holds at most one second worth of tokens
+    class TokenBucket {
+        const int64_t rate; // tokens per second
+        std::atomic<int64_t> tokens;
+        std::atomic<int64_t> refilled_at; // ns
+
+        void refill(std::chrono::nanoseconds now);
+
+    public:
+        TokenBucket(int64_t rate, std::chrono::nanoseconds now);
+
+        // Takes up to `want` tokens, returns how many were taken
+        int64_t take(int64_t want, std::chrono::nanoseconds now);
+
+        // Earliest time a token may be available again
+        std::chrono::nanoseconds next_refill() const;
+    };
+
+    // Per-thread cache of tokens (taken from buckets in batches) so threads
+    // only touch shared buckets once every few injections. Entries are
+    // keyed by limiter-id, tokens cached for a limiter that is gone (plan
+    // was replaced) are simply dropped.
+    struct TokenCache {
+        static constexpr int slots = 8;
+
+        struct Entry {
+            uint64_t id = 0;
+            int64_t failures = 0;
+            int64_t delay_us = 0;
+            // bucket was found empty, don't look again until
+            int64_t failures_retry_at = 0;
+            int64_t delay_retry_at = 0;
+            // cached tokens are dropped after this, to keep them fresh
+            int64_t expires_at = 0;
+        };
+
+        Entry entries[slots];
+    };
+
+    // Enforces an outcome's Limit, safe to use from the handler (does not
+    // allocate or block)
+    class Limiter {
+        static std::atomic<uint64_t> ids;
+
+        const uint64_t id;
+        const int64_t fail_batch;
+        const int64_t delay_batch;
+        std::unique_ptr<TokenBucket> failures;
+        std::unique_ptr<TokenBucket> delays; // in microseconds
+        const bool budgeted;
+        std::atomic<uint64_t> budget;
+
+        TokenCache::Entry* entry(TokenCache* c, std::chrono::nanoseconds now);
+
+    public:
+        Limiter(
+            const Limit& l,
+            std::chrono::nanoseconds now = schedule::coarse_now());
+
+        // Whether a failure may be injected (consumes allowance if so)
+        bool allow_failure(TokenCache* c, std::chrono::nanoseconds now);
+
+        // How much of the `want`ed delay may be injected
+        std::chrono::microseconds allow_delay(
+            TokenCache* c,
+            std::chrono::microseconds want,
+            std::chrono::nanoseconds now);
+
+        static bool limits(const Limit& l);
+    };
+}
+
+#endif
@@ -18,6 +18,9 @@
 
 #include <regex>
 #include <cassert>
+#include <memory>
+#include <dlfcn.h>
+#include <cxxabi.h>
 
 std::optional<sysfail::Mapping> sysfail::get_mmap(pid_t pid) {
     Mapping mapping;
@@ -53,6 +56,7 @@ std::optional<sysfail::Mapping> sysfail::get_mmap(pid_t pid) {
         info.permissions = permissions;
         info.path = path;
         info.inode = inode;
+        info.offset = std::stoull(offsetStr, nullptr, 16);
 
         mapping.map[startAddr] = info;
     }
@@ -84,4 +88,35 @@ sysfail::AddrRange sysfail::Mapping::self_text() {
     assert(mappings.size() == 1);
 
     return mappings[0];
-}
\ No newline at end of file
+}
+
+const sysfail::AddrRange* sysfail::Mapping::find(uintptr_t addr) const {
+    auto it = map.upper_bound(addr);
+    if (it == map.begin()) return nullptr;
+    --it;
+    if (addr - it->second.start >= it->second.length) return nullptr;
+    return &it->second;
+}
+
+std::string sysfail::Mapping::symbolize(uintptr_t addr) const {
+    auto at = addr - 1;
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(at), &info) && info.dli_sname) {
+        int status;
+        std::unique_ptr<char, decltype(&free)> demangled(
+            abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status),
+            &free);
+        return status == 0 ? demangled.get() : info.dli_sname;
+    }
+
+    std::stringstream ss;
+    if (auto r = find(at)) {
+        auto slash = r->path.find_last_of('/');
+        auto module = r->path.empty() ? "[anon]" :
+            slash == std::string::npos ? r->path : r->path.substr(slash + 1);
+        ss << module << "+0x" << std::hex << (at - r->start + r->offset);
+    } else {
+        ss << "0x" << std::hex << at;
+    }
+    return ss.str();
+}
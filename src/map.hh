@@ -33,6 +33,7 @@ namespace sysfail {
         std::string permissions;
         std::string path;
         uintptr_t inode;
+        uintptr_t offset;
 
         bool executable() const;
         bool vdso() const;
@@ -43,6 +44,14 @@ namespace sysfail {
         std::map<uintptr_t, AddrRange> map;
 
         AddrRange self_text();
+
+        // Mapping that contains the given address, if any
+        const AddrRange* find(uintptr_t addr) const;
+
+        // Human readable name for a code address (function name when
+        // exported, `module+0xoffset` otherwise). Code addresses from stacks
+        // are return-addresses, so the byte before them is looked up.
+        std::string symbolize(uintptr_t addr) const;
     };
 
     std::optional<Mapping> get_mmap(pid_t pid);
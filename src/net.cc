@@ -0,0 +1,410 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+#include "net.hh"
+#include "helpers.hh"
+#include "syscall.hh"
+
+namespace {
+    struct Prefix {
+        std::array<uint8_t, 16> addr;
+        uint32_t bits;
+        std::optional<uint16_t> port;
+    };
+
+    template <typename T> bool number(const std::string& s, T max, T& out) {
+        auto end = s.data() + s.size();
+        uint64_t v;
+        auto [at, ec] = std::from_chars(s.data(), end, v);
+        if (ec != std::errc() || at != end || v > max) return false;
+        out = v;
+        return true;
+    }
+
+    // "address[/bits][:port]", IPv6 addresses in brackets when followed by
+    // a port
+    Prefix parse(const std::string& peer) {
+        auto bad = [&](const std::string& why) {
+            return std::invalid_argument("Bad link peer " + peer + ": " + why);
+        };
+        std::string addr, tail;
+        bool v6;
+        if (!peer.empty() && peer[0] == '[') {
+            auto close = peer.find(']');
+            if (close == std::string::npos) throw bad("unterminated [");
+            addr = peer.substr(1, close - 1);
+            tail = peer.substr(close + 1);
+            v6 = true;
+        } else {
+            v6 = std::count(peer.begin(), peer.end(), ':') > 1;
+            auto end = peer.find_first_of(v6 ? "/" : "/:");
+            addr = peer.substr(0, end);
+            tail = end == std::string::npos ? "" : peer.substr(end);
+        }
+
+        Prefix p{{}, v6 ? 128u : 32u, std::nullopt};
+        if (v6) {
+            if (inet_pton(AF_INET6, addr.c_str(), p.addr.data()) != 1) {
+                throw bad("not an IPv6 address");
+            }
+        } else {
+            p.addr[10] = p.addr[11] = 0xff;
+            if (inet_pton(AF_INET, addr.c_str(), p.addr.data() + 12) != 1) {
+                throw bad("not an IPv4 address");
+            }
+        }
+        auto port_at = tail.find(':');
+        if (!tail.empty() && tail[0] == '/') {
+            uint32_t bits;
+            if (!number(tail.substr(1, port_at - 1), p.bits, bits)) {
+                throw bad("prefix length out of range");
+            }
+            p.bits = bits;
+        } else if (port_at != 0 && !tail.empty()) {
+            throw bad("unexpected " + tail);
+        }
+        if (port_at != std::string::npos) {
+            uint16_t port;
+            if (!number(tail.substr(port_at + 1), uint16_t(65535), port) ||
+                port == 0) {
+                throw bad("port out of range");
+            }
+            p.port = port;
+        }
+        if (!v6) p.bits += 96;
+        return p;
+    }
+
+    // Reads the process' memory without faulting
+    bool read_mem(uint64_t addr, void* buf, size_t len) {
+        if (addr == 0) return false;
+        auto pid = sysfail::syscall(0, 0, 0, 0, 0, 0, SYS_getpid);
+        iovec local{buf, len};
+        iovec remote{reinterpret_cast<void*>(addr), len};
+        auto r = sysfail::syscall(
+            pid,
+            reinterpret_cast<uint64_t>(&local),
+            1,
+            reinterpret_cast<uint64_t>(&remote),
+            1,
+            0,
+            SYS_process_vm_readv);
+        return r == static_cast<long>(len);
+    }
+
+    std::optional<sysfail::Peer> peer_at(uint64_t addr, uint64_t len) {
+        sockaddr_storage ss;
+        len = std::min<uint64_t>(len, sizeof(ss));
+        if (!read_mem(addr, &ss, len)) return std::nullopt;
+        return sysfail::Peer::of(reinterpret_cast<sockaddr*>(&ss), len);
+    }
+}
+
+sysfail::net::Link::Link(
+    const std::vector<std::string>& peers,
+    std::chrono::microseconds latency,
+    std::chrono::microseconds jitter,
+    double loss,
+    Errno error
+) : peers(peers), latency(latency), jitter(jitter), loss(loss), error(error) {
+    if (peers.empty()) {
+        throw std::invalid_argument("Link must have peers");
+    }
+    for (const auto& p : peers) parse(p);
+    if (latency.count() < 0 || jitter.count() < 0) {
+        throw std::invalid_argument("Link latency must not be negative");
+    }
+    if (!(loss >= 0 && loss <= 1)) {
+        throw std::invalid_argument("Link loss must be in [0, 1]");
+    }
+    if (error <= 0) {
+        throw std::invalid_argument("Link error must be positive");
+    }
+}
+
+std::optional<sysfail::Peer> sysfail::Peer::of(
+    const sockaddr* sa,
+    socklen_t len
+) {
+    Peer p{{}, 0};
+    if (len >= sizeof(sockaddr_in) && sa->sa_family == AF_INET) {
+        auto in = reinterpret_cast<const sockaddr_in*>(sa);
+        p.addr[10] = p.addr[11] = 0xff;
+        std::memcpy(p.addr.data() + 12, &in->sin_addr, 4);
+        p.port = ntohs(in->sin_port);
+        return p;
+    }
+    if (len >= sizeof(sockaddr_in6) && sa->sa_family == AF_INET6) {
+        auto in6 = reinterpret_cast<const sockaddr_in6*>(sa);
+        std::memcpy(p.addr.data(), &in6->sin6_addr, 16);
+        p.port = ntohs(in6->sin6_port);
+        return p;
+    }
+    return std::nullopt;
+}
+
+void sysfail::PeerTable::build() {
+    std::lock_guard<std::mutex> l(mtx);
+    if (owned) return;
+    owned.reset(new Entry[max_fds]);
+    entries.store(owned.get(), std::memory_order_release);
+}
+
+void sysfail::PeerTable::store(
+    int64_t fd,
+    uint32_t meta,
+    const uint64_t (&addr)[2]
+) {
+    auto table = entries.load(std::memory_order_acquire);
+    if (!table || fd < 0 || static_cast<size_t>(fd) >= max_fds) return;
+    auto& e = table[fd];
+    auto s = e.seq.load(std::memory_order_relaxed);
+    // a racing writer (eg. close vs connect of one fd) wins
+    if ((s & 1) ||
+        !e.seq.compare_exchange_strong(s, s + 1, std::memory_order_relaxed)) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    e.addr[0].store(addr[0], std::memory_order_relaxed);
+    e.addr[1].store(addr[1], std::memory_order_relaxed);
+    e.meta.store(meta, std::memory_order_relaxed);
+    e.seq.store(s + 2, std::memory_order_release);
+}
+
+void sysfail::PeerTable::set(int64_t fd, const std::optional<Peer>& p) {
+    uint64_t addr[2] = {};
+    if (!p) return store(fd, None << 16, addr);
+    std::memcpy(addr, p->addr.data(), sizeof(addr));
+    store(fd, Connected << 16 | p->port, addr);
+}
+
+void sysfail::PeerTable::clear(int64_t fd) {
+    store(fd, Unknown << 16, {0, 0});
+}
+
+std::optional<sysfail::Peer> sysfail::PeerTable::peer_of(int64_t fd) {
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    auto r = sysfail::syscall(
+        fd,
+        reinterpret_cast<uint64_t>(&ss),
+        reinterpret_cast<uint64_t>(&len),
+        0,
+        0,
+        0,
+        SYS_getpeername);
+    if (r < 0) return std::nullopt;
+    return Peer::of(reinterpret_cast<sockaddr*>(&ss), len);
+}
+
+void sysfail::PeerTable::observe(Syscall call, const greg_t* regs) {
+    if (!entries.load(std::memory_order_acquire)) return;
+    auto ret = regs[REG_RAX];
+    switch (call) {
+        case SYS_close:
+            clear(regs[REG_RDI]);
+            return;
+        case SYS_close_range:
+            if (ret < 0) return;
+            for (auto fd = static_cast<uint64_t>(regs[REG_RDI]);
+                 fd <= static_cast<uint64_t>(regs[REG_RSI]) && fd < max_fds;
+                 fd++) {
+                clear(fd);
+            }
+            return;
+        case SYS_connect:
+            // a non-blocking connect is on its way to the peer
+            if (ret < 0 && ret != -EINPROGRESS) return;
+            set(regs[REG_RDI], peer_at(regs[REG_RSI], regs[REG_RDX]));
+            return;
+        default:
+            break;
+    }
+    if (ret < 0) return;
+    switch (call) {
+        case SYS_socket:
+            set(ret, std::nullopt);
+            break;
+        case SYS_accept:
+        case SYS_accept4:
+            // looked up if ever needed, the fd number may have been seen
+            clear(ret);
+            break;
+        case SYS_dup:
+        case SYS_dup2:
+        case SYS_dup3:
+            if (regs[REG_RDI] != ret) set(ret, lookup(regs[REG_RDI]));
+            break;
+        case SYS_fcntl:
+            if (regs[REG_RSI] == F_DUPFD || regs[REG_RSI] == F_DUPFD_CLOEXEC) {
+                set(ret, lookup(regs[REG_RDI]));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+std::optional<sysfail::Peer> sysfail::PeerTable::lookup(int64_t fd) {
+    if (fd < 0) return std::nullopt;
+    auto table = entries.load(std::memory_order_acquire);
+    if (!table || static_cast<size_t>(fd) >= max_fds) return peer_of(fd);
+    auto& e = table[fd];
+    auto s = e.seq.load(std::memory_order_acquire);
+    auto meta = e.meta.load(std::memory_order_relaxed);
+    uint64_t addr[2] = {
+        e.addr[0].load(std::memory_order_relaxed),
+        e.addr[1].load(std::memory_order_relaxed)};
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ((s & 1) || e.seq.load(std::memory_order_relaxed) != s) {
+        return peer_of(fd);
+    }
+    switch (meta >> 16) {
+        case Unknown: {
+            auto p = peer_of(fd);
+            set(fd, p);
+            return p;
+        }
+        case Connected: {
+            Peer p{{}, static_cast<uint16_t>(meta & 0xffff)};
+            std::memcpy(p.addr.data(), addr, sizeof(addr));
+            return p;
+        }
+        default:
+            return std::nullopt;
+    }
+}
+
+sysfail::LinkTable::LinkTable(
+    const std::vector<net::Link>& links,
+    PeerTable& peers
+) : links(links), peers(peers), nodes(1) {
+    std::vector<std::vector<std::pair<uint16_t, uint32_t>>> node_ports(1);
+    for (uint32_t i = 0; i < links.size(); i++) {
+        for (const auto& peer : links[i].peers) {
+            auto p = parse(peer);
+            uint32_t n = 0;
+            for (uint32_t bit = 0; bit < p.bits; bit++) {
+                auto b = (p.addr[bit / 8] >> (7 - bit % 8)) & 1;
+                if (nodes[n].child[b] == none) {
+                    nodes[n].child[b] = nodes.size();
+                    nodes.emplace_back();
+                    node_ports.emplace_back();
+                }
+                n = nodes[n].child[b];
+            }
+            auto dup = p.port
+                ? std::any_of(
+                    node_ports[n].begin(),
+                    node_ports[n].end(),
+                    [&](const auto& e) { return e.first == *p.port; })
+                : nodes[n].any != none;
+            if (dup) {
+                throw std::invalid_argument(
+                    "Peer " + peer + " is on more than one link");
+            }
+            if (p.port) {
+                node_ports[n].emplace_back(*p.port, i);
+            } else {
+                nodes[n].any = i;
+            }
+        }
+    }
+    for (uint32_t n = 0; n < nodes.size(); n++) {
+        std::sort(node_ports[n].begin(), node_ports[n].end());
+        nodes[n].ports_at = ports.size();
+        ports.insert(ports.end(), node_ports[n].begin(), node_ports[n].end());
+        nodes[n].ports_end = ports.size();
+    }
+    // sockets' peers are kept from now on
+    peers.build();
+}
+
+bool sysfail::LinkTable::supports(Syscall call) {
+    switch (call) {
+        case SYS_connect:
+        case SYS_sendto:
+        case SYS_sendmsg:
+        case SYS_recvfrom:
+        case SYS_recvmsg:
+            return true;
+        default:
+            return false;
+    }
+}
+
+const sysfail::net::Link* sysfail::LinkTable::route(const Peer& p) const {
+    const net::Link* best = nullptr;
+    uint32_t n = 0;
+    for (uint32_t bit = 0; ; bit++) {
+        const auto& node = nodes[n];
+        auto begin = ports.begin() + node.ports_at;
+        auto end = ports.begin() + node.ports_end;
+        auto e = std::lower_bound(
+            begin,
+            end,
+            p.port,
+            [](const auto& x, uint16_t port) { return x.first < port; });
+        if (e != end && e->first == p.port) {
+            best = &links[e->second];
+        } else if (node.any != none) {
+            best = &links[node.any];
+        }
+        if (bit == 128) break;
+        n = node.child[(p.addr[bit / 8] >> (7 - bit % 8)) & 1];
+        if (n == none) break;
+    }
+    return best;
+}
+
+const sysfail::net::Link* sysfail::LinkTable::find(const greg_t* regs) const {
+    auto fd = regs[REG_RDI];
+    std::optional<Peer> p;
+    switch (regs[REG_RAX]) {
+        case SYS_connect:
+            p = peer_at(regs[REG_RSI], regs[REG_RDX]);
+            break;
+        case SYS_sendto:
+            p = regs[REG_R8]
+                ? peer_at(regs[REG_R8], regs[REG_R9])
+                : peers.lookup(fd);
+            break;
+        case SYS_sendmsg: {
+            msghdr m;
+            if (!read_mem(regs[REG_RSI], &m, sizeof(m))) return nullptr;
+            p = m.msg_name && m.msg_namelen
+                ? peer_at(reinterpret_cast<uint64_t>(m.msg_name), m.msg_namelen)
+                : peers.lookup(fd);
+            break;
+        }
+        case SYS_recvfrom:
+        case SYS_recvmsg:
+            p = peers.lookup(fd);
+            break;
+        default:
+            return nullptr;
+    }
+    return p ? route(*p) : nullptr;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _NET_HH
+#define _NET_HH
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sys/socket.h>
+#include <sys/ucontext.h>
+#include <vector>
+
+#include "sysfail.hh"
+
+namespace sysfail {
+    // Address (IPv4 as IPv4-mapped IPv6) and port of a socket's peer
+    struct Peer {
+        std::array<uint8_t, 16> addr;
+        uint16_t port;
+
+        // Peer at an AF_INET / AF_INET6 address, nullopt for other families
+        static std::optional<Peer> of(const sockaddr* sa, socklen_t len);
+    };
+
+    // Peers of the process' sockets, a flat table indexed by fd. Entries are
+    // filled in the handler as sockets are connected (and cleared as fds
+    // are closed), accepted sockets and sockets the table hasn't seen are
+    // looked up with a raw getpeername on first use. Each entry is a
+    // seqlock, a reader racing a writer looks the peer up instead of
+    // waiting.
+    //
+    // The table is built when a plan first compiles links, until then
+    // nothing is kept.
+    class PeerTable {
+        enum State : uint32_t { Unknown = 0, None, Connected };
+
+        struct Entry {
+            std::atomic<uint32_t> seq{0};
+            // state << 16 | port
+            std::atomic<uint32_t> meta{0};
+            std::atomic<uint64_t> addr[2] = {};
+        };
+
+        // null until built, `owned` keeps it
+        std::atomic<Entry*> entries{nullptr};
+        std::unique_ptr<Entry[]> owned;
+        std::mutex mtx; // serializes building
+
+        void store(int64_t fd, uint32_t meta, const uint64_t (&addr)[2]);
+
+        void set(int64_t fd, const std::optional<Peer>& p);
+
+        void clear(int64_t fd);
+
+    public:
+        void build();
+
+        // Records sockets the call connected, accepted, created or closed
+        // (after it returned)
+        void observe(Syscall call, const greg_t* regs);
+
+        // Peer of the socket, nullopt => not a connected inet socket
+        std::optional<Peer> lookup(int64_t fd);
+
+        // Raw getpeername
+        static std::optional<Peer> peer_of(int64_t fd);
+    };
+
+    // Links of an outcome, compiled into a binary trie over peer addresses
+    // (each node holds the links whose prefix ends there, by port)
+    class LinkTable {
+        static constexpr uint32_t none = UINT32_MAX;
+
+        struct Node {
+            uint32_t child[2] = {none, none};
+            // link for any port, and [ports_at, ports_end) in `ports`
+            uint32_t any = none;
+            uint32_t ports_at = 0;
+            uint32_t ports_end = 0;
+        };
+
+        const std::vector<net::Link> links;
+        PeerTable& peers;
+        std::vector<Node> nodes;
+        // (port, link) sorted by port within a node
+        std::vector<std::pair<uint16_t, uint32_t>> ports;
+
+    public:
+        // Builds the peer table. Throws std::invalid_argument if a prefix is
+        // on more than one link.
+        LinkTable(const std::vector<net::Link>& links, PeerTable& peers);
+
+        static bool supports(Syscall call);
+
+        // Link the peer is on, nullptr => none
+        const net::Link* route(const Peer& p) const;
+
+        // Link the call's peer is on, reads the call's address arguments
+        // without faulting (a call with an unreadable address is on none)
+        const net::Link* find(const greg_t* regs) const;
+    };
+}
+
+#endif
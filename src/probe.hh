@@ -0,0 +1,106 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PROBE_HH
+#define _PROBE_HH
+
+#include <cstdint>
+
+// Statically defined tracing probes (USDT) under provider `sysfail`.
+//
+// Each probe is a single `nop` plus an ELF note (.note.stapsdt) describing
+// its location and arguments, in the format defined by systemtap's
+// <sys/sdt.h>. This is what bpftrace / perf / bcc look for, eg.
+//   bpftrace -e 'usdt:/usr/lib/libsysfail.so:sysfail:decide { ... }'
+//   perf buildid-cache --add libsysfail.so && perf record -e sdt_sysfail:*
+// Nothing is executed unless a tracer attaches (it patches the nop with a
+// breakpoint), so probes are always compiled in. Arguments are passed as
+// signed 64-bit values.
+//
+// Probes:
+//   decide(syscall, tid, decision, errno, delay_us)
+//       decision is a bitmask of probe::FailBefore, FailAfter, DelayBefore,
+//       DelayAfter (0 => syscall passed through untouched)
+//   thd_enable(tid, self)       thread armed (self: by the thread itself)
+//   thd_disable(tid, self)      thread disarmed for good
+//   disarm(tid)                 temporarily disarmed (libc masks signals)
+//   rearm(tid)                  re-armed after temporary disarm
+//   queued(syscall, tid, wait_ns)
+//       call waited for a slot of its Concurrency queue
+//   scan(generation, tasks, spawned, terminated, elapsed_ns)
+//       thread-discovery poll of /proc/self/task
+
+namespace sysfail::probe {
+    enum : int64_t {
+        FailBefore = 1,
+        FailAfter = 2,
+        DelayBefore = 4,
+        DelayAfter = 8
+    };
+}
+
+#define _SYSFAIL_PROBE(name, args, ...)                                       \
+    __asm__ __volatile__ (                                                    \
+        "990: nop\n"                                                          \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                         \
+        ".balign 4\n"                                                         \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                    \
+        "991: .asciz \"stapsdt\"\n"                                           \
+        "992: .balign 4\n"                                                    \
+        "993: .8byte 990b\n"                                                  \
+        ".8byte _.stapsdt.base\n"                                             \
+        ".8byte 0\n"                                                          \
+        ".asciz \"sysfail\"\n"                                                \
+        ".asciz \"" #name "\"\n"                                              \
+        ".asciz \"" args "\"\n"                                               \
+        "994: .balign 4\n"                                                    \
+        ".popsection\n"                                                       \
+        ".ifndef _.stapsdt.base\n"                                            \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\","                     \
+            ".stapsdt.base,comdat\n"                                          \
+        ".weak _.stapsdt.base\n"                                              \
+        ".hidden _.stapsdt.base\n"                                            \
+        "_.stapsdt.base: .space 1\n"                                          \
+        ".size _.stapsdt.base, 1\n"                                           \
+        ".popsection\n"                                                       \
+        ".endif\n"                                                            \
+        :: __VA_ARGS__)
+
+#define _SYSFAIL_PROBE_ARG(n, v) [a##n] "nor"(static_cast<int64_t>(v))
+
+#define SYSFAIL_PROBE1(name, a0)                                              \
+    _SYSFAIL_PROBE(name, "-8@%[a0]", _SYSFAIL_PROBE_ARG(0, a0))
+
+#define SYSFAIL_PROBE2(name, a0, a1)                                          \
+    _SYSFAIL_PROBE(name, "-8@%[a0] -8@%[a1]",                                 \
+        _SYSFAIL_PROBE_ARG(0, a0),                                            \
+        _SYSFAIL_PROBE_ARG(1, a1))
+
+#define SYSFAIL_PROBE3(name, a0, a1, a2)                                      \
+    _SYSFAIL_PROBE(name, "-8@%[a0] -8@%[a1] -8@%[a2]",                        \
+        _SYSFAIL_PROBE_ARG(0, a0),                                            \
+        _SYSFAIL_PROBE_ARG(1, a1),                                            \
+        _SYSFAIL_PROBE_ARG(2, a2))
+
+#define SYSFAIL_PROBE5(name, a0, a1, a2, a3, a4)                              \
+    _SYSFAIL_PROBE(name, "-8@%[a0] -8@%[a1] -8@%[a2] -8@%[a3] -8@%[a4]",      \
+        _SYSFAIL_PROBE_ARG(0, a0),                                            \
+        _SYSFAIL_PROBE_ARG(1, a1),                                            \
+        _SYSFAIL_PROBE_ARG(2, a2),                                            \
+        _SYSFAIL_PROBE_ARG(3, a3),                                            \
+        _SYSFAIL_PROBE_ARG(4, a4))
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <climits>
+#include <linux/futex.h>
+
+#include "queue.hh"
+#include "syscall.hh"
+
+sysfail::Concurrency::Concurrency(
+    uint32_t limit,
+    const std::string& queue
+) : limit(limit), queue(queue) {
+    if (limit == 0) {
+        throw std::invalid_argument("Concurrency limit must be positive");
+    }
+}
+
+sysfail::Semaphore::Semaphore(uint32_t limit) : limit(limit) {}
+
+void sysfail::Semaphore::wake() {
+    // waiters re-check their own ticket, only those let in stay awake
+    sysfail::syscall(
+        reinterpret_cast<uint64_t>(&released),
+        FUTEX_WAKE_PRIVATE,
+        INT_MAX,
+        0,
+        0,
+        0,
+        SYS_futex);
+}
+
+std::chrono::nanoseconds sysfail::Semaphore::acquire() {
+    auto ticket = taken.fetch_add(1);
+    auto r = released.load();
+    // tickets wrap around, compare distances
+    if (ticket - r < limit.load()) return std::chrono::nanoseconds(0);
+
+    auto start = std::chrono::steady_clock::now();
+    while (ticket - r >= limit.load()) {
+        // a release between the load and the wait changes the futex word,
+        // so the wait returns right away
+        sleepers.fetch_add(1);
+        sysfail::syscall(
+            reinterpret_cast<uint64_t>(&released),
+            FUTEX_WAIT_PRIVATE,
+            r,
+            0,
+            0,
+            0,
+            SYS_futex);
+        sleepers.fetch_sub(1);
+        r = released.load();
+    }
+    return std::chrono::steady_clock::now() - start;
+}
+
+void sysfail::Semaphore::release() {
+    released.fetch_add(1);
+    if (sleepers.load() > 0) wake();
+}
+
+void sysfail::Semaphore::resize(uint32_t l) {
+    if (limit.exchange(l) < l && sleepers.load() > 0) wake();
+}
+
+sysfail::Semaphore* sysfail::Queues::get(const Concurrency& c, Syscall call) {
+    auto key = c.queue.empty()
+        ? std::make_pair(std::string(), call)
+        : std::make_pair(c.queue, static_cast<Syscall>(-1));
+    std::lock_guard<std::mutex> l(mtx);
+    auto& q = queues[key];
+    if (!q) q = std::make_unique<Semaphore>(c.limit);
+    return q.get();
+}
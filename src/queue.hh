@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _QUEUE_HH
+#define _QUEUE_HH
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "sysfail.hh"
+
+namespace sysfail {
+    // FIFO counting semaphore, callers take a ticket and wait (on a futex,
+    // using raw syscalls) until fewer than `limit` tickets ahead of theirs
+    // are still held. Safe to use from the handler.
+    class Semaphore {
+        // tickets handed out, and given back (futex word)
+        std::atomic<uint32_t> taken{0};
+        std::atomic<uint32_t> released{0};
+        std::atomic<uint32_t> limit;
+        std::atomic<uint32_t> sleepers{0};
+
+        void wake();
+
+    public:
+        explicit Semaphore(uint32_t limit);
+
+        // Returns the time spent waiting for a slot
+        std::chrono::nanoseconds acquire();
+
+        void release();
+
+        // Wakes waiters a higher limit lets in (any that miss it are let in
+        // by the next release)
+        void resize(uint32_t limit);
+    };
+
+    // Queues of a session by name, they are never removed (so a caller
+    // waiting in one doesn't depend on the plan that sent it there)
+    class Queues {
+        std::mutex mtx;
+        // unnamed queues are keyed by syscall (named ones by -1)
+        std::map<std::pair<std::string, Syscall>, std::unique_ptr<Semaphore>>
+            queues;
+
+    public:
+        // The outcome's queue, created with its limit if there is none yet
+        Semaphore* get(const Concurrency& c, Syscall call);
+    };
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RCU_HH
+#define _RCU_HH
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace sysfail {
+    // Read-copy-update style protection for data that is read from the
+    // SIGSYS handler and replaced rarely (eg. outcome table). Readers never
+    // block or allocate (so are safe in the handler, including nested
+    // signals), the writer publishes a replacement and waits for readers
+    // that may still see the old one before reclaiming it.
+    //
+    // Readers are counted per epoch-parity, striped (by tid) across
+    // cache-lines to keep unrelated threads from contending.
+    class Rcu {
+        static constexpr uint32_t stripes = 32;
+
+        struct alignas(64) Stripe {
+            std::atomic<uint64_t> readers{0};
+        };
+
+        std::atomic<uint32_t> epoch{0};
+        Stripe counts[2][stripes];
+
+    public:
+        class Reader {
+            Rcu& rcu;
+            uint32_t parity;
+            uint32_t stripe;
+
+        public:
+            Reader(Rcu& rcu, uint32_t id) : rcu(rcu), stripe(id % stripes) {
+                parity = rcu.epoch.load() & 1;
+                rcu.counts[parity][stripe].readers.fetch_add(1);
+            }
+
+            ~Reader() {
+                rcu.counts[parity][stripe].readers.fetch_sub(
+                    1,
+                    std::memory_order_release);
+            }
+
+            Reader(const Reader&) = delete;
+            Reader& operator=(const Reader&) = delete;
+        };
+
+        // Waits for readers that entered before the call to leave. Callers
+        // must publish the replacement before calling this, and must
+        // serialize calls.
+        //
+        // Each phase flips the epoch (so new readers count against the other
+        // parity) and drains the parity readers were using. Two phases are
+        // needed because a reader may sample the epoch just before a flip
+        // and register against the parity being drained after the check.
+        void synchronize() {
+            for (int phase = 0; phase < 2; phase++) {
+                auto parity = epoch.fetch_add(1) & 1;
+                for (uint32_t i = 0; i < stripes; i++) {
+                    while (counts[parity][i].readers.load() != 0) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RNG_HH
+#define _RNG_HH
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace sysfail::rng {
+    using Block = std::array<uint32_t, 4>;
+    using Key = std::array<uint32_t, 2>;
+
+    // Philox4x32-10 (Salmon et al, "Parallel random numbers: as easy as
+    // 1, 2, 3"): a counter-based generator, the n-th block of a stream is a
+    // pure function of (key, n), so streams need no state to be carried
+    // across calls or threads.
+    inline Block philox(Block ctr, Key key) {
+        constexpr uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+        constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+
+        for (int round = 0; round < 10; round++) {
+            auto p0 = static_cast<uint64_t>(M0) * ctr[0];
+            auto p1 = static_cast<uint64_t>(M1) * ctr[2];
+            ctr = {
+                static_cast<uint32_t>(p1 >> 32) ^ ctr[1] ^ key[0],
+                static_cast<uint32_t>(p1),
+                static_cast<uint32_t>(p0 >> 32) ^ ctr[3] ^ key[1],
+                static_cast<uint32_t>(p0)};
+            key[0] += W0;
+            key[1] += W1;
+        }
+        return ctr;
+    }
+
+    // UniformRandomBitGenerator over Philox blocks. The stream is
+    // identified by (seed, ordinal, index) eg. (plan seed, thread, call),
+    // draws within a stream walk the lowest counter word.
+    class Philox {
+        Key key;
+        Block ctr;
+        Block out;
+        uint32_t used;
+
+    public:
+        using result_type = uint32_t;
+
+        explicit Philox(uint64_t seed, uint32_t ordinal = 0, uint64_t index = 0) :
+            key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)},
+            ctr{
+                0,
+                static_cast<uint32_t>(index),
+                static_cast<uint32_t>(index >> 32),
+                ordinal},
+            out{},
+            used(4) {}
+
+        result_type operator()() {
+            if (used == 4) {
+                out = philox(ctr, key);
+                used = 0;
+                if (++ctr[0] == 0) ++ctr[1];
+            }
+            return out[used++];
+        }
+
+        static constexpr result_type min() { return 0; }
+
+        static constexpr result_type max() {
+            return std::numeric_limits<result_type>::max();
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "schedule.hh"
+#include "helpers.hh"
+
+namespace {
+    void check_level(double l) {
+        if (l < 0 || l > 1) {
+            throw std::invalid_argument("Level must be in [0, 1]");
+        }
+    }
+
+    void check_positive(std::chrono::milliseconds d) {
+        if (d.count() <= 0) {
+            throw std::invalid_argument("Duration must be positive");
+        }
+    }
+
+    uint64_t mix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+}
+
+sysfail::schedule::Ramp::Ramp(
+    double from,
+    double to,
+    milliseconds over
+) : from(from), to(to), over(over) {
+    check_level(from);
+    check_level(to);
+    check_positive(over);
+}
+
+sysfail::schedule::Square::Square(
+    milliseconds on,
+    milliseconds period,
+    milliseconds offset
+) : on(on), period(period), offset(offset) {
+    check_positive(period);
+    if (on.count() < 0 || on > period) {
+        throw std::invalid_argument("On-time must be in [0, period]");
+    }
+    if (offset.count() < 0) {
+        throw std::invalid_argument("Offset must not be negative");
+    }
+}
+
+sysfail::schedule::Incidents::Incidents(
+    milliseconds mean_gap,
+    milliseconds duration,
+    uint64_t seed
+) : mean_gap(mean_gap), duration(duration), seed(seed) {
+    check_positive(mean_gap);
+    check_positive(duration);
+}
+
+sysfail::schedule::Steps::Steps(
+    std::vector<Step> steps,
+    milliseconds period
+) : steps(steps), period(period) {
+    for (size_t i = 0; i < steps.size(); i++) {
+        check_level(steps[i].level);
+        if (steps[i].at.count() < 0) {
+            throw std::invalid_argument("Step time must not be negative");
+        }
+        if (i > 0 && steps[i].at <= steps[i - 1].at) {
+            throw std::invalid_argument("Steps must be in increasing order");
+        }
+    }
+    if (period.count() < 0) {
+        throw std::invalid_argument("Period must not be negative");
+    }
+}
+
+sysfail::schedule::Schedule sysfail::schedule::resolve(
+    const Schedule& s,
+    uint64_t seed
+) {
+    if (auto i = std::get_if<Incidents>(&s); i && i->seed == 0) {
+        return Incidents(i->mean_gap, i->duration, seed ? seed : 1);
+    }
+    return s;
+}
+
+bool sysfail::schedule::constant(const Schedule& s) {
+    return std::holds_alternative<Constant>(s);
+}
+
+double sysfail::schedule::level(const Schedule& s, std::chrono::nanoseconds t) {
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+
+    return std::visit(cases(
+        [](const Constant&) {
+            return 1.0;
+        },
+        [&](const Ramp& r) {
+            auto f = static_cast<double>(t.count()) /
+                duration_cast<nanoseconds>(r.over).count();
+            return r.from + (r.to - r.from) * std::min(f, 1.0);
+        },
+        [&](const Square& sq) {
+            auto since = t - duration_cast<nanoseconds>(sq.offset);
+            if (since.count() < 0) return 0.0;
+            return since % duration_cast<nanoseconds>(sq.period) <
+                duration_cast<nanoseconds>(sq.on) ? 1.0 : 0.0;
+        },
+        [&](const Incidents& i) {
+            auto slot = t / duration_cast<nanoseconds>(i.duration);
+            // chance of at least one Poisson arrival within a slot
+            auto p = -std::expm1(
+                -static_cast<double>(i.duration.count()) / i.mean_gap.count());
+            auto u = (mix(i.seed ^ mix(slot)) >> 11) * 0x1.0p-53;
+            return u < p ? 1.0 : 0.0;
+        },
+        [&](const Steps& st) {
+            auto at = t;
+            if (st.period.count()) {
+                at %= duration_cast<nanoseconds>(st.period);
+            }
+            auto next = std::upper_bound(
+                st.steps.begin(),
+                st.steps.end(),
+                at,
+                [](auto at, const auto& step) {
+                    return at < duration_cast<nanoseconds>(step.at);
+                });
+            if (next == st.steps.begin()) return 0.0;
+            return std::prev(next)->level;
+        }),
+        s);
+}
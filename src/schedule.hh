@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SCHEDULE_HH
+#define _SCHEDULE_HH
+
+#include <chrono>
+#include <time.h>
+
+#include "sysfail.hh"
+
+namespace sysfail::schedule {
+    // Served by the vDSO without entering the kernel (so never trapped),
+    // resolution is a jiffy
+    inline std::chrono::nanoseconds coarse_now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return std::chrono::seconds(ts.tv_sec) +
+            std::chrono::nanoseconds(ts.tv_nsec);
+    }
+
+    // Fixes up anything left to be picked at activation (eg. unspecified
+    // seed is replaced by `seed`)
+    Schedule resolve(const Schedule& s, uint64_t seed);
+
+    bool constant(const Schedule& s);
+
+    // Level in [0, 1] at time `t` (since the schedule took effect), does not
+    // allocate
+    double level(const Schedule& s, std::chrono::nanoseconds t);
+}
+
+#endif
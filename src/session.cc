@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <sys/prctl.h>
 #include <sys/prctl.h>
@@ -23,9 +24,9 @@
 #include <cerrno>
 #include <csignal>
 #include <random>
-#include <thread>
 #include <functional>
 #include <linux/unistd.h>
+#include <unistd.h>
 
 #include "sysfail.hh"
 #include "session.hh"
@@ -34,14 +35,47 @@
 #include "log.hh"
 #include "signal.hh"
 #include "helpers.hh"
+#include "probe.hh"
 
 extern "C" {
     extern void sysfail_restore(greg_t*);
+    extern void sysfail_sigreturn(greg_t);
 }
 
 using namespace std::placeholders;
 using namespace std::chrono_literals;
 
+namespace {
+    // State of the calling thread, set only while the thread is
+    // failure-injected.
+    thread_local sysfail::ThdState* self_st = nullptr;
+
+    // Nesting of handler sections that use `self_st`. The thread's state is
+    // freed as soon as a disable completes, so a disable signal arriving in
+    // such a section is deferred (and completed) until it ends.
+    thread_local uint32_t using_st = 0;
+    thread_local sysfail::ThdState* deferred_disable = nullptr;
+
+    // Stream ordinal reserved for deriving per-syscall seeds (threads are
+    // numbered from 0)
+    constexpr uint32_t derived_seeds = ~0u;
+
+    uint64_t pick_seed(uint64_t seed) {
+        while (seed == 0) {
+            std::random_device rd;
+            seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+        }
+        return seed;
+    }
+
+    std::atomic<uint64_t> generations{1};
+
+    uint64_t derive_seed(uint64_t seed, sysfail::Syscall call) {
+        sysfail::Rng r(seed, derived_seeds, call);
+        return (static_cast<uint64_t>(r()) << 32) | r();
+    }
+}
+
 void sysfail::continue_syscall(ucontext_t *ctx) {
     auto rax = syscall(
         ctx->uc_mcontext.gregs[REG_RDI],
@@ -56,45 +90,257 @@ void sysfail::continue_syscall(ucontext_t *ctx) {
 }
 
 sysfail::ActiveOutcome::ActiveOutcome(
-    const Outcome& _o
+    const Outcome& _o,
+    uint64_t seed,
+    Semaphore* queue,
+    const std::optional<FdMatch>& fd_match,
+    const std::optional<PathMatch>& path_match,
+    const std::shared_ptr<const LinkTable>& links
 ) : fail(_o.fail),
     delay(_o.delay),
     max_delay(_o.max_delay),
-    eligibility_check(_o.eligible) {
+    eligibility_check(_o.eligible),
+    schedule(schedule::resolve(_o.schedule, seed)),
+    scheduled(!schedule::constant(_o.schedule)),
+    limiter(
+        Limiter::limits(_o.limit)
+        ? std::make_shared<Limiter>(_o.limit)
+        : nullptr),
+    trigger(_o.trigger),
+    latency(
+        std::holds_alternative<latency::Uniform>(_o.latency)
+        ? nullptr
+        : std::make_shared<latency::Table>(_o.latency, _o.max_delay)),
+    throttler(
+        _o.throttle
+        ? std::make_shared<Throttler>(*_o.throttle)
+        : nullptr),
+    device(
+        _o.device
+        ? std::make_shared<DeviceModel>(*_o.device)
+        : nullptr),
+    queue(queue),
+    fd_match(fd_match),
+    path_match(path_match),
+    links(links) {
+    double total = 0;
+    for (const auto& [err_no, weight] : _o.error_weights) {
+        if (weight < 0) {
+            throw std::invalid_argument("Error weight must not be negative");
+        }
+        total += weight;
+    }
+    // weights are relative, normalize them so a uniform [0, 1) draw picks
+    // an error (last entry is exactly 1)
     double cumulative = 0;
     for (const auto& [err_no, weight] : _o.error_weights) {
+        if (weight == 0) continue; // would shadow the previous error
         cumulative += weight;
-        error_by_cumulative_p[cumulative] = err_no;
+        error_by_cumulative_p[cumulative / total] = err_no;
     }
 }
 
 bool sysfail::ActiveOutcome::eligible(const greg_t* regs) const {
+    if (fd_match && !fd_match->matches(regs[REG_RDI])) return false;
+    if (path_match && !path_match->matches(regs)) return false;
     if (!eligibility_check) return true;
 
      // user wants to filter individual syscalls
     return eligibility_check(regs);
 }
 
-sysfail::ActivePlan::ActivePlan(const Plan& p) : p(p) {
+void sysfail::ActiveOutcome::limit(Decision& d) const {
+    if (!limiter || (!d.fail && !d.delay.count())) return;
+
+    thread_local TokenCache tokens;
+    auto now = schedule::coarse_now();
+    if (d.fail && !limiter->allow_failure(&tokens, now)) {
+        d.fail = 0;
+    }
+    if (d.delay.count()) {
+        d.delay = limiter->allow_delay(&tokens, d.delay, now);
+    }
+}
+
+int64_t sysfail::Decision::flags() const {
+    int64_t f = 0;
+    if (fail) f |= fail_after ? probe::FailAfter : probe::FailBefore;
+    if (delay.count()) f |= delay_after ? probe::DelayAfter : probe::DelayBefore;
+    return f;
+}
+
+sysfail::Decision sysfail::ActiveOutcome::decide(
+    Rng& rnd,
+    double level,
+    std::optional<bool> picked
+) const {
+    Decision d;
+    std::uniform_real_distribution<double> p_dist(0, 1);
+    if (delay.p * level > 0) {
+        if (p_dist(rnd) < delay.p * level) {
+            auto after_p = p_dist(rnd);
+            if (latency) {
+                d.delay = latency->sample(p_dist(rnd));
+            } else {
+                std::uniform_int_distribution<int> delay_dist(
+                    0,
+                    max_delay.count());
+                d.delay = std::chrono::microseconds(delay_dist(rnd));
+            }
+            d.delay_after = delay.after_bias && after_p < delay.after_bias;
+        }
+    }
+    auto fail_p = picked ? (*picked ? 1.0 : 0.0) : fail.p * level;
+    if (fail_p > 0) {
+        if (p_dist(rnd) < fail_p) {
+            auto err_p = p_dist(rnd);
+            auto e = error_by_cumulative_p.lower_bound(err_p);
+            auto after_p = p_dist(rnd);
+            if (e != error_by_cumulative_p.end()) {
+                d.fail = e->second;
+                d.fail_after = fail.after_bias && after_p < fail.after_bias;
+            }
+        }
+    }
+    return d;
+}
+
+sysfail::ActivePlan::ActivePlan(
+    const Plan& p,
+    Queues& queues,
+    FdTable& fd_table,
+    PeerTable& peers
+) : start(schedule::coarse_now()),
+    seed(pick_seed(p.seed)),
+    generation(generations.fetch_add(1)) {
+    // globs of all outcomes go into one automaton, outcomes are numbered in
+    // the order they are seen
+    std::vector<std::vector<std::string>> globs;
+    std::map<Syscall, uint32_t> glob_ids;
     for (const auto& [call, o] : p.outcomes) {
-        outcomes.insert({call, o});
+        if (o.paths.empty()) continue;
+        if (PathGlobs::path_arg(call) < 0) {
+            throw std::invalid_argument(
+                "Path globs on syscall without a path argument " +
+                std::to_string(call));
+        }
+        glob_ids[call] = globs.size();
+        globs.push_back(o.paths);
+    }
+    auto compiled = globs.empty()
+        ? nullptr
+        : std::make_shared<const PathGlobs>(globs);
+
+    for (const auto& [call, o] : p.outcomes) {
+        if (o.trigger &&
+            trigger::scope(*o.trigger) == trigger::Scope::Thread &&
+            (call < 0 || static_cast<uint32_t>(call) >= stats::max_syscall)) {
+            throw std::invalid_argument(
+                "Per-thread trigger on unsupported syscall " +
+                std::to_string(call));
+        }
+        if (o.throttle && !Throttler::supports(call)) {
+            throw std::invalid_argument(
+                "Throttle on unsupported syscall " + std::to_string(call));
+        }
+        if (o.device && !DeviceModel::supports(call)) {
+            throw std::invalid_argument(
+                "Device on unsupported syscall " + std::to_string(call));
+        }
+        if (o.fd_class && !FdTable::takes_fd(call)) {
+            throw std::invalid_argument(
+                "Fd class on syscall without an fd argument " +
+                std::to_string(call));
+        }
+        if (!o.links.empty() && !LinkTable::supports(call)) {
+            throw std::invalid_argument(
+                "Links on unsupported syscall " + std::to_string(call));
+        }
+        Semaphore* queue = nullptr;
+        if (o.concurrency) {
+            queue = queues.get(*o.concurrency, call);
+            auto [l, added] = queue_limits.emplace(queue, o.concurrency->limit);
+            if (!added && l->second != o.concurrency->limit) {
+                throw std::invalid_argument(
+                    "Conflicting limits for queue " + o.concurrency->queue);
+            }
+        }
+        outcomes.emplace(
+            std::piecewise_construct,
+            std::forward_as_tuple(call),
+            std::forward_as_tuple(
+                o,
+                derive_seed(seed, call),
+                queue,
+                o.fd_class
+                ? std::make_optional(fd_table.compile(*o.fd_class))
+                : std::nullopt,
+                o.paths.empty()
+                ? std::nullopt
+                : std::make_optional(PathMatch{compiled, glob_ids[call]}),
+                o.links.empty()
+                ? nullptr
+                : std::make_shared<const LinkTable>(o.links, peers)));
     }
 }
 
+void sysfail::ActivePlan::resize_queues() const {
+    for (const auto& [q, limit] : queue_limits) q->resize(limit);
+}
+
 sysfail::ActiveSession::ActiveSession(
     const Plan& _plan,
-    AddrRange&& _self_addr
-) : plan(_plan), self_text(_self_addr) {
+    Mapping& _mapping
+) : plan(_plan),
+    active(new ActivePlan(_plan, queues, fd_table, peers)),
+    self_text(_mapping.self_text()) {
+    if (plan.observe.stacks) {
+        stacks = std::make_unique<StackProfile>(
+            *plan.observe.stacks,
+            _mapping);
+    }
+    if (plan.observe.call_sites) {
+        sites = std::make_unique<CallSiteProfile>(
+            *plan.observe.call_sites,
+            _mapping);
+    }
+    if (plan.observe.live_stats) {
+        live = std::make_unique<stats::Publisher>();
+    }
+    if (plan.observe.record) {
+        recorder = std::make_unique<trace::Recorder>();
+    }
+    if (plan.replay) {
+        replayer = std::make_unique<trace::Replayer>(*plan.replay);
+    }
+    delay::calibrate();
     enable_handler(SIGSYS, handle_sigsys);
     enable_handler(SIG_REARM, reenable_sysfail);
     enable_handler(SIG_ENABLE, enable_sysfail);
     enable_handler(SIG_DISABLE, disable_sysfail);
+    // A handler that blocks SIGSYS can't return (its rt_sigreturn traps)
+    unblocked = unblock_in_handlers(SIGSYS);
+}
+
+sysfail::ActiveSession::~ActiveSession() {
+    reblock_in_handlers(SIGSYS, unblocked);
+    delete active.load();
+}
+
+void sysfail::ActiveSession::update(const Plan& _plan) {
+    auto replacement = new ActivePlan(_plan, queues, fd_table, peers);
+    std::lock_guard<std::mutex> l(update_mtx);
+    auto old = active.exchange(replacement);
+    replacement->resize_queues();
+    rcu.synchronize();
+    delete old;
 }
 
 void sysfail::ActiveSession::initialize() {
     tmon = std::make_unique<sysfail::ThdMon>(
-        plan.p.thd_disc,
-        std::bind(&ActiveSession::thd_track, this, _1, _2));
+        plan.thd_disc,
+        std::bind(&ActiveSession::thd_track, this, _1, _2),
+        [this](auto elapsed) { if (live) live->scanned(elapsed); });
 }
 
 void sysfail::ActiveSession::thd_track(pid_t tid, sysfail::DiscThdSt state) {
@@ -115,6 +361,7 @@ pid_t sysfail::ActiveSession::disarm() {
         a->second.on = SYSCALL_DISPATCH_FILTER_ALLOW;
     }
     assert(! a.empty());
+    SYSFAIL_PROBE1(disarm, tid);
     return tid;
 }
 
@@ -123,6 +370,7 @@ void sysfail::ActiveSession::rearm() {
     ThdSt::accessor a;
     if (thd_st.find(a, tid)) {
         a->second.on = SYSCALL_DISPATCH_FILTER_BLOCK;
+        SYSFAIL_PROBE1(rearm, tid);
     }
 }
 
@@ -144,10 +392,12 @@ static void enable(
         throw std::runtime_error("Failed to enable sysfail: " + errStr);
     }
 
+    self_st = st;
     st->on = SYSCALL_DISPATCH_FILTER_BLOCK;
 }
 
 static void disable() {
+    self_st = nullptr;
     auto ret = prctl(
         PR_SET_SYSCALL_USER_DISPATCH,
         PR_SYS_DISPATCH_OFF,
@@ -162,13 +412,21 @@ static void disable() {
     // caller must erase the thd-state
 }
 
+// Ends a section using `self_st`, completing the disable it deferred (if any)
+static void done_with_st() {
+    if (--using_st > 0 || !deferred_disable) return;
+    disable();
+    std::exchange(deferred_disable, nullptr)->sig_coord.release();
+}
+
 void sysfail::ActiveSession::thd_enable(pid_t tid) {
-    if (! plan.p.selector(tid)) return; // TODO: log
+    if (! plan.selector(tid)) return; // TODO: log
 
     ThdSt::accessor a;
     if (! thd_st.insert(a, tid)) return; // idempotency check
 
     auto& st = a->second;
+    thd_attach(tid, st);
     st.sig_coord.acquire();
 
     send_signal<ThdState>(
@@ -179,6 +437,7 @@ void sysfail::ActiveSession::thd_enable(pid_t tid) {
 
     st.sig_coord.acquire();
     st.sig_coord.release(); // leave sem in a re-usable state
+    SYSFAIL_PROBE2(thd_enable, tid, 0);
 }
 
 void sysfail::ActiveSession::thd_disable(pid_t tid) {
@@ -196,12 +455,14 @@ void sysfail::ActiveSession::thd_disable(pid_t tid) {
 
     st.sig_coord.acquire();
     st.sig_coord.release(); // leave sem in a re-usable state
+    thd_detach(st);
     thd_st.erase(a);
+    SYSFAIL_PROBE2(thd_disable, tid, 0);
 }
 
 void sysfail::ActiveSession::thd_enable() {
     auto tid = gettid();
-    if (!plan.p.selector(tid)) {
+    if (!plan.selector(tid)) {
         // std::cerr << "Not enabling sysfail for " << pid << "\n";
         return;
     }
@@ -209,7 +470,9 @@ void sysfail::ActiveSession::thd_enable() {
     ThdSt::accessor a;
     if (thd_st.insert(a, tid)) {
         a->second.on = SYSCALL_DISPATCH_FILTER_ALLOW;
+        thd_attach(tid, a->second);
         enable(self_text, &a->second);
+        SYSFAIL_PROBE2(thd_enable, tid, 1);
     }
 }
 
@@ -220,71 +483,352 @@ void sysfail::ActiveSession::thd_disable() {
 
     a->second.on = SYSCALL_DISPATCH_FILTER_ALLOW;
     disable();
+    thd_detach(a->second);
     thd_st.erase(a);
+    SYSFAIL_PROBE2(thd_disable, tid, 1);
+}
+
+void sysfail::ActiveSession::thd_attach(pid_t tid, ThdState& st) {
+    st.tid = tid;
+    st.ordinal = ordinals.fetch_add(1);
+    st.decisions = 0;
+    st.replay_at = 0;
+    if (recorder) st.log = recorder->attach(st.ordinal);
+    if (stacks) st.stacks = stacks->attach();
+    if (sites) st.sites = sites->attach();
+    if (live) live->thread_added();
+}
+
+void sysfail::ActiveSession::thd_detach(ThdState& st) {
+    if (live) live->thread_removed();
+    if (st.stacks) stacks->detach(st.stacks);
+    if (st.sites) sites->detach(st.sites);
+    if (st.log) recorder->detach(st.log);
+    st.stacks = nullptr;
+    st.sites = nullptr;
+    st.log = nullptr;
 }
 
 namespace {
-    void sleep(std::chrono::microseconds dur) {
-        // TODO: avoid libc's nanosleep, if someone failure-injects it
-        // this will confuse them. Use an equivalent
-        // continue-sleep-after-interrupt helper instead.
-        std::this_thread::sleep_for(dur);
+    thread_local bool calibrating = false;
+
+    sysfail::observe::Latency percentiles(
+        std::vector<std::chrono::nanoseconds>& samples
+    ) {
+        std::sort(samples.begin(), samples.end());
+        auto at = [&](double q) {
+            return samples[std::min(
+                samples.size() - 1,
+                static_cast<size_t>(q * samples.size()))];
+        };
+        return {at(0.5), at(0.99)};
     }
 }
 
-void sysfail::ActiveSession::fail_maybe(ucontext_t *ctx) {
-    auto regs = ctx->uc_mcontext.gregs;
-    auto call = ctx->uc_mcontext.gregs[REG_RAX];
+void sysfail::ActiveSession::calibrate(const observe::Calibrate& cfg) {
+    using clk = std::chrono::steady_clock;
+    std::vector<std::chrono::nanoseconds> raw, trapped, toggle;
+    raw.reserve(cfg.syscalls);
+    trapped.reserve(cfg.syscalls);
+    toggle.reserve(cfg.toggles);
+
+    for (uint32_t i = 0; i < cfg.syscalls; i++) {
+        auto start = clk::now();
+        sysfail::syscall(0, 0, 0, 0, 0, 0, SYS_getppid);
+        raw.push_back(clk::now() - start);
+    }
+
+    // The calling thread is enabled on a state of its own, regardless of the
+    // selector and without being tracked (so it takes no ordinal, and isn't
+    // recorded, profiled or counted in live stats)
+    ThdState st;
+    st.tid = gettid();
+    calibrating = true;
+    enable(self_text, &st);
+    for (uint32_t i = 0; i < cfg.syscalls; i++) {
+        auto start = clk::now();
+        ::syscall(SYS_getppid);
+        trapped.push_back(clk::now() - start);
+    }
+    st.on = SYSCALL_DISPATCH_FILTER_ALLOW;
+    disable();
+
+    for (uint32_t i = 0; i < cfg.toggles; i++) {
+        auto start = clk::now();
+        enable(self_text, &st);
+        st.on = SYSCALL_DISPATCH_FILTER_ALLOW;
+        disable();
+        toggle.push_back(clk::now() - start);
+    }
+    calibrating = false;
 
-    auto o = plan.outcomes.find(call);
-    if (o == plan.outcomes.end() || !o->second.eligible(regs)) {
+    auto raw_lat = percentiles(raw);
+    for (auto& t : trapped) {
+        t = std::max(t - raw_lat.median, std::chrono::nanoseconds(0));
+    }
+    overhead = {raw_lat, percentiles(trapped), percentiles(toggle)};
+}
+
+void sysfail::ActiveSession::intercept(ucontext_t *ctx) {
+    if (calibrating) {
         continue_syscall(ctx);
         return;
     }
 
-    thread_local std::mt19937 rnd_eng(rd());
+    if (live) live->trapped(ctx->uc_mcontext.gregs[REG_RAX]);
 
-    std::uniform_real_distribution<double> p_dist(0, 1);
-    auto delay_after = std::chrono::microseconds(0);
-    if (o->second.delay.p > 0) {
-        if (p_dist(rnd_eng) < o->second.delay.p) {
-            auto after_p = p_dist(rnd_eng);
-            auto bias = o->second.delay.after_bias;
-            std::uniform_int_distribution<int> delay_dist(0, o->second.max_delay.count());
-            auto delay = std::chrono::microseconds(delay_dist(rnd_eng));
-            if (bias && after_p < bias) {
-                delay_after = delay;
+    auto regs = ctx->uc_mcontext.gregs;
+    Syscall call = regs[REG_RAX];
+    using_st++;
+    auto st = self_st;
+    auto profiled = st && (st->stacks || st->sites);
+    if (profiled && st->sites) st->sites->next(call);
+    done_with_st();
+    if (!profiled) {
+        fail_maybe(ctx);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto err = fail_maybe(ctx);
+    using_st++;
+    // the thread may have been disabled (and its state freed) meanwhile
+    if (self_st == st) {
+        if (st->stacks) {
+            stacks->record(
+                st->stacks,
+                regs,
+                std::chrono::steady_clock::now() - start);
+        }
+        if (err && st->sites) sites->record(st->sites, call, regs);
+    }
+    done_with_st();
+}
+
+namespace {
+    using sysfail::ActiveOutcome;
+    using sysfail::ActivePlan;
+    using sysfail::Decision;
+
+    // Link latency adds to the delay (placed after receives that go
+    // through, before other calls), loss fails the call before it is made
+    void on_link(
+        const sysfail::net::Link& l,
+        sysfail::Syscall call,
+        sysfail::Rng& rnd,
+        Decision& d
+    ) {
+        std::uniform_real_distribution<double> p_dist(0, 1);
+        auto lost = l.loss > 0 && p_dist(rnd) < l.loss;
+        auto delay = l.latency;
+        if (l.jitter.count()) {
+            std::uniform_int_distribution<int64_t> jitter_dist(
+                0,
+                l.jitter.count());
+            delay += std::chrono::microseconds(jitter_dist(rnd));
+        }
+        if (lost) {
+            d.fail = l.error;
+            d.fail_after = false;
+            d.delay_after = false;
+        } else if (!d.delay.count()) {
+            d.delay_after = call == SYS_recvfrom || call == SYS_recvmsg;
+        }
+        d.delay += delay;
+    }
+
+    Decision sample(
+        const ActivePlan& a,
+        const ActiveOutcome& o,
+        sysfail::Syscall call,
+        sysfail::ThdState* st,
+        sysfail::Rng& rnd,
+        const sysfail::net::Link* link
+    ) {
+        using namespace sysfail;
+
+        auto level = o.scheduled
+            ? schedule::level(o.schedule, schedule::coarse_now() - a.start)
+            : 1;
+        std::optional<bool> picked;
+        if (o.trigger) {
+            if (trigger::scope(*o.trigger) == trigger::Scope::Global) {
+                auto index = o.calls.fetch_add(1, std::memory_order_relaxed);
+                picked = trigger::picks(*o.trigger, index);
+            } else if (st) {
+                if (st->trigger_gen != a.generation) {
+                    st->trigger_calls.fill(0);
+                    st->trigger_gen = a.generation;
+                }
+                picked = trigger::picks(*o.trigger, st->trigger_calls[call]++);
             } else {
-                sleep(delay);
+                picked = false; // calls of unknown threads are not counted
             }
         }
+        auto d = o.decide(rnd, level, picked);
+        o.limit(d);
+        if (link) on_link(*link, call, rnd, d);
+        return d;
     }
-    Errno fail_with = 0;
-    if (o->second.fail.p > 0) {
-        if (p_dist(rnd_eng) < o->second.fail.p) {
-            auto err_p = p_dist(rnd_eng);
-            auto e = o->second.error_by_cumulative_p.lower_bound(err_p);
-            auto after_p = p_dist(rnd_eng);
-            if (o->second.fail.after_bias && (after_p < o->second.fail.after_bias)) {
-                fail_with = e->second;
-            } else {
-                if (e != o->second.error_by_cumulative_p.end()) {
-                    // kernel returns negative 0 - 4096 error codes in %rax
-                    regs[REG_RAX] = -e->second;
-                    return;
-                }
+}
+
+void sysfail::ActiveSession::wait(
+    Syscall call,
+    std::chrono::microseconds d
+) const {
+    auto waited = delay::wait(d);
+    if (live) live->waited(call, d, waited);
+}
+
+void sysfail::ActiveSession::charge(
+    uint64_t generation,
+    pid_t tid,
+    Syscall call,
+    const greg_t* regs
+) {
+    Rcu::Reader r(rcu, tid);
+    auto a = active.load();
+    if (a->generation != generation) return;
+    auto o = a->outcomes.find(call);
+    if (o == a->outcomes.end() || !o->second.throttler) return;
+    o->second.throttler->charge(
+        regs[REG_RDI],
+        regs[REG_RAX],
+        std::chrono::steady_clock::now().time_since_epoch());
+}
+
+sysfail::Errno sysfail::ActiveSession::fail_maybe(ucontext_t *ctx) {
+    auto regs = ctx->uc_mcontext.gregs;
+    auto call = ctx->uc_mcontext.gregs[REG_RAX];
+    // wait before the call (to stay within its throttle, or for the device
+    // to serve it) and the plan that must be charged for it after
+    std::chrono::nanoseconds hold{0};
+    std::optional<uint64_t> throttled_by;
+    // queue the call must take a turn in
+    Semaphore* queue = nullptr;
+    // the throttle may shorten the call, the caller must not see it
+    auto rdx = regs[REG_RDX];
+
+    using_st++;
+    pid_t tid = self_st ? self_st->tid : 0;
+
+    // only lookup and decision hold the outcome table, so update() never
+    // waits for a syscall (or an injected delay) to finish
+    auto decision = [&]() -> std::optional<Decision> {
+        Rcu::Reader r(rcu, tid);
+        auto a = active.load();
+        auto o = a->outcomes.find(call);
+        if (o == a->outcomes.end()) return std::nullopt;
+        // an outcome with links only takes calls to peers on one of them
+        auto link = o->second.links ? o->second.links->find(regs) : nullptr;
+        if ((o->second.links && !link) || !o->second.eligible(regs)) {
+            return std::nullopt;
+        }
+        auto shape = [&](const Decision& d) {
+            const auto& t = o->second.throttler;
+            const auto& dev = o->second.device;
+            if (d.fail && !d.fail_after) return;
+            queue = o->second.queue;
+            if (!t && !dev) return;
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            if (t) {
+                hold = t->admit(regs, now);
+                throttled_by = a->generation;
+            }
+            // served once admitted, and (as shortened) by the throttle
+            if (dev) hold += dev->admit(regs, now + hold);
+        };
+        if (!self_st) { // eg. while disabling
+            thread_local uint64_t detached_decisions = 0;
+            Decision d;
+            if (!replayer) {
+                Rng rnd(a->seed, derived_seeds - 1, detached_decisions++);
+                d = sample(*a, o->second, call, nullptr, rnd, link);
+            }
+            shape(d);
+            return d;
+        }
+        auto index = self_st->decisions++;
+        Decision d;
+        if (replayer) {
+            auto e = replayer->find(self_st->ordinal, index, self_st->replay_at);
+            if (e && e->call == call) {
+                d = {e->fail, e->fail_after, e->delay, e->delay_after};
             }
+        } else {
+            // every decision gets a fresh stream, so the number of draws one
+            // decision makes doesn't shift the ones that follow
+            Rng rnd(a->seed, self_st->ordinal, index);
+            d = sample(*a, o->second, call, self_st, rnd, link);
+        }
+        if (self_st->log && (d.fail || d.delay.count())) {
+            self_st->log->add(
+                index,
+                call,
+                d.fail,
+                d.fail_after,
+                d.delay,
+                d.delay_after);
         }
+        shape(d);
+        return d;
+    }();
+    done_with_st();
+    if (!decision) {
+        continue_syscall(ctx);
+        fd_table.observe(call, regs);
+        peers.observe(call, regs);
+        return 0;
+    }
+    auto d = *decision;
+    SYSFAIL_PROBE5(
+        decide,
+        call,
+        tid,
+        d.flags(),
+        d.fail,
+        d.delay.count());
+    if (live) {
+        if (d.fail) live->injected(call);
+        if (d.delay.count()) live->delayed(call);
     }
 
+    if (d.delay.count() && !d.delay_after) {
+        wait(call, d.delay);
+    }
+    if (d.fail && !d.fail_after) {
+        // kernel returns negative 0 - 4096 error codes in %rax
+        regs[REG_RAX] = -d.fail;
+        return d.fail;
+    }
+
+    if (queue) {
+        auto waited = queue->acquire();
+        if (waited.count()) {
+            SYSFAIL_PROBE3(
+                queued,
+                call,
+                tid,
+                waited.count());
+            if (live) live->queued(call, waited);
+        }
+    }
+    if (hold.count() > 0) delay::wait(hold);
     continue_syscall(ctx);
+    // syscall preserves rdx
+    regs[REG_RDX] = rdx;
+    fd_table.observe(call, regs);
+    peers.observe(call, regs);
+    if (queue) queue->release();
+    if (throttled_by) charge(*throttled_by, tid, call, regs);
 
-    if (delay_after.count()) {
-        sleep(delay_after);
+    if (d.delay.count() && d.delay_after) {
+        wait(call, d.delay);
     }
-    if (fail_with) {
-        regs[REG_RAX] = -fail_with;
+    if (d.fail) {
+        regs[REG_RAX] = -d.fail;
     }
+    return d.fail;
 }
 
 void sysfail::ActiveSession::discover_threads() {
@@ -329,14 +873,26 @@ static void sysfail::enable_sysfail(int sig, siginfo_t *info, void *ucontext) {
 }
 
 static void sysfail::disable_sysfail(int sig, siginfo_t *info, void *ucontext) {
-    NotifySigHdlrCompletion r(info); // Expect thread-state is initialized
-    auto s = session;
-    if (!s) {
-        std::cerr << "Can't disable sysfail, no active session\n";
-        return;
+    if (using_st) {
+        deferred_disable = reinterpret_cast<sysfail::ThdState*>(
+            info->si_value.sival_ptr);
+        // stop trapping already, so the rest of the interrupted section
+        // doesn't trap
+        deferred_disable->on = SYSCALL_DISPATCH_FILTER_ALLOW;
+    } else {
+        NotifySigHdlrCompletion r(info); // Expect thread-state is initialized
+        auto s = session;
+        if (s) {
+            disable();
+        } else {
+            std::cerr << "Can't disable sysfail, no active session\n";
+        }
     }
 
-    disable();
+    // Not through libc's sigreturn, the thread may be enabled again before
+    // it runs (and it would then trap)
+    ucontext_t *ctx = (ucontext_t *)ucontext;
+    sysfail_restore(ctx->uc_mcontext.gregs);
 }
 
 static void sysfail::reenable_sysfail(int sig, siginfo_t *info, void *ucontext) {
@@ -348,8 +904,77 @@ static void sysfail::reenable_sysfail(int sig, siginfo_t *info, void *ucontext)
     sysfail_restore(ctx->uc_mcontext.gregs);
 }
 
+void sysfail::rearm_forked() {
+    auto s = session;
+    if (!s || !self_st) return;
+    self_st->tid = sysfail::syscall(0, 0, 0, 0, 0, 0, SYS_gettid);
+    sysfail::syscall(
+        PR_SET_SYSCALL_USER_DISPATCH,
+        PR_SYS_DISPATCH_ON,
+        s->self_text.start,
+        s->self_text.length,
+        reinterpret_cast<uint64_t>(&self_st->on),
+        0,
+        SYS_prctl);
+}
+
+namespace {
+    // The kernel's struct sigaction (x86_64)
+    struct KSigaction {
+        uint64_t handler;
+        uint64_t flags;
+        uint64_t restorer;
+        uint64_t mask;
+    };
+
+    constexpr uint64_t sigsys_bit = 1UL << (SIGSYS - 1);
+
+    uint64_t bit_of(greg_t sig) {
+        return sig > 0 && sig < NSIG ? 1UL << (sig - 1) : 0;
+    }
+
+    bool blocks_sigsys(const ucontext_t* ctx) {
+        auto regs = ctx->uc_mcontext.gregs;
+        KSigaction act;
+        sysfail::SafeReader r;
+        return regs[REG_RDI] != SIGSYS &&
+            regs[REG_RSI] != 0 &&
+            r.read(regs[REG_RSI], &act, sizeof(act)) &&
+            (act.mask & sigsys_bit);
+    }
+
+    // Installs the handler with SIGSYS taken out of its mask (see
+    // unblock_in_handlers), and reports the old one's as it was installed
+    void continue_sigaction(std::atomic<uint64_t>& unblocked, ucontext_t* ctx) {
+        auto regs = ctx->uc_mcontext.gregs;
+        auto bit = bit_of(regs[REG_RDI]);
+        auto was = unblocked.load(std::memory_order_relaxed) & bit;
+        KSigaction act;
+        sysfail::SafeReader r;
+        auto given = regs[REG_RSI];
+        auto replaced = given != 0 && r.read(given, &act, sizeof(act));
+        auto strip = replaced && (act.mask & sigsys_bit);
+        if (strip) {
+            act.mask &= ~sigsys_bit;
+            regs[REG_RSI] = reinterpret_cast<greg_t>(&act);
+        }
+        sysfail::continue_syscall(ctx);
+        regs[REG_RSI] = given;
+        if (regs[REG_RAX] != 0) return;
+        if (was && regs[REG_RDX] != 0) {
+            reinterpret_cast<KSigaction*>(regs[REG_RDX])->mask |= sigsys_bit;
+        }
+        if (strip) {
+            unblocked.fetch_or(bit, std::memory_order_relaxed);
+        } else if (replaced) {
+            unblocked.fetch_and(~bit, std::memory_order_relaxed);
+        }
+    }
+}
+
 static void sysfail::handle_sigsys(int sig, siginfo_t *info, void *ucontext) {
     ucontext_t *ctx = (ucontext_t *)ucontext;
+    auto sigreturn = false;
 
     {
         auto s = session;
@@ -372,13 +997,22 @@ static void sysfail::handle_sigsys(int sig, siginfo_t *info, void *ucontext) {
                 }
             }
         } else if (syscall == SYS_rt_sigreturn) {
-            // TODO handle sigreturn correctly, may be write a test for it?
+            sigreturn = true;
+        } else if (
+            s &&
+            syscall == SYS_rt_sigaction &&
+            (blocks_sigsys(ctx) ||
+             (s->unblocked & bit_of(ctx->uc_mcontext.gregs[REG_RDI])))) {
+            continue_sigaction(s->unblocked, ctx);
         } else if (s && syscall != SYS_exit) {
-            s->fail_maybe(ctx);
+            s->intercept(ctx);
         } else {
             continue_syscall(ctx);
         }
     }
+    // A handler returning on an armed thread, its frame is at the trapped
+    // sp (this frame is dropped with it)
+    if (sigreturn) sysfail_sigreturn(ctx->uc_mcontext.gregs[REG_RSP]);
     sysfail_restore(ctx->uc_mcontext.gregs);
     assert(false);
 }
@@ -387,8 +1021,9 @@ sysfail::Session::Session(const Plan& _plan) {
     auto m = get_mmap(getpid());
     assert(m.has_value());
 
-    auto s = std::make_shared<ActiveSession>(_plan, m->self_text());
+    auto s = std::make_shared<ActiveSession>(_plan, *m);
     session = s;
+    if (_plan.observe.calibrate) s->calibrate(*_plan.observe.calibrate);
     s->initialize();
 }
 
@@ -432,3 +1067,49 @@ void sysfail::Session::discover_threads() {
     std::shared_lock<std::shared_mutex> l(lck);
     session->discover_threads();
 }
+
+void sysfail::Session::update(const Plan& plan) {
+    std::shared_lock<std::shared_mutex> l(lck);
+    session->update(plan);
+}
+
+void sysfail::Session::dump_stacks(
+    std::ostream& out,
+    observe::Metric metric
+) {
+    std::shared_lock<std::shared_mutex> l(lck);
+    if (!session->stacks) {
+        throw std::logic_error("Stack profiling is not enabled in the plan");
+    }
+    session->stacks->dump(out, metric);
+}
+
+std::vector<sysfail::observe::CallSite> sysfail::Session::call_sites() {
+    std::shared_lock<std::shared_mutex> l(lck);
+    if (!session->sites) {
+        throw std::logic_error("Call-site tracking is not enabled in the plan");
+    }
+    return session->sites->report();
+}
+
+sysfail::trace::Trace sysfail::Session::recorded() {
+    std::shared_lock<std::shared_mutex> l(lck);
+    if (!session->recorder) {
+        throw std::logic_error("Recording is not enabled in the plan");
+    }
+    return session->recorder->collect();
+}
+
+uint64_t sysfail::Session::seed() {
+    std::shared_lock<std::shared_mutex> l(lck);
+    std::lock_guard<std::mutex> u(session->update_mtx);
+    return session->active.load()->seed;
+}
+
+sysfail::observe::Overhead sysfail::Session::overhead() {
+    std::shared_lock<std::shared_mutex> l(lck);
+    if (!session->overhead) {
+        throw std::logic_error("Calibration is not enabled in the plan");
+    }
+    return *session->overhead;
+}
@@ -27,6 +27,7 @@
 #include <csignal>
 #include <random>
 #include <thread>
+#include <mutex>
 #include <linux/unistd.h>
 #include <oneapi/tbb/concurrent_hash_map.h>
 #include <oneapi/tbb/blocked_range.h>
@@ -37,6 +38,23 @@
 #include "syscall.hh"
 #include "log.hh"
 #include "thdmon.hh"
+#include "stack.hh"
+#include "callsite.hh"
+#include "stats.hh"
+#include "rcu.hh"
+#include "schedule.hh"
+#include "limit.hh"
+#include "rng.hh"
+#include "trace.hh"
+#include "trigger.hh"
+#include "latency.hh"
+#include "delay.hh"
+#include "throttle.hh"
+#include "device.hh"
+#include "queue.hh"
+#include "fdtable.hh"
+#include "glob.hh"
+#include "net.hh"
 
 extern "C" {
     extern void sysfail_restore(greg_t*);
@@ -45,37 +63,126 @@ extern "C" {
 namespace sysfail {
     void continue_syscall(ucontext_t *ctx);
 
+    // Re-arms the calling thread in a child forked from a failure-injected
+    // thread (syscall-user-dispatch does not survive fork). Safe to call
+    // from the handler (eg. from an eligibility predicate).
+    void rearm_forked();
+
     static void handle_sigsys(int sig, siginfo_t *info, void *ucontext);
     static void reenable_sysfail(int sig, siginfo_t *info, void *ucontext);
     static void enable_sysfail(int sig, siginfo_t *info, void *ucontext);
     static void disable_sysfail(int sig, siginfo_t *info, void *ucontext);
 
+    using Rng = rng::Philox;
+
+    // What to do to one syscall invocation
+    struct Decision {
+        // Error to fail the syscall with (0 => don't fail)
+        Errno fail = 0;
+        bool fail_after = false;
+        std::chrono::microseconds delay{0};
+        bool delay_after = false;
+
+        // Bitmask of probe::FailBefore etc
+        int64_t flags() const;
+    };
+
     struct ActiveOutcome {
         Probability fail;
         Probability delay;
         std::chrono::microseconds max_delay;
         std::map<double, Errno> error_by_cumulative_p;
         InvocationPredicate eligibility_check;
+        const schedule::Schedule schedule;
+        const bool scheduled; // false => schedule is constant
+        // null => unlimited, shared by threads (state is process-wide)
+        const std::shared_ptr<Limiter> limiter;
+        const std::optional<trigger::Trigger> trigger;
+        // null => uniform over [0, max_delay]
+        const std::shared_ptr<const latency::Table> latency;
+        // null => not throttled, budgets are process-wide
+        const std::shared_ptr<Throttler> throttler;
+        // null => no device emulated, the device is process-wide
+        const std::shared_ptr<DeviceModel> device;
+        // null => not queued, owned by the session's Queues
+        Semaphore* const queue;
+        const std::optional<FdMatch> fd_match;
+        const std::optional<PathMatch> path_match;
+        const std::shared_ptr<const LinkTable> links;
+        // eligible calls so far, indexes calls for global triggers
+        mutable std::atomic<uint64_t> calls{0};
 
-        ActiveOutcome(const Outcome& _o);
+        // `seed` stands in for seeds the outcome leaves unspecified
+        ActiveOutcome(
+            const Outcome& _o,
+            uint64_t seed,
+            Semaphore* queue = nullptr,
+            const std::optional<FdMatch>& fd_match = std::nullopt,
+            const std::optional<PathMatch>& path_match = std::nullopt,
+            const std::shared_ptr<const LinkTable>& links = nullptr);
 
         bool eligible(const greg_t* regs) const;
+
+        // `level` (from the schedule) scales fail and delay probabilities,
+        // `picked` (by a trigger) replaces fail probability if given
+        Decision decide(
+            Rng& rnd,
+            double level = 1,
+            std::optional<bool> picked = std::nullopt) const;
+
+        // Drops (or cuts short) injection that would exceed the limits
+        void limit(Decision& d) const;
     };
 
+    // Outcome table compiled from a plan, replaced as a whole on update
     struct ActivePlan {
-        const Plan p;
         std::unordered_map<Syscall, const ActiveOutcome> outcomes;
+        // schedules are evaluated relative to this (coarse monotonic clock)
+        const std::chrono::nanoseconds start;
+        // resolved (non-zero) seed for injection decisions
+        const uint64_t seed;
+        // unique across plans, per-thread trigger counts of another
+        // generation are stale
+        const uint64_t generation;
+        // limits queues take once the plan is in effect
+        std::map<Semaphore*, uint32_t> queue_limits;
+
+        ActivePlan(
+            const Plan& _plan,
+            Queues& queues,
+            FdTable& fd_table,
+            PeerTable& peers);
 
-        ActivePlan(const Plan& _plan);
+        void resize_queues() const;
     };
 
     struct ThdState {
         char on;
         std::binary_semaphore sig_coord; // for signal handler coordination
+        StackTable* stacks; // owned by the session's StackProfile
+        CallSiteTable* sites; // owned by the session's CallSiteProfile
+        pid_t tid;
+        uint32_t ordinal; // order in which the thread was enabled
+        uint64_t decisions; // index of the next decision (random stream)
+        trace::Log* log; // owned by the session's Recorder
+        size_t replay_at; // cursor in the thread's recorded decisions
+        // eligible calls by syscall, for per-thread triggers of the plan
+        // generation `trigger_gen`
+        std::array<uint64_t, stats::max_syscall> trigger_calls;
+        uint64_t trigger_gen;
 
         ThdState() :
             on(SYSCALL_DISPATCH_FILTER_ALLOW),
-            sig_coord(1) {}
+            sig_coord(1),
+            stacks(nullptr),
+            sites(nullptr),
+            tid(0),
+            ordinal(0),
+            decisions(0),
+            log(nullptr),
+            replay_at(0),
+            trigger_calls{},
+            trigger_gen(0) {}
     };
 
     using ThdSt = oneapi::tbb::concurrent_hash_map<pid_t, ThdState>;
@@ -85,13 +192,39 @@ namespace sysfail {
     const int SIG_REARM = SIGRTMIN + 6;
 
     struct ActiveSession {
-        ActivePlan plan;
+        const Plan plan;
+        // must outlive plans (and callers waiting in its queues)
+        Queues queues;
+        FdTable fd_table;
+        PeerTable peers;
+        // read in the handler under `rcu`, owned by the session
+        std::atomic<const ActivePlan*> active;
+        Rcu rcu;
+        std::mutex update_mtx;
         AddrRange self_text;
-        std::random_device rd;
+        std::atomic<uint32_t> ordinals{0};
         ThdSt thd_st;
+        std::unique_ptr<stats::Publisher> live; // must outlive tmon
         std::unique_ptr<ThdMon> tmon;
+        std::unique_ptr<StackProfile> stacks;
+        std::unique_ptr<CallSiteProfile> sites;
+        std::unique_ptr<trace::Recorder> recorder;
+        std::unique_ptr<const trace::Replayer> replayer;
+        std::optional<observe::Overhead> overhead;
+        // signals (bit sig - 1) whose handlers had SIGSYS taken out of their
+        // mask, it's put back when the session ends
+        std::atomic<uint64_t> unblocked{0};
 
-        ActiveSession(const Plan& _plan, AddrRange&& _self_addr);
+        ActiveSession(const Plan& _plan, Mapping& _mapping);
+
+        ~ActiveSession();
+
+        // Replaces the outcome table, leaves thread arming untouched
+        void update(const Plan& _plan);
+
+        // Measures interception overhead on the calling thread, must be
+        // called before any threads are enabled (before initialize).
+        void calibrate(const observe::Calibrate& cfg);
 
         // Some procedures (sig-handlers etc) require the global-session to be
         // defined, so first define the global session and then initialize it.
@@ -112,7 +245,27 @@ namespace sysfail {
 
         void thd_disable(pid_t tid);
 
-        void fail_maybe(ucontext_t *ctx);
+        // Allocate / release per-thread resources (outside the handler)
+        void thd_attach(pid_t tid, ThdState& st);
+
+        void thd_detach(ThdState& st);
+
+        // Entry point for syscalls that may be failure-injected
+        void intercept(ucontext_t *ctx);
+
+        // Returns the error injected (if any)
+        Errno fail_maybe(ucontext_t *ctx);
+
+        // Waits out an injected delay (and reports its error)
+        void wait(Syscall call, std::chrono::microseconds d) const;
+
+        // Charges a throttled call's transfer, unless the plan it was
+        // admitted by has been replaced since
+        void charge(
+            uint64_t generation,
+            pid_t tid,
+            Syscall call,
+            const greg_t* regs);
 
         void thd_track(pid_t tid, DiscThdSt state);
 
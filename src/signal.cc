@@ -42,6 +42,34 @@ void sysfail::enable_handler(signal_t signal, sigaction_t hdlr) {
     }
 }
 
+uint64_t sysfail::unblock_in_handlers(signal_t signal) {
+    uint64_t unblocked = 0;
+    for (int sig = 1; sig < NSIG; sig++) {
+        struct sigaction action;
+        if (sig == signal || sigaction(sig, nullptr, &action) != 0) continue;
+        if (action.sa_handler == SIG_DFL || action.sa_handler == SIG_IGN) {
+            continue;
+        }
+        if (sigismember(&action.sa_mask, signal)) {
+            sigdelset(&action.sa_mask, signal);
+            if (sigaction(sig, &action, nullptr) == 0) {
+                unblocked |= 1UL << (sig - 1);
+            }
+        }
+    }
+    return unblocked;
+}
+
+void sysfail::reblock_in_handlers(signal_t signal, uint64_t signals) {
+    for (int sig = 1; sig < NSIG; sig++) {
+        if (!(signals & (1UL << (sig - 1)))) continue;
+        struct sigaction action;
+        if (sigaction(sig, nullptr, &action) != 0) continue;
+        sigaddset(&action.sa_mask, signal);
+        sigaction(sig, &action, nullptr);
+    }
+}
+
 void sysfail::_send_signal(
     pid_t tid,
     int sig,
@@ -18,6 +18,7 @@
 #define _SIGNAL_HH
 
 #include <signal.h>
+#include <cstdint>
 
 namespace sysfail {
     using signal_t = int;
@@ -25,6 +26,15 @@ namespace sysfail {
 
     void enable_handler(signal_t signal, sigaction_t hdlr);
 
+    // Takes `signal` out of the sa_mask of the handlers installed so far
+    // (eg. Go's, which block every signal), returns the signals (bit sig - 1)
+    // it was taken out for
+    uint64_t unblock_in_handlers(signal_t signal);
+
+    // Puts `signal` back in the sa_mask of the handlers of `signals` (as
+    // returned by unblock_in_handlers)
+    void reblock_in_handlers(signal_t signal, uint64_t signals);
+
     void _send_signal(
         pid_t tid,
         int sig,
@@ -0,0 +1,289 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "stack.hh"
+#include "syscall.hh"
+
+namespace {
+    const uintptr_t page_sz = 4096;
+
+    // frames further apart than this are assumed to be garbage (code not
+    // compiled with frame-pointers uses %rbp as a general purpose register)
+    const uintptr_t max_frame_span = 8 * 1024 * 1024;
+
+    uint64_t hash_frames(const uintptr_t* f, uint32_t depth) {
+        uint64_t h = 0x9e3779b97f4a7c15ULL ^ depth;
+        for (uint32_t i = 0; i < depth; i++) {
+            h ^= f[i];
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+        }
+        return h ? h : 1; // 0 marks an empty slot
+    }
+
+    uint32_t pow2_at_least(uint32_t n) {
+        uint32_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+}
+
+bool sysfail::SafeReader::verified(uintptr_t page) const {
+    for (int i = 0; i < known; i++) {
+        if (pages[i] == page) return true;
+    }
+    return false;
+}
+
+bool sysfail::SafeReader::read(uintptr_t addr, void* out, size_t len) {
+    auto first = addr & ~(page_sz - 1);
+    auto last = (addr + len - 1) & ~(page_sz - 1);
+    if (verified(first) && verified(last)) {
+        std::memcpy(out, reinterpret_cast<const void*>(addr), len);
+        return true;
+    }
+
+    if (pid == 0) pid = sysfail::syscall(0, 0, 0, 0, 0, 0, SYS_getpid);
+    struct iovec local{out, len};
+    struct iovec remote{reinterpret_cast<void*>(addr), len};
+    auto ret = sysfail::syscall(
+        pid,
+        reinterpret_cast<uint64_t>(&local),
+        1,
+        reinterpret_cast<uint64_t>(&remote),
+        1,
+        0,
+        SYS_process_vm_readv);
+    if (ret != static_cast<long>(len)) return false;
+
+    for (auto p : {first, last}) {
+        if (!verified(p) && known < max_pages) pages[known++] = p;
+    }
+    return true;
+}
+
+sysfail::Unwinder::Unwinder(const Mapping& m) {
+    for (const auto& [start, r] : m.map) {
+        if (r.executable()) exec.emplace_back(start, start + r.length);
+    }
+}
+
+bool sysfail::Unwinder::executable(uintptr_t addr) const {
+    auto it = std::upper_bound(
+        exec.begin(),
+        exec.end(),
+        addr,
+        [](uintptr_t a, const auto& r) { return a < r.first; });
+    if (it == exec.begin()) return false;
+    return addr < (--it)->second;
+}
+
+uint32_t sysfail::Unwinder::capture(
+    const greg_t* regs,
+    uintptr_t* frames,
+    uint32_t max
+) const {
+    SafeReader r;
+    uint32_t depth = 0;
+    uintptr_t sp = regs[REG_RSP], fp = regs[REG_RBP];
+
+    frames[depth++] = regs[REG_RIP];
+
+    // Syscall wrappers are usually leaf functions without a frame, so the
+    // return address into their caller sits at the top of the stack.
+    uintptr_t ret;
+    if (depth < max && r.read(sp, &ret, sizeof(ret)) && executable(ret)) {
+        frames[depth++] = ret;
+    }
+
+    while (depth < max) {
+        if (fp < sp || (fp & 7) || fp - sp > max_frame_span) break;
+        uintptr_t frame[2]; // saved %rbp, return address
+        if (!r.read(fp, frame, sizeof(frame)) || frame[1] == 0) break;
+        if (frames[depth - 1] != frame[1]) frames[depth++] = frame[1];
+        if (frame[0] <= fp) break;
+        sp = fp;
+        fp = frame[0];
+    }
+
+    return depth;
+}
+
+sysfail::StackTable::StackTable(
+    const observe::Stacks& cfg
+) : max_frames(cfg.max_frames),
+    capacity(cfg.capacity),
+    mask(pow2_at_least(cfg.capacity * 2) - 1),
+    slots(std::make_unique<Slot[]>(mask + 1)),
+    frames(std::make_unique_for_overwrite<uintptr_t[]>(
+        static_cast<size_t>(cfg.capacity) * cfg.max_frames)) {}
+
+void sysfail::StackTable::add(
+    const uintptr_t* f,
+    uint32_t depth,
+    uint64_t nanos
+) {
+    if (busy.test_and_set(std::memory_order_acquire)) return;
+
+    auto h = hash_frames(f, depth);
+    auto totals = &overflow;
+    for (auto i = h & mask; ; i = (i + 1) & mask) {
+        auto& s = slots[i];
+        if (s.hash == h &&
+            s.depth == depth &&
+            std::equal(f, f + depth, &frames[s.frames_at])) {
+            totals = &s.totals;
+            break;
+        }
+        if (s.hash == 0) {
+            if (used < capacity) {
+                s.frames_at = used++ * max_frames;
+                s.depth = depth;
+                std::copy(f, f + depth, &frames[s.frames_at]);
+                s.hash = h;
+                totals = &s.totals;
+            }
+            break;
+        }
+    }
+    totals->count++;
+    totals->nanos += nanos;
+
+    busy.clear(std::memory_order_release);
+}
+
+size_t sysfail::StackTable::copy_size() const {
+    return (static_cast<size_t>(capacity) + 1) * (max_frames + 3);
+}
+
+void sysfail::StackTable::copy(std::vector<uint64_t>& out) {
+    while (busy.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    for (uint32_t i = 0; i <= mask; i++) {
+        const auto& s = slots[i];
+        if (s.hash == 0) continue;
+        out.push_back(s.depth);
+        out.push_back(s.totals.count);
+        out.push_back(s.totals.nanos);
+        out.insert(
+            out.end(),
+            &frames[s.frames_at],
+            &frames[s.frames_at] + s.depth);
+    }
+    if (overflow.count) {
+        out.push_back(0);
+        out.push_back(overflow.count);
+        out.push_back(overflow.nanos);
+    }
+    busy.clear(std::memory_order_release);
+}
+
+sysfail::StackProfile::StackProfile(
+    const observe::Stacks& cfg,
+    const Mapping& m
+) : cfg(cfg), unwinder(m) {}
+
+sysfail::StackTable* sysfail::StackProfile::attach() {
+    auto t = std::make_unique<StackTable>(cfg);
+    auto ptr = t.get();
+    std::lock_guard<std::mutex> l(mtx);
+    live.emplace(ptr, std::move(t));
+    return ptr;
+}
+
+void sysfail::StackProfile::merge(
+    const std::vector<uint64_t>& raw,
+    std::map<std::vector<uintptr_t>, StackTotals>& into
+) {
+    for (size_t i = 0; i < raw.size(); ) {
+        auto depth = raw[i];
+        auto& t = into[std::vector<uintptr_t>(
+            raw.begin() + i + 3,
+            raw.begin() + i + 3 + depth)];
+        t.count += raw[i + 1];
+        t.nanos += raw[i + 2];
+        i += 3 + depth;
+    }
+}
+
+void sysfail::StackProfile::detach(StackTable* t) {
+    std::unique_ptr<StackTable> owned;
+    {
+        std::lock_guard<std::mutex> l(mtx);
+        auto it = live.find(t);
+        if (it == live.end()) return;
+        owned = std::move(it->second);
+        live.erase(it);
+    }
+    std::vector<uint64_t> raw;
+    raw.reserve(owned->copy_size());
+    owned->copy(raw);
+    std::lock_guard<std::mutex> l(mtx);
+    merge(raw, retired);
+}
+
+void sysfail::StackProfile::record(
+    StackTable* t,
+    const greg_t* regs,
+    std::chrono::nanoseconds elapsed
+) {
+    uintptr_t frames[128];
+    auto depth = unwinder.capture(regs, frames, cfg.max_frames);
+    t->add(frames, depth, elapsed.count());
+}
+
+void sysfail::StackProfile::dump(std::ostream& out, observe::Metric metric) {
+    std::map<std::vector<uintptr_t>, StackTotals> totals;
+    {
+        std::lock_guard<std::mutex> l(mtx);
+        totals = retired;
+        for (const auto& [ptr, t] : live) {
+            std::vector<uint64_t> raw;
+            raw.reserve(t->copy_size());
+            t->copy(raw);
+            merge(raw, totals);
+        }
+    }
+
+    auto m = get_mmap(getpid());
+    std::map<std::string, uint64_t> folded;
+    std::unordered_map<uintptr_t, std::string> names;
+    for (const auto& [frames, t] : totals) {
+        std::string stack;
+        for (auto f = frames.rbegin(); f != frames.rend(); f++) {
+            auto n = names.find(*f);
+            if (n == names.end()) {
+                auto name = m ? m->symbolize(*f) : Mapping{}.symbolize(*f);
+                n = names.emplace(*f, std::move(name)).first;
+            }
+            if (!stack.empty()) stack += ';';
+            stack += n->second;
+        }
+        if (frames.empty()) stack = "[overflow]";
+        folded[stack] += metric == observe::Metric::Time ? t.nanos : t.count;
+    }
+
+    for (const auto& [stack, value] : folded) {
+        out << stack << ' ' << value << '\n';
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _STACK_HH
+#define _STACK_HH
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include <ucontext.h>
+
+#include "sysfail.hh"
+#include "map.hh"
+
+namespace sysfail {
+    // Reads memory that may not be mapped without faulting. Pages verified
+    // once are read directly for the rest of the reader's lifetime, so keep
+    // the reader short-lived (eg. one stack-capture). Safe to use in the
+    // SIGSYS handler (issues syscalls directly).
+    class SafeReader {
+        static constexpr int max_pages = 8;
+        uintptr_t pages[max_pages];
+        int known = 0;
+        pid_t pid = 0;
+
+        bool verified(uintptr_t page) const;
+
+    public:
+        bool read(uintptr_t addr, void* out, size_t len);
+    };
+
+    // Frame-pointer based unwinder, safe to use in the SIGSYS handler.
+    class Unwinder {
+        // executable ranges [start, end) known at session start, used to
+        // recognize return-address of frame-less leaf functions (eg. libc's
+        // syscall wrappers)
+        std::vector<std::pair<uintptr_t, uintptr_t>> exec;
+
+        bool executable(uintptr_t addr) const;
+
+    public:
+        explicit Unwinder(const Mapping& m);
+
+        // Captures up to `max` frames (leaf first) and returns the depth.
+        uint32_t capture(
+            const greg_t* regs,
+            uintptr_t* frames,
+            uint32_t max) const;
+    };
+
+    struct StackTotals {
+        uint64_t count = 0;
+        uint64_t nanos = 0;
+    };
+
+    // Fixed-capacity per-thread stack aggregate. Only the owning thread
+    // writes to it, readers (dump) briefly lock it to take a copy.
+    class StackTable {
+        struct Slot {
+            uint64_t hash;
+            uint32_t depth;
+            uint32_t frames_at;
+            StackTotals totals;
+        };
+
+        const uint32_t max_frames;
+        const uint32_t capacity;
+        const uint32_t mask;
+        std::unique_ptr<Slot[]> slots;
+        std::unique_ptr<uintptr_t[]> frames;
+        uint32_t used = 0;
+        StackTotals overflow;
+        std::atomic_flag busy = ATOMIC_FLAG_INIT;
+
+    public:
+        StackTable(const observe::Stacks& cfg);
+
+        // Called from the handler, drops the sample if a reader holds the
+        // table (or if handler is re-entered by a nested signal).
+        void add(const uintptr_t* f, uint32_t depth, uint64_t nanos);
+
+        // Appends `depth, count, nanos, frames...` records to `out` (overflow
+        // is reported with depth 0). Does not allocate while holding the
+        // table, so is safe to call from a failure-injected thread.
+        void copy(std::vector<uint64_t>& out);
+
+        size_t copy_size() const;
+    };
+
+    class StackProfile {
+        const observe::Stacks cfg;
+        const Unwinder unwinder;
+        std::mutex mtx;
+        std::unordered_map<StackTable*, std::unique_ptr<StackTable>> live;
+        std::map<std::vector<uintptr_t>, StackTotals> retired;
+
+        void merge(
+            const std::vector<uint64_t>& raw,
+            std::map<std::vector<uintptr_t>, StackTotals>& into);
+
+    public:
+        StackProfile(const observe::Stacks& cfg, const Mapping& m);
+
+        // Per-thread table, must be detached before the thread is forgotten
+        StackTable* attach();
+
+        // Folds the thread's stacks into process-wide totals
+        void detach(StackTable* t);
+
+        void record(
+            StackTable* t,
+            const greg_t* regs,
+            std::chrono::nanoseconds elapsed);
+
+        void dump(std::ostream& out, observe::Metric metric);
+    };
+}
+
+#endif
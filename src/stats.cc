@@ -0,0 +1,126 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stats.hh"
+
+std::string sysfail::stats::region_name(pid_t pid) {
+    return "/sysfail." + std::to_string(pid);
+}
+
+void sysfail::stats::read(const Region& r, Snapshot& s) {
+    const auto& h = r.hdr;
+    while (true) {
+        auto seq = h.seq.load(std::memory_order_acquire);
+        if (seq & 1) continue;
+        s.threads = h.threads.load(std::memory_order_relaxed);
+        s.scans = h.scans.load(std::memory_order_relaxed);
+        s.last_scan_ns = h.last_scan_ns.load(std::memory_order_relaxed);
+        s.total_scan_ns = h.total_scan_ns.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (h.seq.load(std::memory_order_relaxed) == seq) break;
+    }
+    for (uint32_t i = 0; i < max_syscall; i++) {
+        auto& c = r.calls[i];
+        auto& out = s.calls[i];
+        out.queued = c.queued.load(std::memory_order_relaxed);
+        out.queue_wait_ns = c.queue_wait_ns.load(std::memory_order_relaxed);
+        out.waits = c.waits.load(std::memory_order_relaxed);
+        out.wait_requested_ns = c.wait_requested_ns.load(
+            std::memory_order_relaxed);
+        out.wait_error_ns = c.wait_error_ns.load(std::memory_order_relaxed);
+        out.delayed = c.delayed.load(std::memory_order_relaxed);
+        out.injected = c.injected.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        out.trapped = c.trapped.load(std::memory_order_relaxed);
+    }
+}
+
+sysfail::stats::Publisher::Publisher() : name(region_name(getpid())) {
+    auto fd = shm_open(name.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), name);
+    }
+    if (ftruncate(fd, sizeof(Region)) != 0) {
+        auto err = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::system_error(err, std::generic_category(), name);
+    }
+    auto addr = mmap(
+        nullptr,
+        sizeof(Region),
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED,
+        fd,
+        0);
+    auto err = errno;
+    close(fd);
+    if (addr == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::system_error(err, std::generic_category(), name);
+    }
+
+    // truncated segment is zero-filled, fill in identity last so readers
+    // never see a valid magic with a partial header
+    r = static_cast<Region*>(addr);
+    r->hdr.version = version;
+    r->hdr.max_syscall = max_syscall;
+    r->hdr.pid = getpid();
+    std::atomic_ref<uint64_t>(r->hdr.magic).store(
+        magic,
+        std::memory_order_release);
+}
+
+sysfail::stats::Publisher::~Publisher() {
+    shm_unlink(name.c_str());
+    munmap(r, sizeof(Region));
+}
+
+template <typename Fn> void sysfail::stats::Publisher::update(Fn&& fn) {
+    std::lock_guard<std::mutex> l(mtx);
+    auto& h = r->hdr;
+    auto seq = h.seq.load(std::memory_order_relaxed);
+    h.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    fn(h);
+    h.seq.store(seq + 2, std::memory_order_release);
+}
+
+void sysfail::stats::Publisher::thread_added() {
+    update([](auto& h) {
+        h.threads.fetch_add(1, std::memory_order_relaxed);
+    });
+}
+
+void sysfail::stats::Publisher::thread_removed() {
+    update([](auto& h) {
+        h.threads.fetch_sub(1, std::memory_order_relaxed);
+    });
+}
+
+void sysfail::stats::Publisher::scanned(std::chrono::nanoseconds elapsed) {
+    update([&](auto& h) {
+        h.scans.fetch_add(1, std::memory_order_relaxed);
+        h.last_scan_ns.store(elapsed.count(), std::memory_order_relaxed);
+        h.total_scan_ns.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    });
+}
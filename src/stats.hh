@@ -0,0 +1,169 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _STATS_HH
+#define _STATS_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+// Live session statistics published in a POSIX shared-memory segment
+// (/dev/shm/sysfail.<pid>) so external tools (sysfail-top) can watch a
+// running session without touching the process.
+//
+// The layout is shared with readers, so only append to it (and bump
+// `version` for incompatible changes). Per-syscall counters are independent
+// monotonic counters, header fields that must be read together are
+// protected by a seqlock.
+
+namespace sysfail::stats {
+    constexpr uint64_t magic = 0x316c696166737973; // "sysfail1"
+    constexpr uint32_t version = 1;
+    constexpr uint32_t max_syscall = 512;
+
+    struct alignas(64) Counters {
+        // Syscalls intercepted by the SIGSYS handler
+        std::atomic<uint64_t> trapped;
+        // Failures injected (before or after the syscall)
+        std::atomic<uint64_t> injected;
+        // Delays injected
+        std::atomic<uint64_t> delayed;
+        // Delays waited out, time requested and absolute error of the time
+        // actually waited (so mean error is wait_error_ns / waits)
+        std::atomic<uint64_t> waits;
+        std::atomic<uint64_t> wait_requested_ns;
+        std::atomic<uint64_t> wait_error_ns;
+        // Calls that waited for a Concurrency queue slot, and time waited
+        std::atomic<uint64_t> queued;
+        std::atomic<uint64_t> queue_wait_ns;
+    };
+
+    struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t max_syscall;
+        pid_t pid;
+
+        // odd while a writer is updating the fields below
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> threads;
+        std::atomic<uint64_t> scans;
+        std::atomic<uint64_t> last_scan_ns;
+        std::atomic<uint64_t> total_scan_ns;
+    };
+
+    struct Region {
+        Header hdr;
+        Counters calls[max_syscall];
+    };
+
+    struct Snapshot {
+        uint64_t threads = 0;
+        uint64_t scans = 0;
+        uint64_t last_scan_ns = 0;
+        uint64_t total_scan_ns = 0;
+        struct {
+            uint64_t trapped = 0;
+            uint64_t injected = 0;
+            uint64_t delayed = 0;
+            uint64_t waits = 0;
+            uint64_t wait_requested_ns = 0;
+            uint64_t wait_error_ns = 0;
+            uint64_t queued = 0;
+            uint64_t queue_wait_ns = 0;
+        } calls[max_syscall];
+    };
+
+    // Shared-memory object name (for shm_open) of the given process' stats
+    std::string region_name(pid_t pid);
+
+    // Consistent copy of the header and a (per-counter) copy of counters.
+    // Counters are read in reverse order of increment, so a syscall never
+    // appears to be injected more times than it was trapped.
+    void read(const Region& r, Snapshot& s);
+
+    // Writer side, owned by the session
+    class Publisher {
+        Region* r;
+        const std::string name;
+        std::mutex mtx; // serializes header writers
+
+        template <typename Fn> void update(Fn&& fn);
+
+    public:
+        Publisher();
+        ~Publisher();
+
+        // Handler-safe (lock-free) counters
+        void trapped(long call) {
+            if (call >= 0 && call < max_syscall) {
+                r->calls[call].trapped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void injected(long call) {
+            if (call >= 0 && call < max_syscall) {
+                r->calls[call].injected.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void delayed(long call) {
+            if (call >= 0 && call < max_syscall) {
+                r->calls[call].delayed.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void waited(
+            long call,
+            std::chrono::nanoseconds requested,
+            std::chrono::nanoseconds achieved
+        ) {
+            if (call >= 0 && call < max_syscall) {
+                auto& c = r->calls[call];
+                auto err = achieved - requested;
+                c.wait_error_ns.fetch_add(
+                    err.count() < 0 ? -err.count() : err.count(),
+                    std::memory_order_relaxed);
+                c.wait_requested_ns.fetch_add(
+                    requested.count(),
+                    std::memory_order_relaxed);
+                c.waits.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void queued(long call, std::chrono::nanoseconds waited) {
+            if (call >= 0 && call < max_syscall) {
+                auto& c = r->calls[call];
+                c.queue_wait_ns.fetch_add(
+                    waited.count(),
+                    std::memory_order_relaxed);
+                c.queued.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void thread_added();
+
+        void thread_removed();
+
+        void scanned(std::chrono::nanoseconds elapsed);
+    };
+}
+
+#endif
@@ -23,13 +23,15 @@
 
 #include "thdmon.hh"
 #include "helpers.hh"
+#include "probe.hh"
 
 namespace fs = std::filesystem;
 
 sysfail::ThdMon::ThdMon(
     const thread_discovery::Strategy& config,
-    ThdEvtHdlr handler
-) : handler(handler) {
+    ThdEvtHdlr handler,
+    ScanHdlr on_scan
+) : handler(handler), on_scan(on_scan) {
     // Found the hard way that inotify does not work for /proc
     // so for now we poll!
     // TODO: replace this with netlink cn_proc based monitoring
@@ -86,13 +88,17 @@ void sysfail::ThdMon::process() {
 }
 
 void sysfail::ThdMon::scan_tasks() {
+    auto start = std::chrono::steady_clock::now();
+    int64_t tasks = 0, spawned = 0;
     for (const auto& entry : fs::directory_iterator(tasks_dir)) {
         auto name = entry.path().filename().string();
         pid_t tid = std::stoi(name);
+        tasks++;
         auto it = known_thds.find(tid);
         if (it == known_thds.end()) {
             handler( tid, gen == 0 ? DiscThdSt::Existing : DiscThdSt::Spawned);
             known_thds.insert({tid, gen});
+            spawned++;
         } else {
             it->second = gen;
         }
@@ -107,6 +113,16 @@ void sysfail::ThdMon::scan_tasks() {
         handler(tid, DiscThdSt::Terminated);
         known_thds.erase(tid);
     }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+    SYSFAIL_PROBE5(
+        scan,
+        gen,
+        tasks,
+        spawned,
+        to_remove.size(),
+        elapsed.count());
+    if (on_scan) on_scan(elapsed);
 }
 
 void sysfail::ThdMon::rescan_threads() {
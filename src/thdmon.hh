@@ -35,9 +35,11 @@ namespace sysfail {
     };
 
     using ThdEvtHdlr = std::function<void(pid_t, DiscThdSt)>;
+    using ScanHdlr = std::function<void(std::chrono::nanoseconds)>;
 
     class ThdMon {
         const ThdEvtHdlr handler;
+        const ScanHdlr on_scan;
         std::chrono::microseconds poll_itvl;
         std::thread poller_thd;
         std::binary_semaphore poll_initialized{0};
@@ -56,7 +58,11 @@ namespace sysfail {
         void scan_tasks();
 
     public:
-        ThdMon( const thread_discovery::Strategy& config, ThdEvtHdlr handler);
+        // `on_scan` (optional) is told how long each scan of tasks took
+        ThdMon(
+            const thread_discovery::Strategy& config,
+            ThdEvtHdlr handler,
+            ScanHdlr on_scan = {});
 
         ~ThdMon();
 
@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "helpers.hh"
+#include "iov.hh"
+#include "throttle.hh"
+
+sysfail::Throttle::Throttle(
+    uint64_t bytes_per_sec,
+    Mode mode,
+    uint64_t burst,
+    bool per_fd
+) : bytes_per_sec(bytes_per_sec), mode(mode), burst(burst), per_fd(per_fd) {
+    if (bytes_per_sec == 0) {
+        throw std::invalid_argument("Throttle rate must be positive");
+    }
+}
+
+sysfail::Throttler::Throttler(
+    const Throttle& t
+) : mode(t.mode),
+    ns_per_byte(1e9 / t.bytes_per_sec),
+    burst(t.burst ? t.burst : std::max<uint64_t>(t.bytes_per_sec / 100, 1)),
+    burst_ns(std::llround(burst * ns_per_byte)),
+    per_fd(t.per_fd),
+    paid_until(new std::atomic<int64_t>[per_fd ? max_fds : 1]) {
+    for (size_t i = 0; i < (per_fd ? max_fds : 1); i++) paid_until[i] = 0;
+}
+
+bool sysfail::Throttler::supports(Syscall call) {
+    switch (call) {
+        case SYS_read:
+        case SYS_write:
+        case SYS_pread64:
+        case SYS_pwrite64:
+        case SYS_readv:
+        case SYS_writev:
+        case SYS_sendto:
+        case SYS_recvfrom:
+        case SYS_sendmsg:
+        case SYS_recvmsg:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::atomic<int64_t>* sysfail::Throttler::budget(int64_t fd) {
+    if (!per_fd) return &paid_until[0];
+    if (fd < 0 || static_cast<size_t>(fd) >= max_fds) return nullptr;
+    return &paid_until[fd];
+}
+
+std::chrono::nanoseconds sysfail::Throttler::admit(
+    greg_t* regs,
+    std::chrono::nanoseconds now
+) {
+    auto b = budget(regs[REG_RDI]);
+    if (!b) return std::chrono::nanoseconds(0);
+    auto paid = b->load(std::memory_order_relaxed);
+    auto call = regs[REG_RAX];
+    auto cuttable = call != SYS_sendto &&
+        call != SYS_recvfrom &&
+        call != SYS_sendmsg &&
+        call != SYS_recvmsg;
+    if (mode == Throttle::Mode::Delay || !cuttable) {
+        return std::chrono::nanoseconds(std::max<int64_t>(paid - now.count(), 0));
+    }
+
+    // bytes the budget allows right now (negative when overdrawn)
+    auto since = now.count() - std::max(paid, now.count() - burst_ns);
+    auto allowed = static_cast<int64_t>(since / ns_per_byte);
+    // don't cut calls down to a trickle, wait for a burst worth instead
+    auto least = static_cast<int64_t>(burst);
+
+    if (call == SYS_readv || call == SYS_writev) {
+        int64_t total = 0, keep = 0;
+        auto read = iov::lengths(regs, [&](size_t l) {
+            auto len = static_cast<int64_t>(l);
+            if (keep > 0 && total + len > std::max(allowed, least)) {
+                return false;
+            }
+            total += len;
+            keep++;
+            return true;
+        });
+        if (!read) return std::chrono::nanoseconds(0);
+        if (keep > 0) regs[REG_RDX] = keep;
+        return std::chrono::nanoseconds(std::llround(
+            std::max<double>(total - allowed, 0) * ns_per_byte));
+    }
+
+    auto count = static_cast<int64_t>(regs[REG_RDX]);
+    if (allowed >= count) return std::chrono::nanoseconds(0);
+    auto grant = std::min(count, std::max(allowed, least));
+    regs[REG_RDX] = grant;
+    return std::chrono::nanoseconds(std::llround(
+        std::max<double>(grant - allowed, 0) * ns_per_byte));
+}
+
+void sysfail::Throttler::charge(
+    int64_t fd,
+    int64_t bytes,
+    std::chrono::nanoseconds now
+) {
+    auto b = budget(fd);
+    if (bytes <= 0 || !b) return;
+    auto cost = std::llround(bytes * ns_per_byte);
+    auto paid = b->load(std::memory_order_relaxed);
+    // unused budget beyond a burst doesn't accumulate
+    while (!b->compare_exchange_weak(
+               paid,
+               std::max(paid, now.count() - burst_ns) + cost,
+               std::memory_order_relaxed));
+}
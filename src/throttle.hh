@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _THROTTLE_HH
+#define _THROTTLE_HH
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <sys/ucontext.h>
+
+#include "sysfail.hh"
+
+namespace sysfail {
+    // Enforces an outcome's Throttle, safe to use from the handler (does not
+    // allocate or block). Budgets are tracked as the time each one is paid
+    // up to (GCRA), in a flat table indexed by fd.
+    class Throttler {
+        const Throttle::Mode mode;
+        const double ns_per_byte;
+        // bytes allowed through at once, and how long they take to pay up
+        const uint64_t burst;
+        const int64_t burst_ns;
+        const bool per_fd;
+        std::unique_ptr<std::atomic<int64_t>[]> paid_until;
+
+        // nullptr for fds out of [0, max_fds) (when per fd), they aren't
+        // throttled
+        std::atomic<int64_t>* budget(int64_t fd);
+
+    public:
+        explicit Throttler(const Throttle& t);
+
+        static bool supports(Syscall call);
+
+        // Delay the call must wait before it is made. Shortens the call
+        // (in `regs`) instead, if the throttle allows. readv / writev whose
+        // iovecs can't be read are let through as they are.
+        std::chrono::nanoseconds admit(
+            greg_t* regs,
+            std::chrono::nanoseconds now);
+
+        // Charges bytes the call transferred to the fd's budget
+        void charge(int64_t fd, int64_t bytes, std::chrono::nanoseconds now);
+    };
+}
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <sys/mman.h>
+
+#include "trace.hh"
+#include "syscall.hh"
+
+namespace {
+    const char magic[8] = {'s', 'y', 's', 'f', 'a', 'i', 'l', 'T'};
+    const uint32_t version = 1;
+
+    // Fields are written in host byte-order (x86_64 only)
+    template <typename T> void put(std::ostream& out, T v) {
+        out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    template <typename T> T get(std::istream& in) {
+        T v;
+        in.read(reinterpret_cast<char*>(&v), sizeof(v));
+        if (!in) throw std::invalid_argument("Truncated sysfail trace");
+        return v;
+    }
+
+    bool by_thread_and_index(
+        const sysfail::trace::Event& a,
+        const sysfail::trace::Event& b
+    ) {
+        return a.thread != b.thread ? a.thread < b.thread : a.index < b.index;
+    }
+}
+
+void sysfail::trace::Trace::save(std::ostream& out) const {
+    out.write(magic, sizeof(magic));
+    put<uint32_t>(out, version);
+    put<uint64_t>(out, dropped);
+    put<uint64_t>(out, events.size());
+    for (const auto& e : events) {
+        put<uint32_t>(out, e.thread);
+        put<uint64_t>(out, e.index);
+        put<int32_t>(out, e.call);
+        put<int32_t>(out, e.fail);
+        put<uint8_t>(out, (e.fail_after ? 1 : 0) | (e.delay_after ? 2 : 0));
+        put<int64_t>(out, e.delay.count());
+    }
+}
+
+sysfail::trace::Trace sysfail::trace::Trace::load(std::istream& in) {
+    char m[sizeof(magic)];
+    in.read(m, sizeof(m));
+    if (!in || std::memcmp(m, magic, sizeof(magic)) != 0) {
+        throw std::invalid_argument("Not a sysfail trace");
+    }
+    if (get<uint32_t>(in) != version) {
+        throw std::invalid_argument("Unsupported sysfail trace version");
+    }
+    Trace t;
+    t.dropped = get<uint64_t>(in);
+    auto n = get<uint64_t>(in);
+    for (uint64_t i = 0; i < n; i++) {
+        Event e;
+        e.thread = get<uint32_t>(in);
+        e.index = get<uint64_t>(in);
+        e.call = get<int32_t>(in);
+        e.fail = get<int32_t>(in);
+        auto flags = get<uint8_t>(in);
+        e.fail_after = flags & 1;
+        e.delay_after = flags & 2;
+        e.delay = std::chrono::microseconds(get<int64_t>(in));
+        t.events.push_back(e);
+    }
+    return t;
+}
+
+sysfail::trace::Log::Chunk* sysfail::trace::Log::map_chunk() {
+    auto addr = sysfail::syscall(
+        0,
+        chunk_bytes,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0,
+        SYS_mmap);
+    if (addr < 0 && addr > -4096) return nullptr;
+    // zero-filled memory is a valid empty chunk
+    return reinterpret_cast<Chunk*>(addr);
+}
+
+sysfail::trace::Log::Log(
+    uint32_t thread
+) : thread(thread), head(map_chunk()), tail(head) {
+    if (!head) throw std::runtime_error("Failed to map decision log");
+}
+
+sysfail::trace::Log::~Log() {
+    for (auto c = head; c != nullptr;) {
+        auto next = c->next.load();
+        sysfail::syscall(
+            reinterpret_cast<uint64_t>(c),
+            chunk_bytes,
+            0,
+            0,
+            0,
+            0,
+            SYS_munmap);
+        c = next;
+    }
+}
+
+void sysfail::trace::Log::add(
+    uint64_t index,
+    Syscall call,
+    Errno fail,
+    bool fail_after,
+    std::chrono::microseconds delay,
+    bool delay_after
+) {
+    auto used = tail->used.load(std::memory_order_relaxed);
+    if (used == Chunk::capacity) {
+        auto c = map_chunk();
+        if (!c) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        tail->next.store(c, std::memory_order_release);
+        tail = c;
+        used = 0;
+    }
+    auto& e = tail->entries[used];
+    e.index = index;
+    e.delay_us = delay.count();
+    e.call = static_cast<uint16_t>(call);
+    e.fail = static_cast<uint16_t>(fail) |
+        (fail_after ? Entry::fail_after : 0) |
+        (delay_after ? Entry::delay_after : 0);
+    tail->used.store(used + 1, std::memory_order_release);
+}
+
+void sysfail::trace::Log::copy(std::vector<Event>& out) const {
+    for (auto c = head; c != nullptr; c = c->next.load()) {
+        auto used = c->used.load();
+        for (uint32_t i = 0; i < used; i++) {
+            const auto& e = c->entries[i];
+            out.push_back({
+                .thread = thread,
+                .index = e.index,
+                .call = e.call,
+                .fail = e.fail & 0xfff,
+                .fail_after = (e.fail & Entry::fail_after) != 0,
+                .delay = std::chrono::microseconds(e.delay_us),
+                .delay_after = (e.fail & Entry::delay_after) != 0});
+        }
+    }
+}
+
+uint64_t sysfail::trace::Log::lost() const {
+    return dropped.load();
+}
+
+sysfail::trace::Log* sysfail::trace::Recorder::attach(uint32_t thread) {
+    auto l = std::make_unique<Log>(thread);
+    auto ptr = l.get();
+    std::lock_guard<std::mutex> g(mtx);
+    live[ptr] = std::move(l);
+    return ptr;
+}
+
+void sysfail::trace::Recorder::detach(Log* l) {
+    std::lock_guard<std::mutex> g(mtx);
+    auto it = live.find(l);
+    if (it == live.end()) return;
+    l->copy(retired);
+    dropped += l->lost();
+    live.erase(it);
+}
+
+sysfail::trace::Trace sysfail::trace::Recorder::collect() {
+    Trace t;
+    {
+        std::lock_guard<std::mutex> g(mtx);
+        t.events = retired;
+        t.dropped = dropped;
+        for (const auto& [ptr, l] : live) {
+            l->copy(t.events);
+            t.dropped += l->lost();
+        }
+    }
+    std::sort(t.events.begin(), t.events.end(), by_thread_and_index);
+    return t;
+}
+
+sysfail::trace::Replayer::Replayer(const Trace& t) {
+    for (const auto& e : t.events) {
+        if (e.thread >= by_thread.size()) by_thread.resize(e.thread + 1);
+        by_thread[e.thread].push_back(e);
+    }
+    for (auto& evts : by_thread) {
+        std::sort(evts.begin(), evts.end(), by_thread_and_index);
+    }
+}
+
+const sysfail::trace::Event* sysfail::trace::Replayer::find(
+    uint32_t thread,
+    uint64_t index,
+    size_t& cursor
+) const {
+    if (thread >= by_thread.size()) return nullptr;
+    const auto& evts = by_thread[thread];
+    if (cursor >= evts.size() ||
+        (cursor > 0 && evts[cursor - 1].index >= index)) {
+        // moved backwards, look it up from scratch
+        cursor = std::lower_bound(
+            evts.begin(),
+            evts.end(),
+            index,
+            [](const Event& e, uint64_t i) { return e.index < i; })
+            - evts.begin();
+    }
+    while (cursor < evts.size() && evts[cursor].index < index) cursor++;
+    if (cursor < evts.size() && evts[cursor].index == index) {
+        return &evts[cursor++];
+    }
+    return nullptr;
+}
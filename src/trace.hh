@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TRACE_HH
+#define _TRACE_HH
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "sysfail.hh"
+
+namespace sysfail::trace {
+    // Compact form of an Event, the thread is implied by the log
+    struct Entry {
+        uint64_t index;
+        int64_t delay_us;
+        uint16_t call;
+        uint16_t fail; // errno (< 4096) | Entry::fail_after | delay_after
+        static constexpr uint16_t fail_after = 1 << 14;
+        static constexpr uint16_t delay_after = 1 << 15;
+    };
+    static_assert(sizeof(Entry) == 24);
+
+    // Append-only per-thread log of decisions, in chunks of anonymous
+    // memory mapped with raw syscalls, so the handler can grow it without
+    // allocating. Only the owning thread appends, readers may copy it
+    // concurrently.
+    class Log {
+        static constexpr size_t chunk_bytes = 64 * 1024;
+
+        struct Chunk {
+            static constexpr uint32_t capacity =
+                (chunk_bytes - 16) / sizeof(Entry);
+
+            std::atomic<Chunk*> next;
+            std::atomic<uint32_t> used;
+            Entry entries[capacity];
+        };
+        static_assert(sizeof(Chunk) <= chunk_bytes);
+
+        const uint32_t thread;
+        Chunk* const head;
+        Chunk* tail;
+        std::atomic<uint64_t> dropped{0};
+
+        static Chunk* map_chunk();
+
+    public:
+        explicit Log(uint32_t thread);
+
+        ~Log();
+
+        Log(const Log&) = delete;
+        Log& operator=(const Log&) = delete;
+
+        // Called from the handler. Decisions that can't be logged (no
+        // memory) are counted as dropped.
+        void add(
+            uint64_t index,
+            Syscall call,
+            Errno fail,
+            bool fail_after,
+            std::chrono::microseconds delay,
+            bool delay_after);
+
+        void copy(std::vector<Event>& out) const;
+
+        uint64_t lost() const;
+    };
+
+    class Recorder {
+        std::mutex mtx;
+        std::unordered_map<Log*, std::unique_ptr<Log>> live;
+        std::vector<Event> retired;
+        uint64_t dropped = 0;
+
+    public:
+        // Per-thread log, must be detached before the thread is forgotten
+        Log* attach(uint32_t thread);
+
+        // Moves the thread's decisions to the process-wide trace
+        void detach(Log* l);
+
+        Trace collect();
+    };
+
+    // Recorded decisions indexed by thread for replay, lookups do not
+    // allocate
+    class Replayer {
+        std::vector<std::vector<Event>> by_thread;
+
+    public:
+        explicit Replayer(const Trace& t);
+
+        // Decision `index` of `thread` (if recorded). `cursor` is the
+        // caller's position in the thread's decisions, lookups are O(1) when
+        // indices only move forward.
+        const Event* find(
+            uint32_t thread,
+            uint64_t index,
+            size_t& cursor) const;
+    };
+}
+
+#endif
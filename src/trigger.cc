@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trigger.hh"
+#include "helpers.hh"
+
+sysfail::trigger::Nth::Nth(uint64_t k, Scope scope) : k(k), scope(scope) {}
+
+sysfail::trigger::Every::Every(uint64_t n, Scope scope) : n(n), scope(scope) {
+    if (n == 0) {
+        throw std::invalid_argument("Trigger period must be positive");
+    }
+}
+
+sysfail::trigger::Window::Window(
+    uint64_t from,
+    uint64_t to,
+    Scope scope
+) : from(from), to(to), scope(scope) {
+    if (from >= to) {
+        throw std::invalid_argument("Trigger window must not be empty");
+    }
+}
+
+sysfail::trigger::Scope sysfail::trigger::scope(const Trigger& t) {
+    return std::visit([](const auto& t) { return t.scope; }, t);
+}
+
+bool sysfail::trigger::picks(const Trigger& t, uint64_t index) {
+    return std::visit(cases(
+        [&](const Nth& n) {
+            return index == n.k;
+        },
+        [&](const Every& e) {
+            return index % e.n == e.n - 1;
+        },
+        [&](const Window& w) {
+            return index >= w.from && index < w.to;
+        }),
+        t);
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TRIGGER_HH
+#define _TRIGGER_HH
+
+#include "sysfail.hh"
+
+namespace sysfail::trigger {
+    Scope scope(const Trigger& t);
+
+    // Whether the call at `index` is picked, does not allocate
+    bool picks(const Trigger& t, uint64_t index);
+}
+
+#endif
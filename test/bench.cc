@@ -0,0 +1,258 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Syscall-path microbenchmark: ns per syscall across the configurations a
+// syscall can go through, from 1 to N threads doing tight syscall loops.
+//
+// Usage: bench [-t <max-threads>] [-d <ms-per-point>] [-f <filter>]
+//
+// Prints one row per (scenario, syscall, threads). `ns/call` is wall-clock
+// time per syscall as seen by each thread, `Mcalls/s` is the aggregate
+// throughput across threads.
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sysfail.hh>
+
+using namespace std::chrono_literals;
+
+namespace {
+    struct Scenario {
+        const char* name;
+        // Plan (nullopt => no session)
+        std::function<std::optional<sysfail::Plan>(pid_t main)> plan;
+        // Worker threads add themselves to the session
+        bool add;
+    };
+
+    sysfail::Plan plan_for(
+        pid_t main,
+        std::unordered_map<sysfail::Syscall, const sysfail::Outcome> outcomes
+    ) {
+        return sysfail::Plan(
+            outcomes,
+            [=](pid_t tid) { return tid != main; },
+            sysfail::thread_discovery::None{});
+    }
+
+    std::unordered_map<sysfail::Syscall, const sysfail::Outcome> both(
+        const sysfail::Outcome& o
+    ) {
+        return {{SYS_getppid, o}, {SYS_write, o}};
+    }
+
+    const std::vector<Scenario> scenarios{
+        {
+            "no-session",
+            [](pid_t) { return std::nullopt; },
+            false
+        },
+        {
+            "thread-not-added",
+            [](pid_t main) {
+                return plan_for(main, both({{1, 0}, {0, 0}, 0us, {{EIO, 1}}}));
+            },
+            false
+        },
+        {
+            "not-in-plan",
+            [](pid_t main) {
+                return plan_for(
+                    main,
+                    {{SYS_getuid, {{1, 0}, {0, 0}, 0us, {{EIO, 1}}}}});
+            },
+            true
+        },
+        {
+            "p=0",
+            [](pid_t main) {
+                return plan_for(main, both({{0, 0}, {0, 0}, 0us, {{EIO, 1}}}));
+            },
+            true
+        },
+        {
+            "p=1-before",
+            [](pid_t main) {
+                return plan_for(main, both({{1, 0}, {0, 0}, 0us, {{EIO, 1}}}));
+            },
+            true
+        },
+        {
+            "p=1-after",
+            [](pid_t main) {
+                return plan_for(main, both({{1, 1}, {0, 0}, 0us, {{EIO, 1}}}));
+            },
+            true
+        },
+        {
+            "invp",
+            [](pid_t main) {
+                // rejects every invocation, so this is p=1 + predicate cost
+                auto never = sysfail::invp::p(
+                    [](auto, auto fd, auto, auto) { return fd == -2; });
+                return plan_for(
+                    main,
+                    both({{1, 0}, {0, 0}, 0us, {{EIO, 1}}, never}));
+            },
+            true
+        }
+    };
+
+    struct Call {
+        const char* name;
+        void (*fn)(int fd);
+    };
+
+    const std::vector<Call> calls{
+        {"getppid", [](int) { getppid(); }},
+        {"write", [](int fd) {
+            char c = 'x';
+            if (write(fd, &c, 1)) {}
+        }}
+    };
+
+    struct Result {
+        double ns_per_call;
+        double mcalls_per_sec;
+    };
+
+    Result run(
+        sysfail::Session* s,
+        bool add,
+        const Call& call,
+        int threads,
+        std::chrono::milliseconds duration
+    ) {
+        auto fd = open("/dev/null", O_WRONLY);
+        std::atomic<bool> stop{false};
+        std::vector<uint64_t> ops(threads);
+        std::barrier start(threads + 1);
+        std::barrier done(threads + 1);
+
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                if (add) s->add();
+                start.arrive_and_wait();
+                uint64_t n = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    for (int i = 0; i < 64; i++) call.fn(fd);
+                    n += 64;
+                }
+                ops[t] = n;
+                if (add) s->remove();
+                done.arrive_and_wait();
+            });
+        }
+
+        start.arrive_and_wait();
+        auto begin = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(duration);
+        stop = true;
+        auto end = std::chrono::steady_clock::now();
+        done.arrive_and_wait();
+        for (auto& w : workers) w.join();
+        close(fd);
+
+        uint64_t total = 0;
+        for (auto n : ops) total += n;
+        std::chrono::duration<double, std::nano> elapsed = end - begin;
+        return {
+            elapsed.count() * threads / total,
+            total / elapsed.count() * 1e3
+        };
+    }
+
+    void usage(const char* prog) {
+        fprintf(
+            stderr,
+            "Usage: %s [-t <max-threads>] [-d <ms-per-point>] [-f <filter>]\n",
+            prog);
+    }
+}
+
+int main(int argc, char** argv) {
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    auto duration = 200ms;
+    std::string filter;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:d:f:h")) != -1) {
+        switch (opt) {
+            case 't':
+                max_threads = std::stoi(optarg);
+                break;
+            case 'd':
+                duration = std::chrono::milliseconds(std::stol(optarg));
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (max_threads < 1 || duration.count() <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    printf(
+        "%-18s %-8s %8s %12s %12s\n",
+        "SCENARIO",
+        "SYSCALL",
+        "THREADS",
+        "ns/call",
+        "Mcalls/s");
+    auto main_tid = gettid();
+    for (const auto& sc : scenarios) {
+        if (!filter.empty() && std::string(sc.name).find(filter) == std::string::npos) {
+            continue;
+        }
+        auto plan = sc.plan(main_tid);
+        std::unique_ptr<sysfail::Session> s;
+        if (plan) s = std::make_unique<sysfail::Session>(*plan);
+        for (const auto& call : calls) {
+            for (auto t : thread_counts) {
+                auto r = run(s.get(), sc.add, call, t, duration);
+                printf(
+                    "%-18s %-8s %8d %12.1f %12.2f\n",
+                    sc.name,
+                    call.name,
+                    t,
+                    r.ns_per_call,
+                    r.mcalls_per_sec);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <thread>
+#include <unistd.h>
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    // distinct call-sites, one gives up (exits) and the other one retries
+    __attribute__((noinline)) void site_gives_up() {
+        if (syscall(SYS_getppid) < 0) syscall(SYS_getuid);
+        asm volatile("" ::: "memory");
+    }
+
+    __attribute__((noinline)) void site_retries() {
+        if (syscall(SYS_getppid) < 0) syscall(SYS_getppid);
+        asm volatile("" ::: "memory");
+    }
+
+    TEST(CallSite, AttributesInjectedFailuresToCallSites) {
+        sysfail::Plan p(
+            { {SYS_getppid, {1, 0, 0us, {{EIO, 1}}}} },
+            [](pid_t) { return true; },
+            thread_discovery::None{},
+            {.call_sites = observe::CallSites{}});
+
+        Session s(p);
+        for (int i = 0; i < 10; i++) site_gives_up();
+        std::thread t([&]() {
+            s.add();
+            for (int i = 0; i < 5; i++) site_gives_up();
+            s.remove();
+        });
+        t.join();
+        for (int i = 0; i < 3; i++) site_retries();
+
+        auto sites = s.call_sites();
+        uint64_t total = 0;
+        for (const auto& site : sites) {
+            EXPECT_EQ(site.call, SYS_getppid);
+            ASSERT_FALSE(site.frames.empty());
+            EXPECT_NE(site.frames[0].module.find("libc"), std::string::npos)
+                << site.frames[0].module;
+            total += site.injected;
+        }
+        // each retry is injected too (and is followed by the next retry)
+        EXPECT_EQ(total, 10 + 5 + 3 * 2);
+
+        auto gave_up = std::count_if(
+            sites.begin(),
+            sites.end(),
+            [](const auto& site) {
+                return site.followed_by.contains(SYS_getuid);
+            });
+        EXPECT_GE(gave_up, 1);
+        uint64_t exits = 0;
+        for (const auto& site : sites) {
+            auto f = site.followed_by.find(SYS_getuid);
+            if (f != site.followed_by.end()) exits += f->second;
+        }
+        EXPECT_EQ(exits, 15);
+
+        auto retried = std::find_if(
+            sites.begin(),
+            sites.end(),
+            [](const auto& site) {
+                auto f = site.followed_by.find(SYS_getppid);
+                return f != site.followed_by.end() && f->second == 3;
+            });
+        EXPECT_NE(retried, sites.end());
+    }
+
+    TEST(CallSite, ReportRequiresCallSiteTracking) {
+        Session s({});
+        EXPECT_THROW(s.call_sites(), std::logic_error);
+    }
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Statistical conformance of injected outcomes against the plan, over a
+// large number of calls. Bounds are set for a false-failure rate of about
+// 1e-6 per check, so a failure here means the sampler is off, not bad luck.
+//
+// SYSFAIL_CONFORMANCE_CALLS overrides the number of calls per test
+// (default 1M).
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cisq.hh"
+#include "session.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    // standard-normal quantile for a two-sided ~1e-6 false-failure rate
+    const double z_crit = 4.9;
+
+    uint64_t calls() {
+        auto n = std::getenv("SYSFAIL_CONFORMANCE_CALLS");
+        return n ? std::stoull(n) : 1'000'000;
+    }
+
+    void report_throughput(const char* what, uint64_t n, auto elapsed) {
+        std::chrono::duration<double> secs = elapsed;
+        auto rate = n / secs.count();
+        std::cout << what << ": " << n << " calls, "
+                  << static_cast<uint64_t>(rate) << " calls/s\n";
+        Test::RecordProperty(what, std::to_string(static_cast<uint64_t>(rate)));
+    }
+
+    // Expects `observed` successes in `n` trials to be consistent with `p`
+    void expect_binomial(uint64_t observed, uint64_t n, double p) {
+        auto mean = n * p;
+        auto sd = std::sqrt(n * p * (1 - p));
+        if (sd == 0) {
+            EXPECT_EQ(observed, mean);
+            return;
+        }
+        EXPECT_LT(std::abs((observed - mean) / sd), z_crit)
+            << "observed " << observed << " of " << n << ", expected p " << p;
+    }
+
+    // Chi-square goodness of fit of `observed` counts against `weights`
+    // (relative, need not add up to 1)
+    void expect_chi_square(
+        const std::map<Errno, uint64_t>& observed,
+        const std::map<Errno, double>& weights
+    ) {
+        double total_wt = 0;
+        uint64_t n = 0;
+        for (const auto& [e, w] : weights) total_wt += w;
+        for (const auto& [e, c] : observed) {
+            EXPECT_TRUE(weights.contains(e)) << "unexpected errno " << e;
+            n += c;
+        }
+        double chi2 = 0;
+        for (const auto& [e, w] : weights) {
+            auto expected = n * w / total_wt;
+            auto o = observed.contains(e) ? observed.at(e) : 0;
+            chi2 += (o - expected) * (o - expected) / expected;
+        }
+        // Wilson-Hilferty approximation of the chi-square critical value
+        double k = weights.size() - 1;
+        auto crit = k * std::pow(
+            1 - 2 / (9 * k) + z_crit * std::sqrt(2 / (9 * k)),
+            3);
+        EXPECT_LT(chi2, crit) << "chi-square " << chi2 << " with " << k
+                              << " degrees of freedom";
+    }
+
+    // Kolmogorov-Smirnov test of integer samples (histogram by value)
+    // against uniform [lo, hist.size())
+    void expect_uniform(const std::vector<uint64_t>& hist, uint64_t lo) {
+        uint64_t n = 0;
+        for (auto c : hist) n += c;
+        ASSERT_GT(n, 0);
+        double d = 0;
+        uint64_t cumulative = 0;
+        for (uint64_t v = lo; v < hist.size(); v++) {
+            cumulative += hist[v];
+            auto empirical = static_cast<double>(cumulative) / n;
+            auto expected = static_cast<double>(v - lo + 1) / (hist.size() - lo);
+            d = std::max(d, std::abs(empirical - expected));
+        }
+        // K(1 - 1e-6) of the Kolmogorov distribution
+        EXPECT_LT(d * std::sqrt(n), 2.69) << "KS statistic " << d;
+    }
+
+    TEST(Conformance, FailureRateAfterBiasAndErrorMix) {
+        // unit-sized relative seeks leave a trace of whether the syscall
+        // actually ran, which tells after-failures apart from before-failures
+        Cisq::TmpFile f;
+        auto fd = open(f.path.c_str(), O_RDONLY);
+        ASSERT_GE(fd, 0);
+
+        const double p = 0.3, bias = 0.4;
+        const std::map<Errno, double> weights{
+            {EIO, 1}, {EBADF, 2}, {EINTR, 3}, {ENOSPC, 4}};
+
+        auto n = calls();
+        uint64_t failed = 0;
+        std::map<Errno, uint64_t> errors;
+        sysfail::Plan plan(
+            { {SYS_lseek, {{p, bias}, {0, 0}, 0us, weights}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            Session s(plan);
+            for (uint64_t i = 0; i < n; i++) {
+                if (lseek(fd, 1, SEEK_CUR) < 0) {
+                    failed++;
+                    errors[errno]++;
+                }
+            }
+        }
+        report_throughput("lseek", n, std::chrono::steady_clock::now() - start);
+
+        uint64_t ran = lseek(fd, 0, SEEK_CUR);
+        close(fd);
+        auto failed_after = ran - (n - failed);
+
+        expect_binomial(failed, n, p);
+        expect_binomial(failed_after, failed, bias);
+        expect_chi_square(errors, weights);
+    }
+
+    TEST(Conformance, DecisionsMatchOutcome) {
+        const Outcome o{{0.2, 0.7}, {0.4, 0.25}, 1000us, {{EIO, 3}, {EAGAIN, 1}}};
+        ActiveOutcome ao(o, 42);
+
+        auto n = calls();
+        uint64_t failed = 0, failed_after = 0, delayed = 0, delayed_after = 0;
+        std::map<Errno, uint64_t> errors;
+        std::vector<uint64_t> delay_hist(o.max_delay.count() + 1);
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < n; i++) {
+            // a fresh stream per decision, as the handler does
+            Rng rnd(42, 0, i);
+            auto d = ao.decide(rnd);
+            if (d.fail) {
+                failed++;
+                if (d.fail_after) failed_after++;
+                errors[d.fail]++;
+            }
+            // a zero delay is indistinguishable from no delay, so look at
+            // non-zero delays, which are uniform over [1, max_delay]
+            if (d.delay.count()) {
+                delayed++;
+                if (d.delay_after) delayed_after++;
+                delay_hist[d.delay.count()]++;
+            }
+        }
+        report_throughput("decide", n, std::chrono::steady_clock::now() - start);
+
+        expect_binomial(failed, n, o.fail.p);
+        expect_binomial(failed_after, failed, o.fail.after_bias);
+        expect_chi_square(errors, o.error_weights);
+
+        auto max = o.max_delay.count();
+        expect_binomial(delayed, n, o.delay.p * max / (max + 1));
+        expect_binomial(delayed_after, delayed, o.delay.after_bias);
+        expect_uniform(delay_hist, 1);
+    }
+}
@@ -27,6 +27,7 @@
 #include <memory>
 #include <vector>
 #include <functional>
+#include <algorithm>
 #include <unordered_set>
 #include <oneapi/tbb/concurrent_vector.h>
 
@@ -728,9 +729,82 @@ namespace cwrapper {
                                  << " after: " << delay_after_avg.count();
     }
 
+    TEST(CWrapper, TestUpdatesPlanOfLiveSession) {
+        auto plan = mk_plan(
+            mk_outcome(SYS_getppid, {1, 0}, {0, 0}, 0, nullptr, nullptr, {{EIO, 1}}),
+            sysfail_tdisc_none,
+            {},
+            nullptr,
+            nullptr);
+
+        std::unique_ptr<sysfail_session_t, void(*)(sysfail_session_t*)> s(
+            sysfail_start(plan.get()),
+            [](sysfail_session_t* s) { s->stop(s); });
+
+        EXPECT_EQ(syscall(SYS_getppid), -1);
+        EXPECT_EQ(errno, EIO);
+
+        {
+            auto update = mk_plan(
+                mk_outcome(
+                    SYS_getppid,
+                    {1, 0},
+                    {0, 0},
+                    0,
+                    nullptr,
+                    nullptr,
+                    {{EPERM, 1}}),
+                sysfail_tdisc_none,
+                {},
+                nullptr,
+                nullptr);
+            s->update(s.get(), update.get());
+        }
+        EXPECT_EQ(syscall(SYS_getppid), -1);
+        EXPECT_EQ(errno, EPERM);
+
+        s->update(s.get(), nullptr); // ignored
+        EXPECT_EQ(syscall(SYS_getppid), -1);
+        EXPECT_EQ(errno, EPERM);
+    }
+
+    TEST(CWrapper, TestSeededSessionReproducesDecisions) {
+        auto plan = mk_plan(
+            mk_outcome(SYS_getppid, {0.5, 0}, {0, 0}, 0, nullptr, nullptr, {{EIO, 1}}),
+            sysfail_tdisc_none,
+            {},
+            nullptr,
+            nullptr);
+
+        auto run = [&]() {
+            std::unique_ptr<sysfail_session_t, void(*)(sysfail_session_t*)> s(
+                sysfail_start_seeded(plan.get(), 42),
+                [](sysfail_session_t* s) { s->stop(s); });
+            EXPECT_EQ(s->seed(s.get()), 42);
+            std::vector<bool> failed;
+            for (int i = 0; i < 64; i++) {
+                failed.push_back(syscall(SYS_getppid) == -1);
+            }
+            // updates keep the seed
+            s->update(s.get(), plan.get());
+            EXPECT_EQ(s->seed(s.get()), 42);
+            return failed;
+        };
+        auto failed = run();
+        EXPECT_EQ(run(), failed);
+        EXPECT_NE(std::count(failed.begin(), failed.end(), true), 0);
+        EXPECT_NE(std::count(failed.begin(), failed.end(), false), 0);
+
+        std::unique_ptr<sysfail_session_t, void(*)(sysfail_session_t*)> s(
+            sysfail_start(plan.get()),
+            [](sysfail_session_t* s) { s->stop(s); });
+        EXPECT_NE(s->seed(s.get()), 0);
+    }
+
     TEST(CWrapper, TestNullPlan) {
         auto s = sysfail_start(nullptr);
         EXPECT_FALSE(s);
+        EXPECT_FALSE(sysfail_start_seeded(nullptr, 42));
     }
 
     TEST(CWrapper, UnderstandsSyscallArgs) {
@@ -0,0 +1,111 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "delay.hh"
+#include "stats.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    namespace {
+        std::chrono::nanoseconds median_error(std::chrono::nanoseconds d) {
+            std::vector<std::chrono::nanoseconds> errors;
+            for (int i = 0; i < 51; i++) {
+                auto waited = delay::wait(d);
+                EXPECT_GE(waited, d);
+                errors.push_back(waited - d);
+            }
+            std::sort(errors.begin(), errors.end());
+            return errors[errors.size() / 2];
+        }
+    }
+
+    TEST(Delay, ShortDelaysArePrecise) {
+        delay::calibrate();
+        // NVMe-class latencies, well below what a plain sleep can hit
+        EXPECT_LT(median_error(10us), 5us);
+        EXPECT_LT(median_error(80us), 5us);
+        // mostly slept
+        EXPECT_LT(median_error(2ms), 50us);
+    }
+
+    TEST(Delay, ErrorIsPublishedInLiveStats) {
+        auto name = stats::region_name(getpid());
+        auto snapshot = std::make_unique<stats::Snapshot>();
+        std::vector<std::chrono::nanoseconds> took;
+        {
+            Session s(Plan(
+                {{SYS_getppid, {
+                    {0, 0},
+                    {1, 0},
+                    0us,
+                    {},
+                    nullptr,
+                    schedule::Constant{},
+                    {},
+                    std::nullopt,
+                    latency::Empirical({{49us, 0}, {50us, 1}})}}},
+                [](pid_t) { return true; },
+                thread_discovery::None{},
+                {.live_stats = observe::LiveStats{}}));
+            for (int i = 0; i < 20; i++) {
+                auto start = std::chrono::steady_clock::now();
+                syscall(SYS_getppid);
+                took.push_back(std::chrono::steady_clock::now() - start);
+            }
+            s.remove();
+
+            auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+            ASSERT_GE(fd, 0);
+            auto addr = mmap(
+                nullptr,
+                sizeof(stats::Region),
+                PROT_READ,
+                MAP_SHARED,
+                fd,
+                0);
+            close(fd);
+            ASSERT_NE(addr, MAP_FAILED);
+            stats::read(*static_cast<const stats::Region*>(addr), *snapshot);
+            munmap(addr, sizeof(stats::Region));
+        }
+
+        const auto& c = snapshot->calls[SYS_getppid];
+        EXPECT_EQ(c.delayed, 20);
+        EXPECT_EQ(c.waits, 20);
+        EXPECT_GE(c.wait_requested_ns, 20 * 49'000);
+        EXPECT_LE(c.wait_requested_ns, 20 * 50'000);
+        // the recorded error is what the waits overshot by, which the calls'
+        // wall time (wait included) bounds
+        std::chrono::nanoseconds total{0};
+        for (auto t : took) total += t;
+        EXPECT_GT(c.wait_error_ns, 0);
+        EXPECT_LE(c.wait_requested_ns + c.wait_error_ns, total.count());
+        // and the typical call overshoots by little (a preempted one may
+        // overshoot by a lot)
+        std::sort(took.begin(), took.end());
+        EXPECT_LT(took[took.size() / 2], 50us + 20us);
+    }
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "device.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    namespace {
+        struct Call {
+            greg_t regs[NGREG] = {};
+
+            Call(Syscall call, int fd, uint64_t count, int64_t offset = 0) {
+                regs[REG_RAX] = call;
+                regs[REG_RDI] = fd;
+                regs[REG_RDX] = count;
+                regs[REG_R10] = offset;
+            }
+        };
+
+        Outcome served_by(const Device& d) {
+            return {{0, 0}, {0, 0}, 0us, {}, nullptr, schedule::Constant{},
+                    {}, std::nullopt, latency::Uniform{}, std::nullopt, d};
+        }
+    }
+
+    TEST(Device, SeeksOnlyWhenOffsetJumps) {
+        // 1us per byte
+        DeviceModel d({5ms, 1'000'000});
+        std::chrono::nanoseconds now = 10s;
+        // where the head is isn't known yet
+        EXPECT_EQ(d.admit(Call(SYS_pread64, 5, 1000, 0).regs, now), 6ms);
+        now += 6ms;
+        EXPECT_EQ(d.admit(Call(SYS_pread64, 5, 1000, 1000).regs, now), 1ms);
+        now += 1ms;
+        EXPECT_EQ(d.admit(Call(SYS_pwrite64, 5, 1000, 2000).regs, now), 1ms);
+        now += 1ms;
+        EXPECT_EQ(d.admit(Call(SYS_pread64, 5, 1000, 0).regs, now), 6ms);
+        // each fd streams on its own
+        now += 6ms;
+        EXPECT_EQ(d.admit(Call(SYS_pread64, 6, 1000, 0).regs, now), 6ms);
+        now += 6ms;
+        EXPECT_EQ(d.admit(Call(SYS_pread64, 5, 1000, 1000).regs, now), 1ms);
+    }
+
+    TEST(Device, QueuesBeyondDepth) {
+        DeviceModel d({0us, 1'000'000, 2});
+        std::chrono::nanoseconds now = 10s;
+        Call c(SYS_pread64, 5, 1000);
+        EXPECT_EQ(d.admit(c.regs, now), 1ms);
+        EXPECT_EQ(d.admit(c.regs, now), 1ms);
+        // waits for a slot
+        EXPECT_EQ(d.admit(c.regs, now), 2ms);
+        EXPECT_EQ(d.admit(c.regs, now + 500us), 1500us);
+        // idle device serves right away
+        EXPECT_EQ(d.admit(c.regs, now + 1s), 1ms);
+    }
+
+    TEST(Device, ChargesNoTransferForUnreadableIovecs) {
+        DeviceModel d({0us, 1'000'000, 4});
+        std::chrono::nanoseconds now = 10s;
+        char buf[1500];
+        iovec iov[2] = {{buf, 1000}, {buf + 1000, 500}};
+        Call c(SYS_readv, -1, 2);
+        c.regs[REG_RSI] = reinterpret_cast<greg_t>(iov);
+        EXPECT_EQ(d.admit(c.regs, now), 1500us);
+
+        auto page = mmap(
+            nullptr,
+            4096,
+            PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+        ASSERT_NE(page, MAP_FAILED);
+        for (auto addr : {greg_t(0), greg_t(1), reinterpret_cast<greg_t>(page)}) {
+            Call bad(SYS_writev, -1, 2);
+            bad.regs[REG_RSI] = addr;
+            EXPECT_EQ(d.admit(bad.regs, now), 0ns);
+        }
+        // counts beyond IOV_MAX aren't read
+        c.regs[REG_RDX] = IOV_MAX + 1;
+        EXPECT_EQ(d.admit(c.regs, now), 0ns);
+        munmap(page, 4096);
+    }
+
+    TEST(Device, FollowsFilePosition) {
+        auto f = std::tmpfile();
+        ASSERT_NE(f, nullptr);
+        auto fd = fileno(f);
+        std::vector<char> data(4096);
+        ASSERT_EQ(write(fd, data.data(), data.size()), 4096);
+
+        DeviceModel d({5ms, 1'000'000});
+        std::chrono::nanoseconds now = 10s;
+        ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+        EXPECT_EQ(d.admit(Call(SYS_read, fd, 1000).regs, now), 6ms);
+        ASSERT_EQ(lseek(fd, 1000, SEEK_SET), 1000);
+        now += 6ms;
+        EXPECT_EQ(d.admit(Call(SYS_read, fd, 1000).regs, now), 1ms);
+        ASSERT_EQ(lseek(fd, 3000, SEEK_SET), 3000);
+        now += 1ms;
+        EXPECT_EQ(d.admit(Call(SYS_write, fd, 1000).regs, now), 6ms);
+        std::fclose(f);
+
+        // no position to follow, never seeks
+        int fds[2];
+        ASSERT_EQ(pipe(fds), 0);
+        now += 6ms;
+        EXPECT_EQ(d.admit(Call(SYS_write, fds[1], 1000).regs, now), 1ms);
+        now += 1ms;
+        EXPECT_EQ(d.admit(Call(SYS_write, fds[1], 1000).regs, now), 1ms);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    TEST(Device, SlowsRandomReadsInSession) {
+        auto f = std::tmpfile();
+        ASSERT_NE(f, nullptr);
+        auto fd = fileno(f);
+        std::vector<char> data(64 * 1024);
+        ASSERT_EQ(write(fd, data.data(), data.size()), data.size());
+
+        Session s(Plan(
+            {{SYS_pread64, served_by({2ms, 1'000'000'000})}},
+            [](pid_t) { return true; },
+            thread_discovery::None{}));
+        char buf[4096];
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 16; i++) {
+            ASSERT_EQ(pread(fd, buf, sizeof(buf), i * sizeof(buf)), sizeof(buf));
+        }
+        auto sequential = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 16; i++) {
+            auto at = ((i * 7) % 16) * sizeof(buf);
+            ASSERT_EQ(pread(fd, buf, sizeof(buf), at), sizeof(buf));
+        }
+        auto random = std::chrono::steady_clock::now() - start;
+
+        // 16 seeks, against the one the sequential pass started with
+        EXPECT_GE(random, 32ms);
+        EXPECT_LT(sequential, random / 2);
+        std::fclose(f);
+    }
+
+    TEST(Device, RejectsBadConfig) {
+        EXPECT_THROW(Device(-1us, 1000), std::invalid_argument);
+        EXPECT_THROW(Device(1ms, 0), std::invalid_argument);
+        EXPECT_THROW(Device(1ms, 1000, 0), std::invalid_argument);
+        EXPECT_THROW(
+            Device(1ms, 1000, Device::max_queue_depth + 1),
+            std::invalid_argument);
+        EXPECT_THROW(
+            Session(Plan(
+                {{SYS_fsync, served_by({1ms, 1000})}},
+                [](pid_t) { return true; },
+                thread_discovery::None{})),
+            std::invalid_argument);
+    }
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail_explore.hh>
+#include <thread>
+#include <unistd.h>
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    using namespace explore;
+
+    namespace {
+        // Each of the 4 getppid calls handles failure differently
+        bool body() {
+            if (syscall(SYS_getppid) == -1) abort();
+            if (syscall(SYS_getppid) == -1) return false;
+            if (syscall(SYS_getppid) == -1) std::this_thread::sleep_for(300ms);
+            if (syscall(SYS_getppid) == -1) {
+                while (true) std::this_thread::sleep_for(1s);
+            }
+            return true;
+        }
+    }
+
+    TEST(Explore, ClassifiesEachFaultPoint) {
+        auto r = run(
+            {.errors = {{SYS_getppid, EIO}},
+             .workers = 2,
+             .timeout = 1s,
+             .slowdown = 100},
+            body);
+
+        EXPECT_EQ(r.calls.at(SYS_getppid), 4);
+        EXPECT_EQ(r.runs, 4);
+        ASSERT_EQ(r.results.size(), 4);
+
+        std::vector<Verdict> verdicts;
+        for (uint64_t i = 0; i < 4; i++) {
+            EXPECT_EQ(r.results[i].points, (std::vector<Point>{{SYS_getppid, i}}));
+            verdicts.push_back(r.results[i].verdict);
+        }
+        EXPECT_EQ(
+            verdicts,
+            (std::vector<Verdict>{
+                Verdict::Crashed,
+                Verdict::Failed,
+                Verdict::Slow,
+                Verdict::Hung}));
+    }
+
+    TEST(Explore, ExploresPairsOfPoints) {
+        auto r = run(
+            {.errors = {{SYS_getppid, EIO}, {SYS_getpid, EPERM}},
+             .depth = 2,
+             .timeout = 5s},
+            []() {
+                auto a = syscall(SYS_getppid) == -1;
+                auto b = syscall(SYS_getppid) == -1;
+                syscall(SYS_getpid);
+                return !(a && b); // only fails if both calls fail
+            });
+
+        EXPECT_EQ(r.calls.at(SYS_getppid), 2);
+        EXPECT_EQ(r.calls.at(SYS_getpid), 1);
+        EXPECT_EQ(r.runs, 3 + 3);
+        ASSERT_EQ(r.results.size(), 1);
+        EXPECT_EQ(r.results[0].verdict, Verdict::Failed);
+        EXPECT_EQ(
+            r.results[0].points,
+            (std::vector<Point>{{SYS_getppid, 0}, {SYS_getppid, 1}}));
+    }
+
+    TEST(Explore, BranchesAtEachFaultPoint) {
+        auto r = branch(
+            {.errors = {{SYS_getppid, EIO}},
+             .workers = 2,
+             .timeout = 1s,
+             .slowdown = 100},
+            body);
+
+        EXPECT_EQ(r.calls.at(SYS_getppid), 4);
+        EXPECT_EQ(r.runs, 4);
+        EXPECT_EQ(r.skipped, 0);
+        ASSERT_EQ(r.results.size(), 4);
+
+        std::vector<Verdict> verdicts;
+        for (uint64_t i = 0; i < 4; i++) {
+            EXPECT_EQ(r.results[i].points, (std::vector<Point>{{SYS_getppid, i}}));
+            verdicts.push_back(r.results[i].verdict);
+        }
+        EXPECT_EQ(
+            verdicts,
+            (std::vector<Verdict>{
+                Verdict::Crashed,
+                Verdict::Failed,
+                Verdict::Slow,
+                Verdict::Hung}));
+    }
+
+    TEST(Explore, BranchesFollowThePathTaken) {
+        auto r = branch(
+            {.errors = {{SYS_getppid, EIO}, {SYS_getpid, EPERM}},
+             .depth = 2,
+             .workers = 8,
+             .timeout = 5s},
+            []() {
+                if (syscall(SYS_getpid) == -1) {
+                    // error path makes a call the fault-free path doesn't
+                    return syscall(SYS_getppid) != -1;
+                }
+                auto a = syscall(SYS_getppid) == -1;
+                auto b = syscall(SYS_getppid) == -1;
+                return !(a && b);
+            });
+
+        EXPECT_EQ(r.calls.at(SYS_getppid), 2);
+        EXPECT_EQ(r.calls.at(SYS_getpid), 1);
+        // singles: getpid#0, getppid#0, getppid#1
+        // pairs: (getpid#0, getppid#0), (getppid#0, getppid#1)
+        EXPECT_EQ(r.runs, 3 + 2);
+        ASSERT_EQ(r.results.size(), 2);
+        EXPECT_EQ(r.results[0].verdict, Verdict::Failed);
+        EXPECT_EQ(
+            r.results[0].points,
+            (std::vector<Point>{{SYS_getpid, 0}, {SYS_getppid, 0}}));
+        EXPECT_EQ(r.results[1].verdict, Verdict::Failed);
+        EXPECT_EQ(
+            r.results[1].points,
+            (std::vector<Point>{{SYS_getppid, 0}, {SYS_getppid, 1}}));
+    }
+
+    TEST(Explore, MinimizesFailingTrace) {
+        auto plan_for = [](const std::shared_ptr<const trace::Trace>& replay) {
+            return Plan(
+                { {SYS_getppid, {{1, 0}, {0, 0}, 0us, {{EIO, 1}}}} },
+                [](pid_t) { return true; },
+                thread_discovery::None{},
+                {.record = observe::Record{}},
+                1,
+                replay);
+        };
+        // fails only if both the 5th and the 37th call fail
+        auto body = []() {
+            std::vector<bool> failed;
+            for (int i = 0; i < 64; i++) {
+                failed.push_back(syscall(SYS_getppid) == -1);
+            }
+            return !(failed[5] && failed[37]);
+        };
+
+        trace::Trace t;
+        {
+            Session s(plan_for(nullptr));
+            EXPECT_FALSE(body());
+            t = s.recorded();
+        }
+        ASSERT_EQ(t.events.size(), 64);
+
+        auto m = minimize({.workers = 4, .timeout = 5s}, t, plan_for, body);
+        EXPECT_EQ(m.verdict, Verdict::Failed);
+        ASSERT_EQ(m.faults.events.size(), 2);
+        EXPECT_EQ(m.faults.events[0], t.events[5]);
+        EXPECT_EQ(m.faults.events[1], t.events[37]);
+        EXPECT_GT(m.runs, 2);
+
+        t.events.erase(t.events.begin() + 5);
+        EXPECT_THROW(
+            minimize({.workers = 4}, t, plan_for, body),
+            std::runtime_error);
+    }
+
+    TEST(Explore, RequiresPassingBaseline) {
+        EXPECT_THROW(
+            run({.errors = {{SYS_getppid, EIO}}}, []() { return false; }),
+            std::runtime_error);
+        EXPECT_THROW(
+            run({.errors = {}}, []() { return true; }),
+            std::invalid_argument);
+        EXPECT_THROW(
+            branch({.errors = {{SYS_getppid, EIO}}}, []() { return false; }),
+            std::runtime_error);
+        EXPECT_THROW(
+            branch(
+                {.errors = {{SYS_getppid, EIO}}, .depth = max_depth + 1},
+                []() { return true; }),
+            std::invalid_argument);
+    }
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fdtable.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    namespace {
+        struct TmpDir {
+            std::string path;
+
+            TmpDir() {
+                char tmpl[] = "/tmp/sysfail_fdtable.XXXXXX";
+                path = mkdtemp(tmpl);
+            }
+
+            ~TmpDir() {
+                std::filesystem::remove_all(path);
+            }
+        };
+
+        // Called after the fact, as the handler does
+        void returned(FdTable& t, Syscall call, greg_t ret, greg_t arg1) {
+            greg_t regs[NGREG] = {};
+            regs[REG_RAX] = ret;
+            regs[REG_RDI] = arg1;
+            t.observe(call, regs);
+        }
+
+        Outcome failing_on(const fds::Class& c) {
+            return {{1, 0}, {0, 0}, 0us, {{EIO, 1.0}}, nullptr,
+                    schedule::Constant{}, {}, std::nullopt, latency::Uniform{},
+                    std::nullopt, std::nullopt, std::nullopt, c};
+        }
+    }
+
+    TEST(FdTable, ClassifiesUnseenFdsOnLookup) {
+        TmpDir dir;
+        auto file = dir.path + "/f";
+        auto fd = open(file.c_str(), O_CREAT | O_WRONLY | O_APPEND, 0600);
+        ASSERT_GE(fd, 0);
+        int p[2];
+        ASSERT_EQ(pipe(p), 0);
+        auto sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        ASSERT_GE(sock, 0);
+
+        FdTable t;
+        auto e = t.lookup(fd);
+        EXPECT_EQ(FdTable::kind(e), fds::Kind::File);
+        EXPECT_EQ(FdTable::flags(e) & (O_WRONLY | O_APPEND), O_WRONLY | O_APPEND);
+        EXPECT_EQ(FdTable::path(e), 0);
+        EXPECT_EQ(FdTable::kind(t.lookup(p[0])), fds::Kind::Pipe);
+        EXPECT_EQ(FdTable::kind(t.lookup(sock)), fds::Kind::Socket);
+        auto d = open("/tmp", O_RDONLY);
+        EXPECT_EQ(FdTable::kind(t.lookup(d)), fds::Kind::Dir);
+        close(d);
+
+        // paths registered later are resolved on the next lookup
+        auto under_dir = t.compile({{}, {dir.path + "/"}});
+        auto elsewhere = t.compile({{}, {"/nonexistent"}});
+        EXPECT_TRUE(under_dir.matches(fd));
+        EXPECT_FALSE(elsewhere.matches(fd));
+        EXPECT_FALSE(under_dir.matches(p[0]));
+
+        close(fd);
+        returned(t, SYS_close, 0, fd);
+        EXPECT_EQ(t.lookup(fd), 0);
+        EXPECT_FALSE(under_dir.matches(fd));
+        close(p[0]);
+        close(p[1]);
+        close(sock);
+    }
+
+    TEST(FdTable, FollowsCreatedFds) {
+        FdTable t;
+        auto sockets = t.compile({{fds::Kind::Socket}});
+        // as the table saw them created, regardless of what they really are
+        returned(t, SYS_socket, 100, AF_INET);
+        EXPECT_TRUE(sockets.matches(100));
+        returned(t, SYS_dup, 101, 100);
+        EXPECT_TRUE(sockets.matches(101));
+        returned(t, SYS_close, 0, 100);
+        EXPECT_FALSE(sockets.matches(100));
+        EXPECT_TRUE(sockets.matches(101));
+        // failed calls create nothing
+        returned(t, SYS_socket, -EMFILE, AF_INET);
+        EXPECT_FALSE(sockets.matches(-EMFILE));
+
+        // a path the longest registered one is under matches too
+        TmpDir dir;
+        auto nested = dir.path + "/a";
+        std::filesystem::create_directory(nested);
+        auto inner = t.compile({{fds::Kind::File}, {nested}});
+        auto outer = t.compile({{fds::Kind::File}, {dir.path}});
+        auto fd = open((nested + "/f").c_str(), O_CREAT | O_RDWR, 0600);
+        ASSERT_GE(fd, 0);
+        EXPECT_TRUE(inner.matches(fd));
+        EXPECT_TRUE(outer.matches(fd));
+        EXPECT_FALSE(sockets.matches(fd));
+        close(fd);
+
+        // opened fds are what they are, not what the open flags suggest
+        // (nor what the fd number was before)
+        auto d = open(dir.path.c_str(), O_RDONLY);
+        ASSERT_GE(d, 0);
+        returned(t, SYS_socket, d, AF_INET);
+        returned(t, SYS_openat, d, AT_FDCWD);
+        EXPECT_EQ(FdTable::kind(t.lookup(d)), fds::Kind::Dir);
+        close(d);
+        returned(t, SYS_close, 0, d);
+    }
+
+    TEST(FdTable, KeepsNothingUntilAClassIsCompiled) {
+        FdTable t;
+        // fd 100 isn't open, only the table could say it's a socket
+        returned(t, SYS_socket, 100, AF_INET);
+        auto sockets = t.compile({{fds::Kind::Socket}});
+        EXPECT_FALSE(sockets.matches(100));
+        returned(t, SYS_socket, 100, AF_INET);
+        EXPECT_TRUE(sockets.matches(100));
+    }
+
+    TEST(FdTable, TargetsOutcomesInSession) {
+        TmpDir dir;
+        Session s(Plan(
+            {{SYS_write, failing_on({{fds::Kind::File}, {dir.path}})}},
+            [](pid_t) { return true; },
+            thread_discovery::None{}));
+
+        char c = 'x';
+        auto in = open((dir.path + "/in").c_str(), O_CREAT | O_WRONLY, 0600);
+        ASSERT_GE(in, 0);
+        EXPECT_EQ(write(in, &c, 1), -1);
+        EXPECT_EQ(errno, EIO);
+
+        auto out = open("/dev/null", O_WRONLY);
+        ASSERT_GE(out, 0);
+        EXPECT_EQ(write(out, &c, 1), 1);
+
+        // a dup of a file under the path is still under it
+        auto dup_in = dup(in);
+        EXPECT_EQ(write(dup_in, &c, 1), -1);
+
+        int p[2];
+        ASSERT_EQ(pipe(p), 0);
+        EXPECT_EQ(write(p[1], &c, 1), 1);
+
+        // fd number reused by a pipe, after the file was closed
+        close(in);
+        ASSERT_EQ(dup2(p[1], in), in);
+        EXPECT_EQ(write(in, &c, 1), 1);
+
+        for (auto fd : {in, out, dup_in, p[0], p[1]}) close(fd);
+    }
+
+    TEST(FdTable, RejectsBadConfig) {
+        EXPECT_THROW(fds::Class({}, {"data"}), std::invalid_argument);
+        EXPECT_THROW(
+            Session(Plan(
+                {{SYS_getppid, failing_on({{fds::Kind::Socket}})}},
+                [](pid_t) { return true; },
+                thread_discovery::None{})),
+            std::invalid_argument);
+    }
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <optional>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "glob.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    namespace {
+        bool matches(const PathGlobs& g, uint32_t outcome, const char* path) {
+            return g.matches(outcome, path, std::strlen(path));
+        }
+
+        Outcome failing_on(const std::vector<std::string>& paths) {
+            return {{1, 0}, {0, 0}, 0us, {{EACCES, 1.0}}, nullptr,
+                    schedule::Constant{}, {}, std::nullopt, latency::Uniform{},
+                    std::nullopt, std::nullopt, std::nullopt, std::nullopt,
+                    paths};
+        }
+    }
+
+    TEST(PathGlobs, MatchesGlobSyntax) {
+        PathGlobs g({
+            {"/data/*.sst"},
+            {"/data/**/MANIFEST-*", "**/tmp/?.log"},
+            {"/etc/[a-c]*", "/x/[!0-9]", "/lit\\*"}});
+
+        EXPECT_TRUE(matches(g, 0, "/data/000123.sst"));
+        EXPECT_FALSE(matches(g, 0, "/data/db/000123.sst")); // * stays put
+        EXPECT_FALSE(matches(g, 0, "/data/000123.sst.tmp"));
+        EXPECT_FALSE(matches(g, 1, "/data/000123.sst"));
+
+        EXPECT_TRUE(matches(g, 1, "/data/MANIFEST-000001"));
+        EXPECT_TRUE(matches(g, 1, "/data/db/cf/MANIFEST-000001"));
+        EXPECT_FALSE(matches(g, 1, "/data/dbMANIFEST-000001"));
+        EXPECT_TRUE(matches(g, 1, "tmp/a.log"));
+        EXPECT_TRUE(matches(g, 1, "/var/tmp/b.log"));
+        EXPECT_FALSE(matches(g, 1, "/var/tmp/bc.log"));
+        EXPECT_FALSE(matches(g, 1, "/var/tmp//.log"));
+
+        EXPECT_TRUE(matches(g, 2, "/etc/hosts") == false);
+        EXPECT_TRUE(matches(g, 2, "/etc/apt"));
+        EXPECT_TRUE(matches(g, 2, "/etc/cron.d"));
+        EXPECT_TRUE(matches(g, 2, "/x/a"));
+        EXPECT_FALSE(matches(g, 2, "/x/5"));
+        EXPECT_FALSE(matches(g, 2, "/x//"));
+        EXPECT_TRUE(matches(g, 2, "/lit*"));
+        EXPECT_FALSE(matches(g, 2, "/lite"));
+
+        // length bounds the path, as does NUL
+        EXPECT_TRUE(g.matches(0, "/data/1.sst-and-more", 11));
+        EXPECT_FALSE(g.matches(0, "/data/1.s\0st", 12));
+    }
+
+    TEST(PathGlobs, CompilesHundredsOfGlobs) {
+        std::vector<std::vector<std::string>> globs(2);
+        for (int i = 0; i < 300; i++) {
+            globs[i % 2].push_back(
+                "/data/shard" + std::to_string(i) + "/**/*.sst");
+        }
+        PathGlobs g(globs);
+        EXPECT_TRUE(matches(g, 1, "/data/shard7/cf/default/001.sst"));
+        EXPECT_FALSE(matches(g, 0, "/data/shard7/cf/default/001.sst"));
+        EXPECT_TRUE(matches(g, 0, "/data/shard298/001.sst"));
+        EXPECT_FALSE(matches(g, 0, "/data/shard300/001.sst"));
+    }
+
+    TEST(PathGlobs, ReadsPathArgumentSafely) {
+        // path ending right before an inaccessible page
+        auto pg = sysconf(_SC_PAGESIZE);
+        auto mem = static_cast<char*>(mmap(
+            nullptr,
+            2 * pg,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0));
+        ASSERT_NE(mem, MAP_FAILED);
+        ASSERT_EQ(mprotect(mem + pg, pg, PROT_NONE), 0);
+        const char path[] = "/data/1.sst";
+        auto at = mem + pg - sizeof(path);
+        std::memcpy(at, path, sizeof(path));
+
+        greg_t regs[NGREG] = {};
+        regs[REG_RAX] = SYS_openat;
+        regs[REG_RSI] = reinterpret_cast<greg_t>(at);
+        char buf[PathGlobs::max_path];
+        EXPECT_EQ(PathGlobs::read_path(regs, buf, sizeof(buf)), sizeof(path) - 1);
+        EXPECT_EQ(std::string(buf, sizeof(path) - 1), path);
+
+        regs[REG_RSI] = reinterpret_cast<greg_t>(mem + pg);
+        EXPECT_EQ(PathGlobs::read_path(regs, buf, sizeof(buf)), -1);
+        regs[REG_RSI] = 0;
+        EXPECT_EQ(PathGlobs::read_path(regs, buf, sizeof(buf)), -1);
+        regs[REG_RAX] = SYS_getppid;
+        EXPECT_EQ(PathGlobs::read_path(regs, buf, sizeof(buf)), -1);
+        munmap(mem, 2 * pg);
+    }
+
+    TEST(PathGlobs, TargetsOutcomesInSession) {
+        char tmpl[] = "/tmp/sysfail_glob.XXXXXX";
+        std::string dir = mkdtemp(tmpl);
+        std::optional<Session> s;
+        s.emplace(Plan(
+            {{SYS_openat, failing_on({dir + "/*.sst", dir + "/**/LOCK"})}},
+            [](pid_t) { return true; },
+            thread_discovery::None{}));
+
+        auto sst = open((dir + "/1.sst").c_str(), O_CREAT | O_RDWR, 0600);
+        EXPECT_EQ(sst, -1);
+        EXPECT_EQ(errno, EACCES);
+        auto lock = open((dir + "/LOCK").c_str(), O_CREAT | O_RDWR, 0600);
+        EXPECT_EQ(lock, -1);
+        auto log = open((dir + "/1.log").c_str(), O_CREAT | O_RDWR, 0600);
+        EXPECT_GE(log, 0);
+        close(log);
+
+        // a bad pointer isn't matched, the kernel reports it
+        EXPECT_EQ(syscall(SYS_openat, AT_FDCWD, 8, O_RDONLY), -1);
+        EXPECT_EQ(errno, EFAULT);
+
+        s->update(Plan(
+            {{SYS_openat, failing_on({})}},
+            [](pid_t) { return true; },
+            thread_discovery::None{}));
+        EXPECT_EQ(open((dir + "/1.log").c_str(), O_RDONLY), -1);
+        s.reset();
+        std::filesystem::remove_all(dir);
+    }
+
+    TEST(PathGlobs, RejectsBadConfig) {
+        EXPECT_THROW(PathGlobs({{"/data/[abc"}}), std::invalid_argument);
+        EXPECT_THROW(PathGlobs({{"/data/\\"}}), std::invalid_argument);
+        EXPECT_THROW(PathGlobs({{"/data/[z-a]"}}), std::invalid_argument);
+        EXPECT_THROW(
+            Session(Plan(
+                {{SYS_getppid, failing_on({"/data/*"})}},
+                [](pid_t) { return true; },
+                thread_discovery::None{})),
+            std::invalid_argument);
+    }
+}
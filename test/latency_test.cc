@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <sstream>
+
+#include "latency.hh"
+#include "rng.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    using namespace latency;
+
+    namespace {
+        double at(const Table& t, double u) {
+            return t.sample(u).count();
+        }
+
+        std::vector<int64_t> draw(const Table& t, size_t n) {
+            rng::Philox rnd(42);
+            std::uniform_real_distribution<double> u(0, 1);
+            std::vector<int64_t> out;
+            for (size_t i = 0; i < n; i++) {
+                out.push_back(t.sample(u(rnd)).count());
+            }
+            std::sort(out.begin(), out.end());
+            return out;
+        }
+    }
+
+    TEST(Latency, ExponentialQuantiles) {
+        Table t(Exponential(1000us), 0us);
+        EXPECT_EQ(at(t, 0), 0);
+        EXPECT_NEAR(at(t, 0.5), 1000 * std::log(2), 1);
+        EXPECT_NEAR(at(t, 0.99), 1000 * std::log(100), 2);
+        // tail comes from the finer levels
+        EXPECT_NEAR(at(t, 0.999), 1000 * std::log(1000), 2);
+        EXPECT_NEAR(at(t, 0.99999), 1000 * std::log(100000), 5);
+    }
+
+    TEST(Latency, LogNormalAndParetoQuantiles) {
+        Table ln(LogNormal(200us, 0.5), 0us);
+        EXPECT_NEAR(at(ln, 0.5), 200, 1);
+        // z(0.999) = 3.0902
+        EXPECT_NEAR(at(ln, 0.999), 200 * std::exp(0.5 * 3.0902), 2);
+
+        Table p(Pareto(100us, 1.5), 0us);
+        EXPECT_EQ(at(p, 0), 100);
+        EXPECT_NEAR(at(p, 0.999), 100 * std::pow(1000, 1 / 1.5), 2);
+    }
+
+    TEST(Latency, CapBoundsDelays) {
+        Table t(Pareto(100us, 1.1), 5000us);
+        EXPECT_EQ(at(t, 0.999999), 5000);
+        for (auto d : draw(t, 10000)) EXPECT_LE(d, 5000);
+
+        // uniform is the legacy [0, max_delay] band
+        Table u(Uniform{}, 400us);
+        EXPECT_EQ(at(u, 0), 0);
+        EXPECT_NEAR(at(u, 0.5), 200, 1);
+    }
+
+    TEST(Latency, UncappedTailsSaturate) {
+        Table t(Pareto(10us, 0.3), 0us);
+        EXPECT_EQ(t.sample(0.999999), Table::uncapped);
+        EXPECT_EQ(t.sample(0.9999999999), Table::uncapped);
+        for (auto d : draw(t, 10000)) {
+            EXPECT_GE(d, 10);
+            EXPECT_LE(d, Table::uncapped.count());
+        }
+    }
+
+    TEST(Latency, BimodalSplitsBetweenModes) {
+        Table t(Bimodal(LogNormal(50us, 0.2), LogNormal(5000us, 0.2), 0.1), 0us);
+        auto d = draw(t, 100000);
+        auto slow = std::count_if(
+            d.begin(),
+            d.end(),
+            [](auto v) { return v > 1000; });
+        EXPECT_NEAR(slow / 100000.0, 0.1, 0.01);
+        EXPECT_NEAR(d[d.size() / 2], 50, 10);
+    }
+
+    TEST(Latency, EmpiricalFromHistogram) {
+        std::stringstream in(
+            "# upper bound (us), count\n"
+            "100 90\n"
+            "\n"
+            "1000 9  # slow path\n"
+            "10000 1\n");
+        Table t(Empirical::load(in), 0us);
+        EXPECT_NEAR(at(t, 0.45), 50, 1);
+        EXPECT_NEAR(at(t, 0.85), 94.4, 1);
+        EXPECT_NEAR(at(t, 0.95), 600, 1);
+        EXPECT_NEAR(at(t, 0.995), 5500, 5);
+
+        std::stringstream bad("100 90\n50 1\n");
+        EXPECT_THROW(Empirical::load(bad), std::invalid_argument);
+        std::stringstream garbage("100 ninety\n");
+        EXPECT_THROW(Empirical::load(garbage), std::invalid_argument);
+    }
+
+    TEST(Latency, RejectsBadParameters) {
+        EXPECT_THROW(Exponential(0us), std::invalid_argument);
+        EXPECT_THROW(LogNormal(10us, 0), std::invalid_argument);
+        EXPECT_THROW(Pareto(10us, -1), std::invalid_argument);
+        EXPECT_THROW(
+            Bimodal(LogNormal(1us, 1), LogNormal(2us, 1), 1.5),
+            std::invalid_argument);
+        EXPECT_THROW(Empirical({{10us, 0}}), std::invalid_argument);
+    }
+
+    TEST(Latency, SessionInjectsDistributedDelays) {
+        Session s(Plan(
+            {{SYS_getppid, {
+                {0, 0},
+                {1, 0},
+                2000us,
+                {},
+                nullptr,
+                schedule::Constant{},
+                {},
+                std::nullopt,
+                Empirical({{1000us, 0}, {1500us, 1}})}}},
+            [](pid_t) { return true; },
+            thread_discovery::None{}));
+        for (int i = 0; i < 5; i++) {
+            auto start = std::chrono::steady_clock::now();
+            syscall(SYS_getppid);
+            EXPECT_GE(std::chrono::steady_clock::now() - start, 1000us);
+        }
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <unistd.h>
+
+#include "limit.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    TEST(Limit, TokenBucketRefillsAtRate) {
+        auto t = 10s;
+        TokenBucket b(10, t);
+        // starts with a second worth of burst
+        EXPECT_EQ(b.take(4, t), 4);
+        EXPECT_EQ(b.take(100, t), 6);
+        EXPECT_EQ(b.take(1, t), 0);
+        EXPECT_EQ(b.next_refill(), t + 100ms);
+
+        EXPECT_EQ(b.take(1, t + 99ms), 0);
+        EXPECT_EQ(b.take(5, t + 250ms), 2);
+        // the 50ms left over counts towards the next token
+        EXPECT_EQ(b.take(5, t + 300ms), 1);
+
+        // never holds more than a second worth
+        EXPECT_EQ(b.take(100, t + 1h), 10);
+    }
+
+    TEST(Limit, CapsFailureRateAcrossCachedBatches) {
+        auto t = 10s;
+        Limiter l(Limit(32), t);
+        TokenCache c1, c2;
+        int allowed = 0;
+        for (int i = 0; i < 100; i++) {
+            if (l.allow_failure(i % 2 ? &c1 : &c2, t)) allowed++;
+        }
+        EXPECT_EQ(allowed, 32);
+
+        // 1/4th of a second later, both caches draw from the refill
+        allowed = 0;
+        for (int i = 0; i < 100; i++) {
+            if (l.allow_failure(i % 2 ? &c1 : &c2, t + 250ms)) allowed++;
+        }
+        EXPECT_EQ(allowed, 8);
+    }
+
+    TEST(Limit, TruncatesDelayToAllowance) {
+        auto t = 10s;
+        Limiter l(Limit(0, 1000us), t);
+        TokenCache c;
+        EXPECT_EQ(l.allow_delay(&c, 600us, t), 600us);
+        EXPECT_EQ(l.allow_delay(&c, 600us, t), 400us);
+        EXPECT_EQ(l.allow_delay(&c, 600us, t), 0us);
+        EXPECT_EQ(l.allow_delay(&c, 600us, t + 100ms), 100us);
+
+        Limiter unlimited(Limit(0, 0us, 5), t);
+        EXPECT_EQ(unlimited.allow_delay(&c, 600us, t), 600us);
+
+        EXPECT_THROW(Limit(0, -1us), std::invalid_argument);
+    }
+
+    TEST(Limit, StopsInjectingOnceBudgetIsUsedUp) {
+        sysfail::Plan p(
+            { {SYS_getppid, {
+                1,
+                0,
+                0us,
+                {{EIO, 1}},
+                nullptr,
+                schedule::Constant{},
+                Limit(0, 0us, 5)}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        Session s(p);
+        int failed = 0;
+        for (int i = 0; i < 100; i++) {
+            if (syscall(SYS_getppid) == -1) failed++;
+        }
+        EXPECT_EQ(failed, 5);
+
+        // budget is per plan
+        s.update(p);
+        failed = 0;
+        for (int i = 0; i < 100; i++) {
+            if (syscall(SYS_getppid) == -1) failed++;
+        }
+        EXPECT_EQ(failed, 5);
+    }
+
+    TEST(Limit, RateLimitsInjectionInTheHandler) {
+        sysfail::Plan p(
+            { {SYS_getppid, {
+                1,
+                0,
+                0us,
+                {{EIO, 1}},
+                nullptr,
+                schedule::Constant{},
+                Limit(20)}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        Session s(p);
+        int failed = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < 200ms) {
+            if (syscall(SYS_getppid) == -1) failed++;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        // burst + refill (allowing for the coarse clock lagging a few ms)
+        EXPECT_GE(failed, 20);
+        EXPECT_LE(failed, 20 + 20 * (elapsed + 20ms) / 1s);
+    }
+}
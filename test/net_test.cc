@@ -0,0 +1,318 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    namespace {
+        sockaddr_in v4(const char* addr, uint16_t port) {
+            sockaddr_in sa{};
+            sa.sin_family = AF_INET;
+            sa.sin_port = htons(port);
+            inet_pton(AF_INET, addr, &sa.sin_addr);
+            return sa;
+        }
+
+        Peer peer(const char* addr, uint16_t port) {
+            if (std::string(addr).find(':') == std::string::npos) {
+                auto sa = v4(addr, port);
+                return *Peer::of(reinterpret_cast<sockaddr*>(&sa), sizeof(sa));
+            }
+            sockaddr_in6 sa{};
+            sa.sin6_family = AF_INET6;
+            sa.sin6_port = htons(port);
+            inet_pton(AF_INET6, addr, &sa.sin6_addr);
+            return *Peer::of(reinterpret_cast<sockaddr*>(&sa), sizeof(sa));
+        }
+
+        // latency of the link the peer is routed to, -1 => none
+        int64_t routed(const LinkTable& t, const char* addr, uint16_t port) {
+            auto l = t.route(peer(addr, port));
+            return l ? l->latency.count() : -1;
+        }
+
+        Outcome on(const std::vector<net::Link>& links) {
+            return {{0, 0}, {0, 0}, 0us, {}, nullptr,
+                    schedule::Constant{}, {}, std::nullopt, latency::Uniform{},
+                    std::nullopt, std::nullopt, std::nullopt, std::nullopt,
+                    {}, links};
+        }
+
+        Plan plan(const std::unordered_map<Syscall, const Outcome>& outcomes) {
+            return Plan(
+                outcomes,
+                [](pid_t) { return true; },
+                thread_discovery::None{});
+        }
+
+        // TCP listener on the address (any port), returns fd and address
+        std::pair<int, sockaddr_in> listener(const char* addr) {
+            auto fd = socket(AF_INET, SOCK_STREAM, 0);
+            auto sa = v4(addr, 0);
+            socklen_t len = sizeof(sa);
+            EXPECT_EQ(bind(fd, reinterpret_cast<sockaddr*>(&sa), len), 0);
+            EXPECT_EQ(listen(fd, 8), 0);
+            getsockname(fd, reinterpret_cast<sockaddr*>(&sa), &len);
+            return {fd, sa};
+        }
+
+        template <typename F> std::chrono::nanoseconds timed(F f) {
+            auto start = std::chrono::steady_clock::now();
+            f();
+            return std::chrono::steady_clock::now() - start;
+        }
+    }
+
+    TEST(Net, RoutesByLongestPrefix) {
+        PeerTable peers;
+        LinkTable t({
+                net::Link({"10.0.0.0/8"}, 1us),
+                net::Link({"10.1.0.0/16", "[::1]:7000"}, 2us),
+                net::Link({"10.1.2.3:80", "10.0.0.0/8:443"}, 3us),
+                net::Link({"fd00::/8"}, 4us)},
+            peers);
+
+        EXPECT_EQ(routed(t, "10.2.0.1", 1), 1);
+        EXPECT_EQ(routed(t, "10.1.9.9", 80), 2);
+        EXPECT_EQ(routed(t, "10.1.2.3", 80), 3);
+        EXPECT_EQ(routed(t, "10.1.2.3", 81), 2);
+        // the longer prefix wins over the port
+        EXPECT_EQ(routed(t, "10.1.2.3", 443), 2);
+        EXPECT_EQ(routed(t, "10.2.2.3", 443), 3);
+        EXPECT_EQ(routed(t, "11.0.0.1", 80), -1);
+        EXPECT_EQ(routed(t, "::1", 7000), 2);
+        EXPECT_EQ(routed(t, "::1", 7001), -1);
+        EXPECT_EQ(routed(t, "fd12::1", 1), 4);
+        EXPECT_EQ(routed(t, "fe00::1", 1), -1);
+        EXPECT_EQ(routed(t, "::ffff:10.9.0.1", 1), 1);
+
+        sockaddr sa{};
+        sa.sa_family = AF_UNIX;
+        EXPECT_FALSE(Peer::of(&sa, sizeof(sa)));
+    }
+
+    TEST(Net, TracksPeersOfSockets) {
+        auto [srv, addr] = listener("127.0.0.2");
+        // connected before the table saw it, looked up with getpeername
+        auto before = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(
+            connect(before, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+            0);
+
+        PeerTable peers;
+        greg_t regs[NGREG] = {};
+        // nothing is kept until the table is built (by a plan's links)
+        regs[REG_RAX] = before;
+        peers.observe(SYS_socket, regs);
+        EXPECT_TRUE(peers.lookup(before));
+        peers.build();
+
+        auto p = peers.lookup(before);
+        ASSERT_TRUE(p);
+        EXPECT_EQ(p->port, ntohs(addr.sin_port));
+        EXPECT_EQ(p->addr, peer("127.0.0.2", 0).addr);
+
+        auto udp = socket(AF_INET, SOCK_DGRAM, 0);
+        regs[REG_RAX] = udp;
+        peers.observe(SYS_socket, regs);
+        EXPECT_FALSE(peers.lookup(udp));
+
+        auto to = v4("127.0.0.5", 9);
+        ASSERT_EQ(connect(udp, reinterpret_cast<sockaddr*>(&to), sizeof(to)), 0);
+        regs[REG_RAX] = 0;
+        regs[REG_RDI] = udp;
+        regs[REG_RSI] = reinterpret_cast<greg_t>(&to);
+        regs[REG_RDX] = sizeof(to);
+        peers.observe(SYS_connect, regs);
+        p = peers.lookup(udp);
+        ASSERT_TRUE(p);
+        EXPECT_EQ(p->port, 9);
+
+        auto dup_fd = dup(udp);
+        regs[REG_RAX] = dup_fd;
+        peers.observe(SYS_dup, regs);
+        p = peers.lookup(dup_fd);
+        ASSERT_TRUE(p);
+        EXPECT_EQ(p->addr, peer("127.0.0.5", 0).addr);
+
+        close(udp);
+        regs[REG_RAX] = 0;
+        peers.observe(SYS_close, regs);
+        EXPECT_FALSE(peers.lookup(udp));
+
+        // accepted sockets are looked up on first use, whatever their fd
+        // number was before
+        sockaddr_in local{};
+        socklen_t len = sizeof(local);
+        ASSERT_EQ(
+            getsockname(before, reinterpret_cast<sockaddr*>(&local), &len),
+            0);
+        auto a = accept(srv, nullptr, nullptr);
+        ASSERT_GE(a, 0);
+        regs[REG_RAX] = a;
+        peers.observe(SYS_socket, regs);
+        EXPECT_FALSE(peers.lookup(a));
+        peers.observe(SYS_accept, regs);
+        p = peers.lookup(a);
+        ASSERT_TRUE(p);
+        EXPECT_EQ(p->port, ntohs(local.sin_port));
+
+        close(a);
+        close(dup_fd);
+        close(before);
+        close(srv);
+    }
+
+    TEST(Net, EmulatesLinkOverLoopback) {
+        auto [srv, addr] = listener("127.0.0.2");
+        auto slow = net::Link({"127.0.0.2"}, 100ms);
+        Session s(plan({
+            {SYS_connect, on({slow})},
+            {SYS_sendto, on({slow})},
+            {SYS_recvfrom, on({slow})}}));
+
+        auto c = socket(AF_INET, SOCK_STREAM, 0);
+        EXPECT_GE(timed([&] {
+            EXPECT_EQ(
+                connect(c, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+                0);
+        }), 100ms);
+        auto a = accept(srv, nullptr, nullptr);
+        ASSERT_GE(a, 0);
+
+        char buf[4] = {};
+        EXPECT_GE(timed([&] { EXPECT_EQ(send(c, "ping", 4, 0), 4); }), 100ms);
+        // the accepted end's peer is 127.0.0.1, not on the link
+        EXPECT_LT(timed([&] { EXPECT_EQ(recv(a, buf, 4, 0), 4); }), 100ms);
+        EXPECT_LT(timed([&] { EXPECT_EQ(send(a, "pong", 4, 0), 4); }), 100ms);
+        EXPECT_GE(timed([&] { EXPECT_EQ(recv(c, buf, 4, 0), 4); }), 100ms);
+        EXPECT_EQ(std::string(buf, 4), "pong");
+
+        close(a);
+        close(srv);
+    }
+
+    TEST(Net, PartitionsPeer) {
+        auto [srv, addr] = listener("127.0.0.1");
+        auto dial = [&](const char* from) {
+            auto c = socket(AF_INET, SOCK_STREAM, 0);
+            auto local = v4(from, 0);
+            bind(c, reinterpret_cast<sockaddr*>(&local), sizeof(local));
+            EXPECT_EQ(
+                connect(c, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+                0);
+            return std::pair{c, accept(srv, nullptr, nullptr)};
+        };
+        // accepted before the session, found by getpeername
+        auto [c0, a0] = dial("127.0.0.3");
+
+        auto cut = net::Link({"127.0.0.3"}, 0us, 0us, 1, ECONNRESET);
+        Session s(plan({
+            {SYS_sendto, on({cut})},
+            {SYS_sendmsg, on({cut})},
+            {SYS_recvfrom, on({cut})}}));
+        auto [c1, a1] = dial("127.0.0.3");
+        auto [c2, a2] = dial("127.0.0.4");
+
+        char buf[4];
+        for (auto a : {a0, a1, dup(a1)}) {
+            EXPECT_EQ(send(a, "ping", 4, 0), -1);
+            EXPECT_EQ(errno, ECONNRESET);
+            EXPECT_EQ(recv(a, buf, 4, MSG_DONTWAIT), -1);
+            EXPECT_EQ(errno, ECONNRESET);
+        }
+        EXPECT_EQ(send(a2, "ping", 4, 0), 4);
+        EXPECT_EQ(recv(c2, buf, 4, 0), 4);
+
+        // datagrams by destination
+        auto udp = socket(AF_INET, SOCK_DGRAM, 0);
+        auto send_to = [&](const char* host) {
+            auto to = v4(host, 9);
+            iovec iov{const_cast<char*>("ping"), 4};
+            msghdr m{};
+            m.msg_name = &to;
+            m.msg_namelen = sizeof(to);
+            m.msg_iov = &iov;
+            m.msg_iovlen = 1;
+            return sendmsg(udp, &m, 0);
+        };
+        EXPECT_EQ(send_to("127.0.0.3"), -1);
+        EXPECT_EQ(errno, ECONNRESET);
+        EXPECT_EQ(send_to("127.0.0.4"), 4);
+
+        for (auto fd : {c0, a0, c1, a1, c2, a2, udp, srv}) close(fd);
+    }
+
+    TEST(Net, DropsCallsAtLossRate) {
+        auto lossy = net::Link({"127.0.0.0/8"}, 0us, 0us, 0.5, ETIMEDOUT);
+        Session s(plan({{SYS_sendto, on({lossy})}}));
+        auto udp = socket(AF_INET, SOCK_DGRAM, 0);
+        auto to = v4("127.0.0.6", 9);
+        int lost = 0;
+        for (int i = 0; i < 400; i++) {
+            auto r = sendto(
+                udp,
+                "x",
+                1,
+                0,
+                reinterpret_cast<sockaddr*>(&to),
+                sizeof(to));
+            if (r < 0) {
+                EXPECT_EQ(errno, ETIMEDOUT);
+                lost++;
+            }
+        }
+        EXPECT_GT(lost, 120);
+        EXPECT_LT(lost, 280);
+        close(udp);
+    }
+
+    TEST(Net, RejectsBadConfig) {
+        for (auto p : {"10.0.0.0/33", "300.1.1.1", "[::1", "10.0.0.1:0",
+                       "10.0.0.1:70000", "10.0.0.1x", "[::1]/129", "::1/8:x",
+                       ""}) {
+            EXPECT_THROW(net::Link({p}, 1ms), std::invalid_argument) << p;
+        }
+        EXPECT_THROW(net::Link({}, 1ms), std::invalid_argument);
+        EXPECT_THROW(net::Link({"::1"}, -1ms), std::invalid_argument);
+        EXPECT_THROW(net::Link({"::1"}, 1ms, 0us, 1.5), std::invalid_argument);
+        EXPECT_THROW(
+            net::Link({"::1"}, 1ms, 0us, 1, 0),
+            std::invalid_argument);
+
+        PeerTable peers;
+        EXPECT_THROW(
+            LinkTable(
+                {net::Link({"10.0.0.0/8"}, 1ms),
+                 net::Link({"10.1.0.0/8"}, 2ms)},
+                peers),
+            std::invalid_argument);
+        EXPECT_THROW(
+            Session(plan({{SYS_read, on({net::Link({"::1"}, 1ms)})}})),
+            std::invalid_argument);
+    }
+}
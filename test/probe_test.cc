@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "sysfail.h"
+}
+
+using namespace testing;
+
+namespace sysfail {
+    struct ProbeNote {
+        std::string provider;
+        std::string name;
+        std::string args;
+    };
+
+    // Reads .note.stapsdt of the ELF object that defines `sym`
+    std::vector<ProbeNote> probe_notes(void* sym) {
+        Dl_info info;
+        EXPECT_NE(dladdr(sym, &info), 0);
+        std::ifstream in(info.dli_fname, std::ios::binary);
+        std::vector<char> elf(
+            (std::istreambuf_iterator<char>(in)),
+            std::istreambuf_iterator<char>());
+
+        auto ehdr = reinterpret_cast<const Elf64_Ehdr*>(elf.data());
+        auto shdrs = reinterpret_cast<const Elf64_Shdr*>(
+            elf.data() + ehdr->e_shoff);
+        auto shstr = elf.data() + shdrs[ehdr->e_shstrndx].sh_offset;
+
+        std::vector<ProbeNote> notes;
+        for (int i = 0; i < ehdr->e_shnum; i++) {
+            if (std::strcmp(shstr + shdrs[i].sh_name, ".note.stapsdt")) continue;
+            auto p = elf.data() + shdrs[i].sh_offset;
+            auto end = p + shdrs[i].sh_size;
+            while (p < end) {
+                auto nhdr = reinterpret_cast<const Elf64_Nhdr*>(p);
+                auto desc = p + sizeof(*nhdr) + ((nhdr->n_namesz + 3) & ~3);
+                EXPECT_EQ(nhdr->n_type, 3);
+                // pc, base and semaphore addresses precede the strings
+                auto s = desc + 3 * sizeof(uint64_t);
+                ProbeNote n;
+                n.provider = s;
+                s += n.provider.size() + 1;
+                n.name = s;
+                s += n.name.size() + 1;
+                n.args = s;
+                notes.push_back(n);
+                p = desc + ((nhdr->n_descsz + 3) & ~3);
+            }
+        }
+        return notes;
+    }
+
+    TEST(Probe, LibraryCarriesUSDTNotes) {
+        auto notes = probe_notes(reinterpret_cast<void*>(&sysfail_start));
+
+        std::map<std::string, int> arg_count;
+        for (const auto& n : notes) {
+            EXPECT_EQ(n.provider, "sysfail");
+            std::istringstream args(n.args);
+            std::string arg;
+            int count = 0;
+            while (args >> arg) {
+                EXPECT_EQ(arg.substr(0, 3), "-8@") << n.name << ": " << n.args;
+                count++;
+            }
+            arg_count[n.name] = count;
+        }
+
+        std::map<std::string, int> expected{
+            {"decide", 5},
+            {"thd_enable", 2},
+            {"thd_disable", 2},
+            {"disarm", 1},
+            {"rearm", 1},
+            {"queued", 3},
+            {"scan", 5}};
+        EXPECT_EQ(arg_count, expected);
+    }
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <mutex>
+#include <thread>
+
+#include "queue.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    namespace {
+        Outcome queued(const Concurrency& c) {
+            return {{0, 0}, {0, 0}, 0us, {}, nullptr, schedule::Constant{},
+                    {}, std::nullopt, latency::Uniform{}, std::nullopt,
+                    std::nullopt, c};
+        }
+
+        Plan plan(
+            const std::unordered_map<Syscall, const Outcome>& outcomes
+        ) {
+            return Plan(
+                outcomes,
+                [](pid_t) { return true; },
+                thread_discovery::None{});
+        }
+
+        // Time `threads` threads take to sleep `d` each, in the session
+        std::chrono::nanoseconds sleep_in(
+            Session& s,
+            int threads,
+            std::chrono::milliseconds d
+        ) {
+            std::vector<std::thread> thds;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < threads; i++) {
+                thds.emplace_back([&]() {
+                    s.add();
+                    std::this_thread::sleep_for(d);
+                    s.remove();
+                });
+            }
+            for (auto& t : thds) t.join();
+            return std::chrono::steady_clock::now() - start;
+        }
+    }
+
+    TEST(Queue, LetsCallersInFirstComeFirstServed) {
+        Semaphore q(1);
+        EXPECT_EQ(q.acquire(), 0ns);
+
+        std::mutex mtx;
+        std::vector<int> order;
+        std::vector<std::thread> thds;
+        for (int i = 0; i < 4; i++) {
+            thds.emplace_back([&, i]() {
+                auto waited = q.acquire();
+                EXPECT_GT(waited, 0ns);
+                {
+                    std::lock_guard<std::mutex> l(mtx);
+                    order.push_back(i);
+                }
+                q.release();
+            });
+            // let it take its ticket before the next one arrives
+            std::this_thread::sleep_for(10ms);
+        }
+        q.release();
+        for (auto& t : thds) t.join();
+        EXPECT_EQ(order, std::vector<int>({0, 1, 2, 3}));
+    }
+
+    TEST(Queue, ResizeLetsWaitersIn) {
+        Semaphore q(1);
+        q.acquire();
+        std::atomic<bool> in = false;
+        std::thread t([&]() {
+            q.acquire();
+            in = true;
+        });
+        std::this_thread::sleep_for(10ms);
+        EXPECT_FALSE(in);
+        q.resize(2);
+        t.join();
+        EXPECT_TRUE(in);
+    }
+
+    TEST(Queue, SerializesCallsInSession) {
+        Session s(plan({{SYS_clock_nanosleep, queued({1})}}));
+        EXPECT_GE(sleep_in(s, 4, 20ms), 80ms);
+
+        // the same queue, let through 4 at a time now
+        s.update(plan({{SYS_clock_nanosleep, queued({4})}}));
+        EXPECT_LT(sleep_in(s, 4, 20ms), 60ms);
+    }
+
+    TEST(Queue, SharedByName) {
+        Session s(plan({
+            {SYS_clock_nanosleep, queued({1, "sleep"})},
+            {SYS_nanosleep, queued({1, "sleep"})}}));
+        auto start = std::chrono::steady_clock::now();
+        std::thread t([&]() {
+            s.add();
+            timespec ts{0, 40'000'000};
+            nanosleep(&ts, nullptr);
+            s.remove();
+        });
+        std::this_thread::sleep_for(5ms);
+        s.add();
+        std::this_thread::sleep_for(10ms);
+        s.remove();
+        t.join();
+        // one after the other (in whichever order), rather than overlapping
+        EXPECT_GE(std::chrono::steady_clock::now() - start, 48ms);
+    }
+
+    TEST(Queue, RejectsBadConfig) {
+        EXPECT_THROW(Concurrency(0), std::invalid_argument);
+        EXPECT_THROW(
+            Session(plan({
+                {SYS_read, queued({1, "disk"})},
+                {SYS_write, queued({2, "disk"})}})),
+            std::invalid_argument);
+    }
+}
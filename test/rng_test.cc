@@ -0,0 +1,106 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <thread>
+#include <unistd.h>
+
+#include "rng.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    using rng::Block;
+    using rng::Philox;
+
+    TEST(Rng, PhiloxMatchesKnownAnswers) {
+        // Random123 known-answer vectors
+        EXPECT_EQ(
+            rng::philox({0, 0, 0, 0}, {0, 0}),
+            (Block{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+        EXPECT_EQ(
+            rng::philox(
+                {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+                {0xffffffff, 0xffffffff}),
+            (Block{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}));
+        EXPECT_EQ(
+            rng::philox(
+                {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+                {0xa4093822, 0x299f31d0}),
+            (Block{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}));
+    }
+
+    TEST(Rng, StreamsAreAddressedByCounter) {
+        Philox a(42, 3, 7), b(42, 3, 7);
+        std::vector<uint32_t> drawn;
+        for (int i = 0; i < 10; i++) {
+            drawn.push_back(a());
+            EXPECT_EQ(drawn.back(), b());
+        }
+        // 3rd block of the stream, computed directly
+        auto blk = rng::philox({2, 7, 0, 3}, {42, 0});
+        EXPECT_EQ(drawn[8], blk[0]);
+        EXPECT_EQ(drawn[9], blk[1]);
+
+        EXPECT_NE(Philox(42, 3, 8)(), drawn[0]);
+        EXPECT_NE(Philox(42, 4, 7)(), drawn[0]);
+        EXPECT_NE(Philox(43, 3, 7)(), drawn[0]);
+    }
+
+    namespace {
+        std::vector<bool> failure_pattern(uint64_t seed, uint64_t* used) {
+            sysfail::Plan p(
+                { {SYS_getppid, {{0.5, 0}, {0, 0}, 0us, {{EIO, 1}}}} },
+                [](pid_t tid) { return true; },
+                thread_discovery::None{},
+                {},
+                seed);
+            Session s(p);
+            if (used) *used = s.seed();
+
+            std::vector<bool> failed;
+            for (int i = 0; i < 200; i++) {
+                failed.push_back(syscall(SYS_getppid) == -1);
+            }
+            return failed;
+        }
+    }
+
+    TEST(Rng, SeedReproducesInjectionDecisions) {
+        auto pattern = failure_pattern(1234, nullptr);
+        EXPECT_GT(std::count(pattern.begin(), pattern.end(), true), 50);
+        EXPECT_LT(std::count(pattern.begin(), pattern.end(), true), 150);
+
+        // other threads (and their syscalls) don't perturb the pattern
+        std::atomic<bool> stop{false};
+        std::thread noise([&]() {
+            while (!stop) syscall(SYS_getppid);
+        });
+        EXPECT_EQ(failure_pattern(1234, nullptr), pattern);
+        stop = true;
+        noise.join();
+
+        EXPECT_NE(failure_pattern(4321, nullptr), pattern);
+
+        // random seed is reported, and reproduces the run
+        uint64_t seed = 0;
+        auto random = failure_pattern(0, &seed);
+        EXPECT_NE(seed, 0);
+        EXPECT_EQ(failure_pattern(seed, nullptr), random);
+    }
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Multi-thread scalability benchmark: 1 to N threads doing trapped syscalls
+// (in the plan, p=0) and periodically spawning a short-lived thread, which
+// takes the rt_sigprocmask disarm / rearm path. Contention on session-wide
+// state shows up as throughput flattening and p99 growing with threads.
+//
+// Usage: scale_bench [-t <max-threads>] [-d <ms-per-point>]
+//                    [-s <calls-between-spawns>]
+//
+// Latency percentiles are computed per thread, the columns show the median
+// (and for p99 also the worst) across threads.
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sysfail.hh>
+
+using namespace std::chrono_literals;
+
+namespace {
+    // Log-linear latency histogram (8 sub-buckets per power of 2), so
+    // percentiles are within 12.5% without storing samples
+    class Histogram {
+        static constexpr int sub_bits = 3;
+        static constexpr int buckets = 64 << sub_bits;
+        uint64_t counts[buckets] = {};
+        uint64_t total = 0;
+
+        static int bucket(uint64_t ns) {
+            if (ns < (1 << sub_bits)) return ns;
+            int msb = 63 - std::countl_zero(ns);
+            int sub = (ns >> (msb - sub_bits)) & ((1 << sub_bits) - 1);
+            return ((msb - sub_bits + 1) << sub_bits) + sub;
+        }
+
+        static uint64_t lower_bound(int b) {
+            if (b < (1 << sub_bits)) return b;
+            int msb = (b >> sub_bits) + sub_bits - 1;
+            uint64_t sub = b & ((1 << sub_bits) - 1);
+            return (1ULL << msb) | (sub << (msb - sub_bits));
+        }
+
+    public:
+        void add(uint64_t ns) {
+            counts[bucket(ns)]++;
+            total++;
+        }
+
+        uint64_t percentile(double q) const {
+            uint64_t seen = 0;
+            auto want = static_cast<uint64_t>(q * total);
+            for (int b = 0; b < buckets; b++) {
+                seen += counts[b];
+                if (seen > want) return lower_bound(b);
+            }
+            return 0;
+        }
+    };
+
+    struct Result {
+        double mcalls_per_sec;
+        double spawns_per_sec;
+        uint64_t p50;
+        uint64_t p99;
+        uint64_t p99_max;
+    };
+
+    Result run(
+        sysfail::Session& s,
+        int threads,
+        std::chrono::milliseconds duration,
+        uint64_t spawn_every
+    ) {
+        std::atomic<bool> stop{false};
+        std::vector<uint64_t> ops(threads), spawns(threads);
+        std::vector<std::unique_ptr<Histogram>> hists;
+        for (int t = 0; t < threads; t++) {
+            hists.push_back(std::make_unique<Histogram>());
+        }
+        std::barrier start(threads + 1);
+        std::barrier done(threads + 1);
+
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                auto& h = *hists[t];
+                s.add();
+                start.arrive_and_wait();
+                uint64_t n = 0, spawned = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    auto begin = std::chrono::steady_clock::now();
+                    getppid();
+                    auto end = std::chrono::steady_clock::now();
+                    h.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        end - begin).count());
+                    if (spawn_every && ++n % spawn_every == 0) {
+                        std::thread([]() {}).join();
+                        spawned++;
+                    }
+                }
+                ops[t] = n;
+                spawns[t] = spawned;
+                s.remove();
+                done.arrive_and_wait();
+            });
+        }
+
+        start.arrive_and_wait();
+        auto begin = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(duration);
+        stop = true;
+        auto end = std::chrono::steady_clock::now();
+        done.arrive_and_wait();
+        for (auto& w : workers) w.join();
+
+        uint64_t total = 0, total_spawns = 0;
+        std::vector<uint64_t> p50s, p99s;
+        for (int t = 0; t < threads; t++) {
+            total += ops[t];
+            total_spawns += spawns[t];
+            p50s.push_back(hists[t]->percentile(0.5));
+            p99s.push_back(hists[t]->percentile(0.99));
+        }
+        std::sort(p50s.begin(), p50s.end());
+        std::sort(p99s.begin(), p99s.end());
+        std::chrono::duration<double> secs = end - begin;
+        return {
+            total / secs.count() / 1e6,
+            total_spawns / secs.count(),
+            p50s[threads / 2],
+            p99s[threads / 2],
+            p99s.back()
+        };
+    }
+
+    void usage(const char* prog) {
+        fprintf(
+            stderr,
+            "Usage: %s [-t <max-threads>] [-d <ms-per-point>] "
+            "[-s <calls-between-spawns>]\n",
+            prog);
+    }
+}
+
+int main(int argc, char** argv) {
+    int max_threads = 128;
+    auto duration = 500ms;
+    uint64_t spawn_every = 10000;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:d:s:h")) != -1) {
+        switch (opt) {
+            case 't':
+                max_threads = std::stoi(optarg);
+                break;
+            case 'd':
+                duration = std::chrono::milliseconds(std::stol(optarg));
+                break;
+            case 's':
+                spawn_every = std::stoull(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (max_threads < 1 || duration.count() <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto main_tid = gettid();
+    sysfail::Plan p(
+        { {SYS_getppid, {{0, 0}, {0, 0}, 0us, {{EIO, 1}}}} },
+        [=](pid_t tid) { return tid != main_tid; },
+        sysfail::thread_discovery::None{});
+    sysfail::Session s(p);
+
+    printf(
+        "%8s %12s %10s %10s %10s %12s\n",
+        "THREADS",
+        "Mcalls/s",
+        "p50(ns)",
+        "p99(ns)",
+        "p99max(ns)",
+        "spawns/s");
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+    for (auto t : thread_counts) {
+        auto r = run(s, t, duration, spawn_every);
+        printf(
+            "%8d %12.3f %10lu %10lu %10lu %12.0f\n",
+            t,
+            r.mcalls_per_sec,
+            r.p50,
+            r.p99,
+            r.p99_max,
+            r.spawns_per_sec);
+        fflush(stdout);
+    }
+    return 0;
+}
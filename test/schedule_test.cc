@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <thread>
+#include <unistd.h>
+
+#include "schedule.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    using namespace schedule;
+
+    TEST(Schedule, RampsLinearly) {
+        Schedule s = Ramp(0.2, 1, 10s);
+        EXPECT_DOUBLE_EQ(level(s, 0s), 0.2);
+        EXPECT_DOUBLE_EQ(level(s, 5s), 0.6);
+        EXPECT_DOUBLE_EQ(level(s, 10s), 1);
+        EXPECT_DOUBLE_EQ(level(s, 1h), 1);
+
+        EXPECT_THROW(Ramp(0, 1.5, 1s), std::invalid_argument);
+        EXPECT_THROW(Ramp(0, 1, 0s), std::invalid_argument);
+    }
+
+    TEST(Schedule, SquareWaveOutages) {
+        // 30s outage every 10 min, first one 1 min in
+        Schedule s = Square(30s, 10min, 1min);
+        EXPECT_EQ(level(s, 0s), 0);
+        EXPECT_EQ(level(s, 1min), 1);
+        EXPECT_EQ(level(s, 1min + 29s), 1);
+        EXPECT_EQ(level(s, 1min + 30s), 0);
+        EXPECT_EQ(level(s, 11min + 10s), 1);
+        EXPECT_EQ(level(s, 10min), 0);
+
+        EXPECT_THROW(Square(2s, 1s), std::invalid_argument);
+    }
+
+    TEST(Schedule, StepsRepeatWithPeriod) {
+        Schedule s = Steps({{1s, 0.5}, {3s, 1}, {4s, 0}}, 5s);
+        EXPECT_EQ(level(s, 0s), 0);
+        EXPECT_EQ(level(s, 1s), 0.5);
+        EXPECT_EQ(level(s, 2s), 0.5);
+        EXPECT_EQ(level(s, 3500ms), 1);
+        EXPECT_EQ(level(s, 4s), 0);
+        EXPECT_EQ(level(s, 6s), 0.5);
+
+        Schedule once = Steps({{0s, 0.1}, {1s, 0.7}});
+        EXPECT_EQ(level(once, 1h), 0.7);
+
+        EXPECT_THROW(Steps({{2s, 0.5}, {1s, 1}}), std::invalid_argument);
+    }
+
+    TEST(Schedule, PoissonIncidentWindows) {
+        Schedule s = resolve(Incidents(10min, 30s, 42), 7);
+        int on = 0, slots = 100000;
+        for (int i = 0; i < slots; i++) {
+            auto l = level(s, i * 30s + 15s);
+            EXPECT_EQ(l, level(s, i * 30s)); // whole slot is on or off
+            if (l) on++;
+        }
+        // 1 - e^(-30s / 10min) of slots
+        EXPECT_NEAR(on, slots * 0.04877, slots * 0.004);
+
+        // same seed, same incidents
+        Schedule same = Incidents(10min, 30s, 42);
+        Schedule other = resolve(Incidents(10min, 30s), 7);
+        int differ = 0;
+        for (int i = 0; i < 1000; i++) {
+            EXPECT_EQ(level(s, i * 30s), level(same, i * 30s));
+            if (level(s, i * 30s) != level(other, i * 30s)) differ++;
+        }
+        EXPECT_GT(differ, 0);
+    }
+
+    TEST(Schedule, ScalesInjectionInTheHandler) {
+        sysfail::Plan p(
+            { {SYS_getppid, {
+                1,
+                0,
+                0us,
+                {{EIO, 1}},
+                nullptr,
+                Steps({{0ms, 0}, {100ms, 1}})}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        Session s(p);
+        for (int i = 0; i < 10; i++) {
+            EXPECT_EQ(syscall(SYS_getppid), getppid());
+        }
+        std::this_thread::sleep_for(150ms);
+        for (int i = 0; i < 10; i++) {
+            EXPECT_EQ(syscall(SYS_getppid), -1);
+        }
+
+        // schedule restarts with an update
+        s.update(p);
+        EXPECT_EQ(syscall(SYS_getppid), getppid());
+    }
+}
@@ -192,7 +192,11 @@ namespace sysfail {
                 std::binomial_distribution<bool> rw_dist;
                 auto reader = rw_dist(rnd_eng);
                 auto disable_explicitly = rw_dist(rnd_eng);
-                threads.push_back(std::thread([&]() {
+                threads.push_back(std::thread([
+                    &,
+                    reader,
+                    disable_explicitly
+                ]() {
                     if (await_thread_disc == 0ms) {
                         s.add();
                     } else {
@@ -843,4 +847,241 @@ namespace sysfail {
             ASSERT_VALUE(p2.read(), 40);
         }
     }
+
+    TEST(Session, CalibratesInterceptionOverhead) {
+        auto self = gettid();
+        sysfail::Plan p(
+            { {SYS_getppid, {1, 0, 0us, {{EIO, 1}}}} },
+            [&](pid_t tid) { return tid == self; },
+            thread_discovery::None{},
+            {.calibrate = observe::Calibrate{1000, 10}});
+
+        Session s(p);
+        auto o = s.overhead();
+        EXPECT_GT(o.raw.median.count(), 0);
+        EXPECT_GT(o.trap.median.count(), 0);
+        EXPECT_GT(o.toggle.median.count(), 0);
+        EXPECT_GE(o.raw.p99, o.raw.median);
+        EXPECT_GE(o.trap.p99, o.trap.median);
+        EXPECT_GE(o.toggle.p99, o.toggle.median);
+
+        // calibration leaves the thread as the plan would have it
+        EXPECT_EQ(::syscall(SYS_getppid), -1);
+        s.remove();
+        EXPECT_EQ(::syscall(SYS_getppid), getppid());
+    }
+
+    TEST(Session, CalibratesRegardlessOfSelectorWithoutTrace) {
+        {
+            // calling thread isn't selected, but is calibrated on anyway
+            sysfail::Plan p(
+                {},
+                [](pid_t tid) { return false; },
+                thread_discovery::None{},
+                {.calibrate = observe::Calibrate{1000, 10}});
+            Session s(p);
+            // a trap costs well over a getppid
+            EXPECT_GT(s.overhead().trap.median, s.overhead().raw.median);
+            EXPECT_EQ(::syscall(SYS_getppid), getppid());
+        }
+
+        auto self = gettid();
+        sysfail::Plan p(
+            { {SYS_getppid, {1, 0, 0us, {{EIO, 1}}}} },
+            [&](pid_t tid) { return tid == self; },
+            thread_discovery::None{},
+            {.calibrate = observe::Calibrate{1000, 10},
+             .record = observe::Record{}});
+        Session s(p);
+        EXPECT_EQ(::syscall(SYS_getppid), -1);
+        s.remove();
+        // calibration took no ordinal and made no decisions
+        auto t = s.recorded();
+        ASSERT_EQ(t.events.size(), 1);
+        EXPECT_EQ(t.events[0].thread, 0);
+        EXPECT_EQ(t.events[0].index, 0);
+    }
+
+    TEST(Session, OverheadRequiresCalibration) {
+        Session s({});
+        EXPECT_THROW(s.overhead(), std::logic_error);
+        EXPECT_THROW(observe::Calibrate(0), std::invalid_argument);
+    }
+
+    TEST(Session, UpdatesOutcomesOfLiveSession) {
+        auto fails_with = [](Errno e) {
+            return sysfail::Plan(
+                { {SYS_getppid, {1, 0, 0us, {{e, 1}}}} },
+                [](pid_t tid) { return false; },
+                thread_discovery::None{});
+        };
+
+        sysfail::Plan p(
+            { {SYS_getppid, {1, 0, 0us, {{EIO, 1}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+        Session s(p);
+        EXPECT_EQ(::syscall(SYS_getppid), -1);
+        EXPECT_EQ(errno, EIO);
+
+        // selector of the update is not used, thread stays failure-injected
+        s.update(fails_with(EPERM));
+        EXPECT_EQ(::syscall(SYS_getppid), -1);
+        EXPECT_EQ(errno, EPERM);
+
+        s.update({});
+        EXPECT_EQ(::syscall(SYS_getppid), getppid());
+    }
+
+    TEST(Session, UpdatesOutcomesWhileThreadsInjectFailures) {
+        auto fails_with = [](Errno e) {
+            return sysfail::Plan(
+                { {SYS_getppid, {1, 0, 0us, {{e, 1}}}} },
+                [](pid_t tid) { return true; },
+                thread_discovery::None{});
+        };
+
+        auto main_tid = gettid();
+        sysfail::Plan p(
+            { {SYS_getppid, {1, 0, 0us, {{EIO, 1}}}} },
+            [=](pid_t tid) { return tid != main_tid; },
+            thread_discovery::None{});
+        Session s(p);
+
+        std::vector<std::unordered_map<Errno, int>> seen(4);
+        std::barrier ready(seen.size() + 1);
+        std::vector<std::thread> thds;
+        for (auto& errs : seen) {
+            thds.emplace_back([&]() {
+                s.add();
+                ready.arrive_and_wait();
+                // EAGAIN is only injected after the last update
+                while (!errs.contains(EAGAIN)) {
+                    if (::syscall(SYS_getppid) < 0) errs[errno]++;
+                }
+                s.remove();
+            });
+        }
+        ready.arrive_and_wait();
+        for (int i = 0; i < 200; i++) {
+            s.update(fails_with(i % 2 ? EIO : EPERM));
+        }
+        s.update(fails_with(EAGAIN));
+        for (auto& t : thds) t.join();
+
+        for (const auto& errs : seen) {
+            for (const auto& [e, count] : errs) {
+                EXPECT_TRUE(e == EIO || e == EPERM || e == EAGAIN) << e;
+            }
+            EXPECT_GT(errs.at(EAGAIN), 0);
+        }
+    }
+
+    namespace {
+        volatile sig_atomic_t handled = 0;
+        volatile long handler_ret = 0;
+
+        void count_signal(int) {
+            handler_ret = ::syscall(SYS_getppid);
+            handled = handled + 1;
+        }
+
+        void install_blocking_all(int sig) {
+            struct sigaction a;
+            memset(&a, 0, sizeof(a));
+            a.sa_handler = count_signal;
+            sigfillset(&a.sa_mask);
+            ASSERT_EQ(sigaction(sig, &a, nullptr), 0);
+        }
+
+        bool blocks_sigsys(int sig) {
+            struct sigaction a;
+            EXPECT_EQ(sigaction(sig, nullptr, &a), 0);
+            return sigismember(&a.sa_mask, SIGSYS);
+        }
+    }
+
+    TEST(Session, ReturnsFromHandlersThatBlockEverySignal) {
+        handled = 0;
+        install_blocking_all(SIGUSR1);
+
+        sysfail::Plan p(
+            { {SYS_getppid, {1, 0, 0us, {{EIO, 1}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+        {
+            Session s(p);
+            raise(SIGUSR1);
+            EXPECT_EQ(handled, 1);
+            EXPECT_EQ(handler_ret, -1);
+
+            // installed while armed, masks are reported as installed
+            install_blocking_all(SIGUSR2);
+            EXPECT_TRUE(blocks_sigsys(SIGUSR2));
+            EXPECT_TRUE(blocks_sigsys(SIGUSR1));
+            raise(SIGUSR2);
+            EXPECT_EQ(handled, 2);
+
+            EXPECT_EQ(::syscall(SYS_getppid), -1);
+            EXPECT_EQ(errno, EIO);
+        }
+        // masks are restored once the session ends
+        EXPECT_TRUE(blocks_sigsys(SIGUSR1));
+        EXPECT_TRUE(blocks_sigsys(SIGUSR2));
+        signal(SIGUSR1, SIG_DFL);
+        signal(SIGUSR2, SIG_DFL);
+    }
+
+    // Leaf fills the 16 slots of its red-zone with their index, spins, then
+    // returns the number of slots that changed
+    extern "C" int red_zone_leaf(uint64_t spins);
+    asm(R"(
+        .text
+        .type red_zone_leaf, @function
+        red_zone_leaf:
+            leaq -128(%rsp), %rsi
+            xorl %ecx, %ecx
+        1:  movq %rcx, (%rsi,%rcx,8)
+            incq %rcx
+            cmpq $16, %rcx
+            jne 1b
+        2:  decq %rdi
+            jnz 2b
+            xorl %eax, %eax
+            xorl %ecx, %ecx
+        3:  cmpq %rcx, (%rsi,%rcx,8)
+            je 4f
+            incl %eax
+        4:  incq %rcx
+            cmpq $16, %rcx
+            jne 3b
+            ret
+        .size red_zone_leaf, .-red_zone_leaf
+    )");
+
+    TEST(Session, EnableAndDisableLeaveTheRedZoneAlone) {
+        sysfail::Plan p(
+            { {SYS_getppid, {1, 0, 0us, {{EIO, 1}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+        Session s(p);
+
+        std::atomic<pid_t> tid{0};
+        std::atomic<bool> stop{false};
+        int clobbered = 0;
+        std::thread leaf([&]() {
+            tid = gettid();
+            while (!stop) clobbered += red_zone_leaf(1 << 16);
+        });
+        while (!tid) std::this_thread::yield();
+
+        // enable and disable signals land on the leaf, mid-function
+        for (int i = 0; i < 500; i++) {
+            s.add(tid);
+            s.remove(tid);
+        }
+        stop = true;
+        leaf.join();
+        EXPECT_EQ(clobbered, 0);
+    }
 }
@@ -0,0 +1,169 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <sstream>
+#include <thread>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cisq.hh"
+#include "map.hh"
+#include "stack.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    using namespace Cisq;
+
+    TEST(Stack, SymbolizesCodeAddresses) {
+        auto m = get_mmap(getpid());
+        ASSERT_TRUE(m.has_value());
+
+        auto addr = reinterpret_cast<uintptr_t>(&getppid);
+        auto r = m->find(addr);
+        ASSERT_NE(r, nullptr);
+        EXPECT_TRUE(r->executable());
+        EXPECT_EQ(m->find(0), nullptr);
+
+        // return-address semantics, so point just past the function start
+        EXPECT_EQ(m->symbolize(addr + 1), "getppid");
+    }
+
+    TEST(Stack, UnwindsFramePointerChain) {
+        auto m = get_mmap(getpid());
+        ASSERT_TRUE(m.has_value());
+        Unwinder u(*m);
+
+        auto code = reinterpret_cast<uintptr_t>(&getppid);
+        uintptr_t stack[8] = {
+            0xdead,   // top of stack, not a return-address
+            0,
+            0,        // frame 1: saved %rbp (patched below)
+            code + 1, //          return-address
+            0,        // frame 2: saved %rbp
+            0,        //          return-address (end of chain)
+        };
+        stack[2] = reinterpret_cast<uintptr_t>(&stack[4]);
+
+        gregset_t regs;
+        std::memset(regs, 0, sizeof(regs));
+        regs[REG_RIP] = code;
+        regs[REG_RSP] = reinterpret_cast<greg_t>(&stack[0]);
+        regs[REG_RBP] = reinterpret_cast<greg_t>(&stack[2]);
+
+        uintptr_t frames[8];
+        ASSERT_EQ(u.capture(regs, frames, 8), 2);
+        EXPECT_EQ(frames[0], code);
+        EXPECT_EQ(frames[1], code + 1);
+
+        stack[5] = code + 2;
+        ASSERT_EQ(u.capture(regs, frames, 8), 3);
+        EXPECT_EQ(frames[2], code + 2);
+
+        // depth is bounded
+        ASSERT_EQ(u.capture(regs, frames, 2), 2);
+    }
+
+    TEST(Stack, UnwindingSurvivesUnmappedFrames) {
+        auto m = get_mmap(getpid());
+        ASSERT_TRUE(m.has_value());
+        Unwinder u(*m);
+
+        auto pg = sysconf(_SC_PAGESIZE);
+        auto mem = static_cast<uint8_t*>(mmap(
+            nullptr,
+            2 * pg,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0));
+        ASSERT_NE(mem, MAP_FAILED);
+        ASSERT_EQ(mprotect(mem + pg, pg, PROT_NONE), 0);
+
+        gregset_t regs;
+        std::memset(regs, 0, sizeof(regs));
+        regs[REG_RIP] = reinterpret_cast<greg_t>(&getppid);
+        regs[REG_RSP] = reinterpret_cast<greg_t>(mem);
+        regs[REG_RBP] = reinterpret_cast<greg_t>(mem + pg + 64);
+
+        uintptr_t frames[8];
+        EXPECT_EQ(u.capture(regs, frames, 8), 1);
+
+        munmap(mem, 2 * pg);
+    }
+
+    struct Folded {
+        std::map<std::string, uint64_t> stacks;
+
+        Folded(const std::string& out) {
+            std::istringstream iss(out);
+            std::string line;
+            while (std::getline(iss, line)) {
+                auto sp = line.find_last_of(' ');
+                EXPECT_NE(sp, std::string::npos) << line;
+                stacks[line.substr(0, sp)] += std::stoull(line.substr(sp + 1));
+            }
+        }
+
+        uint64_t leaf(const std::string& name) const {
+            uint64_t total = 0;
+            for (const auto& [s, v] : stacks) {
+                if (s == name || s.ends_with(";" + name)) total += v;
+            }
+            return total;
+        }
+    };
+
+    TEST(Stack, AggregatesSyscallTimeByStack) {
+        sysfail::Plan p(
+            { {SYS_getppid, {0, {1, 0}, 100us, {}}} },
+            [](pid_t) { return true; },
+            thread_discovery::None{},
+            {.stacks = observe::Stacks{}});
+
+        const int calls = 50;
+        Session s(p);
+        for (int i = 0; i < calls; i++) getppid();
+
+        // removed threads are reported too
+        std::thread t([&]() {
+            s.add();
+            for (int i = 0; i < calls; i++) getppid();
+            s.remove();
+        });
+        t.join();
+
+        std::stringstream count_out, time_out;
+        s.dump_stacks(count_out, observe::Metric::Count);
+        s.dump_stacks(time_out);
+
+        Folded count(count_out.str()), time(time_out.str());
+        EXPECT_GE(count.leaf("getppid"), 2 * calls) << count_out.str();
+        // each call was delayed (upto 100us), so time must be substantial
+        EXPECT_GT(time.leaf("getppid"), calls * 1000) << time_out.str();
+    }
+
+    TEST(Stack, DumpRequiresStackProfiling) {
+        Session s({});
+        std::stringstream out;
+        EXPECT_THROW(s.dump_stacks(out), std::logic_error);
+    }
+}
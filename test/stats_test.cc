@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stats.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    TEST(Stats, PublishesLiveCountersInSharedMemory) {
+        auto self = gettid();
+        auto name = stats::region_name(getpid());
+        auto snapshot = std::make_unique<stats::Snapshot>();
+        {
+            sysfail::Plan p(
+                { {SYS_getppid, {1, 0, 0us, {{EIO, 1}}}} },
+                [&](pid_t tid) { return tid == self; },
+                thread_discovery::None{},
+                {.live_stats = observe::LiveStats{}});
+
+            Session s(p);
+            for (int i = 0; i < 10; i++) {
+                EXPECT_EQ(syscall(SYS_getppid), -1);
+            }
+            s.remove();
+
+            auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+            ASSERT_GE(fd, 0);
+            auto addr = mmap(
+                nullptr,
+                sizeof(stats::Region),
+                PROT_READ,
+                MAP_SHARED,
+                fd,
+                0);
+            close(fd);
+            ASSERT_NE(addr, MAP_FAILED);
+            const auto& r = *static_cast<const stats::Region*>(addr);
+            EXPECT_EQ(r.hdr.magic, stats::magic);
+            EXPECT_EQ(r.hdr.version, stats::version);
+            EXPECT_EQ(r.hdr.pid, getpid());
+            stats::read(r, *snapshot);
+            munmap(addr, sizeof(stats::Region));
+        }
+
+        EXPECT_EQ(snapshot->calls[SYS_getppid].injected, 10);
+        EXPECT_GE(snapshot->calls[SYS_getppid].trapped, 10);
+        EXPECT_EQ(snapshot->calls[SYS_getppid].delayed, 0);
+        EXPECT_EQ(snapshot->calls[SYS_getuid].trapped, 0);
+        EXPECT_EQ(snapshot->threads, 0); // removed
+        EXPECT_EQ(snapshot->scans, 1);
+
+        // segment goes away with the session
+        EXPECT_LT(shm_open(name.c_str(), O_RDONLY, 0), 0);
+        EXPECT_EQ(errno, ENOENT);
+    }
+}
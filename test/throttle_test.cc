@@ -0,0 +1,228 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "helpers.hh"
+#include "throttle.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    namespace {
+        struct Call {
+            greg_t regs[NGREG] = {};
+
+            Call(Syscall call, int fd, uint64_t count) {
+                regs[REG_RAX] = call;
+                regs[REG_RDI] = fd;
+                regs[REG_RDX] = count;
+            }
+        };
+
+        Outcome throttled(const Throttle& t) {
+            return {{0, 0}, {0, 0}, 0us, {}, nullptr, schedule::Constant{},
+                    {}, std::nullopt, latency::Uniform{}, t};
+        }
+    }
+
+    TEST(Throttle, DelaysUntilBudgetIsPaidUp) {
+        Throttler t({1000, Throttle::Mode::Delay, 100});
+        auto now = 10s;
+        Call c(SYS_write, 5, 4096);
+        EXPECT_EQ(t.admit(c.regs, now), 0ns);
+        EXPECT_EQ(c.regs[REG_RDX], 4096); // never shortened
+        t.charge(5, 600, now);
+        // 100 bytes of burst, 500 left to pay for at 1ms per byte
+        EXPECT_EQ(t.admit(c.regs, now), 500ms);
+        EXPECT_EQ(t.admit(c.regs, now + 200ms), 300ms);
+        // other fds have budgets of their own
+        Call other(SYS_write, 6, 4096);
+        EXPECT_EQ(t.admit(other.regs, now), 0ns);
+
+        // idling only saves up a burst
+        t.charge(5, 150, now + 10s);
+        EXPECT_EQ(t.admit(c.regs, now + 10s), 50ms);
+    }
+
+    TEST(Throttle, SharedBudgetAcrossFds) {
+        Throttler t({1000, Throttle::Mode::Delay, 100, false});
+        t.charge(5, 600, 10s);
+        Call c(SYS_read, 6, 10);
+        EXPECT_EQ(t.admit(c.regs, 10s), 500ms);
+    }
+
+    TEST(Throttle, ShortensToBudget) {
+        Throttler t({1000, Throttle::Mode::Shorten, 100});
+        auto now = 10s;
+        Call c(SYS_read, 5, 4096);
+        EXPECT_EQ(t.admit(c.regs, now), 0ns);
+        EXPECT_EQ(c.regs[REG_RDX], 100);
+        t.charge(5, 100, now);
+
+        // nothing left, waits for a burst worth
+        Call next(SYS_read, 5, 4096);
+        EXPECT_EQ(t.admit(next.regs, now + 40ms), 60ms);
+        EXPECT_EQ(next.regs[REG_RDX], 100);
+
+        // datagrams are delayed (once overdrawn), not cut
+        Call dgram(SYS_recvfrom, 5, 4096);
+        EXPECT_EQ(t.admit(dgram.regs, now + 40ms), 0ns);
+        EXPECT_EQ(dgram.regs[REG_RDX], 4096);
+        t.charge(5, 100, now + 40ms);
+        EXPECT_EQ(t.admit(dgram.regs, now + 40ms), 60ms);
+        EXPECT_EQ(dgram.regs[REG_RDX], 4096);
+
+        // whole iovecs are dropped, the first one always stays
+        char buf[300];
+        iovec iov[3] = {{buf, 60}, {buf + 60, 30}, {buf + 90, 200}};
+        Call vec(SYS_readv, 7, 3);
+        vec.regs[REG_RSI] = reinterpret_cast<greg_t>(iov);
+        EXPECT_EQ(t.admit(vec.regs, now), 0ns);
+        EXPECT_EQ(vec.regs[REG_RDX], 2);
+    }
+
+    TEST(Throttle, LetsUnreadableIovecsThrough) {
+        Throttler t({1000, Throttle::Mode::Shorten, 100});
+        auto now = 10s;
+        t.charge(5, 600, now);
+
+        auto page = mmap(
+            nullptr,
+            4096,
+            PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+        ASSERT_NE(page, MAP_FAILED);
+        for (auto addr : {greg_t(0), greg_t(1), reinterpret_cast<greg_t>(page)}) {
+            Call c(SYS_readv, 5, 2);
+            c.regs[REG_RSI] = addr;
+            EXPECT_EQ(t.admit(c.regs, now), 0ns);
+            EXPECT_EQ(c.regs[REG_RDX], 2);
+        }
+
+        // counts beyond IOV_MAX aren't read
+        char buf[100];
+        iovec iov{buf, sizeof(buf)};
+        Call c(SYS_writev, 5, IOV_MAX + 1);
+        c.regs[REG_RSI] = reinterpret_cast<greg_t>(&iov);
+        EXPECT_EQ(t.admit(c.regs, now), 0ns);
+        EXPECT_EQ(c.regs[REG_RDX], IOV_MAX + 1);
+
+        // the kernel fails the call, as it would unthrottled
+        int fds[2];
+        ASSERT_EQ(pipe(fds), 0);
+        {
+            Session s(Plan(
+                {{SYS_readv, throttled({1000, Throttle::Mode::Shorten, 100})}},
+                [](pid_t) { return true; },
+                thread_discovery::None{}));
+            errno = 0;
+            EXPECT_EQ(readv(fds[0], reinterpret_cast<iovec*>(page), 2), -1);
+            EXPECT_EQ(errno, EFAULT);
+        }
+        close(fds[0]);
+        close(fds[1]);
+        munmap(page, 4096);
+    }
+
+    TEST(Throttle, SkipsFdsOutOfRange) {
+        Throttler t({1000, Throttle::Mode::Delay, 100});
+        auto now = 10s;
+        int64_t beyond = max_fds;
+        for (auto fd : {-1L, beyond, beyond * 2}) {
+            t.charge(fd, 600, now);
+            Call c(SYS_write, fd, 4096);
+            EXPECT_EQ(t.admit(c.regs, now), 0ns);
+        }
+        // which don't share a budget with fd 0 or the last one in range
+        t.charge(0, 600, now);
+        t.charge(beyond - 1, 600, now);
+        Call c(SYS_write, -1, 4096);
+        EXPECT_EQ(t.admit(c.regs, now), 0ns);
+        c.regs[REG_RDI] = beyond;
+        EXPECT_EQ(t.admit(c.regs, now), 0ns);
+    }
+
+    TEST(Throttle, ShapesSessionThroughput) {
+        int fds[2];
+        ASSERT_EQ(pipe(fds), 0);
+        fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+        Session s(Plan(
+            {{SYS_write, throttled({1'000'000, Throttle::Mode::Shorten, 10'000})}},
+            [](pid_t) { return true; },
+            thread_discovery::None{}));
+
+        std::vector<char> data(64 * 1024);
+        // a burst goes through at once, cut down to it
+        EXPECT_EQ(write(fds[1], data.data(), data.size()), 10'000);
+        auto start = std::chrono::steady_clock::now();
+        size_t sent = 0;
+        while (sent < 100'000) {
+            auto w = write(fds[1], data.data(), data.size());
+            ASSERT_GT(w, 0);
+            EXPECT_LE(w, 10'000);
+            sent += w;
+            std::vector<char> sink(w);
+            ASSERT_EQ(read(fds[0], sink.data(), w), w);
+        }
+        // 100KB at 1MB/s
+        EXPECT_GE(std::chrono::steady_clock::now() - start, 90ms);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    TEST(Throttle, PreservesRegistersOfShortenedCalls) {
+        int fds[2];
+        ASSERT_EQ(pipe(fds), 0);
+        fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+        Session s(Plan(
+            {{SYS_write, throttled({1'000'000, Throttle::Mode::Shorten, 10'000})}},
+            [](pid_t) { return true; },
+            thread_discovery::None{}));
+
+        std::vector<char> data(64 * 1024);
+        // raw syscall, code like this relies on rdx surviving it
+        long ret;
+        uint64_t rdx = data.size();
+        asm volatile(
+            "syscall"
+            : "=a"(ret), "+d"(rdx)
+            : "a"(SYS_write), "D"(fds[1]), "S"(data.data())
+            : "rcx", "r11", "memory");
+        EXPECT_EQ(ret, 10'000);
+        EXPECT_EQ(rdx, data.size());
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    TEST(Throttle, RejectsBadConfig) {
+        EXPECT_THROW(Throttle(0), std::invalid_argument);
+        EXPECT_THROW(
+            Session(Plan(
+                {{SYS_getppid, throttled({1000})}},
+                [](pid_t) { return true; },
+                thread_discovery::None{})),
+            std::invalid_argument);
+    }
+}
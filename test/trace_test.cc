@@ -0,0 +1,167 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "trace.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    namespace {
+        Plan mk_plan(
+            double p,
+            uint64_t seed,
+            std::shared_ptr<const trace::Trace> replay = nullptr
+        ) {
+            return Plan(
+                { {SYS_getppid, {{p, 0.5}, {0, 0}, 0us, {{EIO, 1}, {EPERM, 1}}}} },
+                [](pid_t tid) { return true; },
+                thread_discovery::None{},
+                {.record = observe::Record{}},
+                seed,
+                replay);
+        }
+
+        std::vector<long> run(int calls) {
+            std::vector<long> out;
+            for (int i = 0; i < calls; i++) {
+                errno = 0;
+                auto r = syscall(SYS_getppid);
+                out.push_back(r == -1 ? -errno : r);
+            }
+            return out;
+        }
+    }
+
+    TEST(Trace, ReplaysRecordedDecisions) {
+        std::vector<long> original;
+        trace::Trace t;
+        {
+            Session s(mk_plan(0.3, 1));
+            original = run(300);
+            t = s.recorded();
+        }
+        auto failed = std::count_if(
+            original.begin(),
+            original.end(),
+            [](auto r) { return r < 0; });
+        ASSERT_GT(failed, 0);
+        EXPECT_EQ(t.events.size(), failed);
+        EXPECT_EQ(t.dropped, 0);
+        for (const auto& e : t.events) {
+            EXPECT_EQ(e.thread, 0);
+            EXPECT_EQ(e.call, SYS_getppid);
+            EXPECT_EQ(-original[e.index], e.fail);
+        }
+
+        std::stringstream buf;
+        t.save(buf);
+        auto loaded = std::make_shared<const trace::Trace>(
+            trace::Trace::load(buf));
+        EXPECT_EQ(loaded->events, t.events);
+
+        // different seed, same decisions
+        Session s(mk_plan(0.3, 2, loaded));
+        EXPECT_EQ(run(300), original);
+        EXPECT_EQ(s.recorded().events, t.events);
+        // beyond the trace nothing is injected
+        for (auto r : run(100)) EXPECT_EQ(r, getppid());
+    }
+
+    TEST(Trace, RecordsThreadsThatWereRemoved) {
+        Session s(mk_plan(1, 1));
+        run(5);
+        std::thread t([&]() {
+            s.add();
+            run(5000); // spans several log chunks
+            s.remove();
+        });
+        t.join();
+
+        auto r = s.recorded();
+        ASSERT_EQ(r.events.size(), 5005);
+        for (uint64_t i = 0; i < 5; i++) {
+            EXPECT_EQ(r.events[i].thread, 0);
+            EXPECT_EQ(r.events[i].index, i);
+        }
+        for (uint64_t i = 0; i < 5000; i++) {
+            EXPECT_EQ(r.events[5 + i].thread, 1);
+            EXPECT_EQ(r.events[5 + i].index, i);
+        }
+    }
+
+    TEST(Trace, SurvivesRemovalMidDecision) {
+        // every call is delayed, recorded and profiled, so removals mostly
+        // land while the thread is inside the handler
+        Session s(Plan(
+            {{SYS_getppid, {{0.5, 0.5}, {1, 0.5}, 20us, {{EIO, 1}}}}},
+            [](pid_t tid) { return true; },
+            thread_discovery::None{},
+            {.stacks = observe::Stacks{},
+             .call_sites = observe::CallSites{},
+             .record = observe::Record{}},
+            1));
+        std::atomic<pid_t> tid{0};
+        std::atomic<bool> stop{false};
+        std::thread t([&]() {
+            tid = gettid();
+            while (!stop) syscall(SYS_getppid);
+        });
+        while (!tid) std::this_thread::yield();
+        for (int i = 0; i < 1000; i++) {
+            s.add(tid);
+            std::this_thread::sleep_for(50us);
+            s.remove(tid);
+        }
+        stop = true;
+        t.join();
+        EXPECT_GT(s.recorded().events.size(), 0);
+    }
+
+    TEST(Trace, RejectsMalformedInput) {
+        std::stringstream garbage("not a trace at all");
+        EXPECT_THROW(trace::Trace::load(garbage), std::invalid_argument);
+
+        trace::Trace t{{{0, 0, SYS_read, EIO, false, 0us, false}}};
+        std::stringstream buf;
+        t.save(buf);
+        auto truncated = buf.str();
+        truncated.pop_back();
+        std::stringstream in(truncated);
+        EXPECT_THROW(trace::Trace::load(in), std::invalid_argument);
+
+        sysfail::Plan p({}, [](pid_t) { return true; }, thread_discovery::None{});
+        Session s(p);
+        EXPECT_THROW(s.recorded(), std::logic_error);
+    }
+
+    TEST(Trace, KeepsLongDelays) {
+        trace::Log l(0);
+        l.add(0, SYS_read, 0, false, 5h, true);
+        std::vector<trace::Event> out;
+        l.copy(out);
+        ASSERT_EQ(out.size(), 1);
+        EXPECT_EQ(out[0].delay, 5h);
+        EXPECT_TRUE(out[0].delay_after);
+    }
+}
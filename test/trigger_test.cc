@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <thread>
+#include <unistd.h>
+
+#include "trigger.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    using namespace trigger;
+
+    namespace {
+        Plan mk_plan(const Trigger& t, Syscall call = SYS_getppid) {
+            return Plan(
+                { {call, {0, 0, 0us, {{EIO, 1}}, nullptr, {}, {}, t}} },
+                [](pid_t tid) { return true; },
+                thread_discovery::None{});
+        }
+
+        std::vector<int> failed_calls(int calls) {
+            std::vector<int> failed;
+            for (int i = 0; i < calls; i++) {
+                if (syscall(SYS_getppid) == -1) failed.push_back(i);
+            }
+            return failed;
+        }
+    }
+
+    TEST(Trigger, PicksCallsByIndex) {
+        EXPECT_TRUE(picks(Nth(3), 3));
+        EXPECT_FALSE(picks(Nth(3), 4));
+
+        EXPECT_FALSE(picks(Every(3), 0));
+        EXPECT_TRUE(picks(Every(3), 2));
+        EXPECT_TRUE(picks(Every(3), 5));
+        EXPECT_TRUE(picks(Every(1), 0));
+
+        EXPECT_FALSE(picks(Window(2, 4), 1));
+        EXPECT_TRUE(picks(Window(2, 4), 2));
+        EXPECT_TRUE(picks(Window(2, 4), 3));
+        EXPECT_FALSE(picks(Window(2, 4), 4));
+
+        EXPECT_EQ(scope(Every(2, Scope::Global)), Scope::Global);
+
+        EXPECT_THROW(Every(0), std::invalid_argument);
+        EXPECT_THROW(Window(3, 3), std::invalid_argument);
+    }
+
+    TEST(Trigger, FailsPickedCallsOfEachThread) {
+        Session s(mk_plan(Every(3)));
+        EXPECT_EQ(failed_calls(10), (std::vector<int>{2, 5, 8}));
+
+        std::vector<int> other;
+        std::thread t([&]() {
+            s.add();
+            other = failed_calls(4);
+            s.remove();
+        });
+        t.join();
+        EXPECT_EQ(other, (std::vector<int>{2}));
+
+        // counts start over with the new plan
+        s.update(mk_plan(Nth(1)));
+        EXPECT_EQ(failed_calls(10), (std::vector<int>{1}));
+    }
+
+    TEST(Trigger, CountsGloballyAcrossThreads) {
+        Session s(mk_plan(Window(2, 5, Scope::Global)));
+        EXPECT_EQ(failed_calls(3), (std::vector<int>{2}));
+
+        std::vector<int> other;
+        std::thread t([&]() {
+            s.add();
+            other = failed_calls(3);
+            s.remove();
+        });
+        t.join();
+        EXPECT_EQ(other, (std::vector<int>{0, 1}));
+        EXPECT_TRUE(failed_calls(3).empty());
+    }
+
+    TEST(Trigger, RejectsPerThreadTriggerOnUnknownSyscall) {
+        EXPECT_THROW(Session(mk_plan(Nth(0), 4096)), std::invalid_argument);
+    }
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Watches live statistics of a sysfail session running in another process
+// (see sysfail::observe::LiveStats).
+//
+// Usage: sysfail-top [-i <interval-ms>] [-n <iterations>] <pid>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.hh"
+
+namespace stats = sysfail::stats;
+using namespace std::chrono_literals;
+
+namespace {
+    void usage(const char* prog) {
+        fprintf(
+            stderr,
+            "Usage: %s [-i <interval-ms>] [-n <iterations>] <pid>\n",
+            prog);
+    }
+
+    struct Row {
+        uint32_t call;
+        double trapped;
+        double injected;
+        double delayed;
+        // mean absolute error of delays waited in the interval (us)
+        double wait_error;
+        // mean wait for a Concurrency queue slot in the interval (us)
+        double queue_wait;
+        uint64_t injected_total;
+    };
+
+    void show(
+        pid_t pid,
+        const stats::Snapshot& prev,
+        const stats::Snapshot& cur,
+        double secs,
+        bool clear
+    ) {
+        std::vector<Row> rows;
+        double trapped = 0, injected = 0, delayed = 0;
+        for (uint32_t i = 0; i < stats::max_syscall; i++) {
+            const auto& p = prev.calls[i];
+            const auto& c = cur.calls[i];
+            if (c.trapped == 0 && c.injected == 0 && c.delayed == 0) continue;
+            Row r{
+                i,
+                (c.trapped - p.trapped) / secs,
+                (c.injected - p.injected) / secs,
+                (c.delayed - p.delayed) / secs,
+                c.waits > p.waits
+                    ? (c.wait_error_ns - p.wait_error_ns) / 1e3 /
+                        (c.waits - p.waits)
+                    : 0.0,
+                c.queued > p.queued
+                    ? (c.queue_wait_ns - p.queue_wait_ns) / 1e3 /
+                        (c.queued - p.queued)
+                    : 0.0,
+                c.injected};
+            trapped += r.trapped;
+            injected += r.injected;
+            delayed += r.delayed;
+            rows.push_back(r);
+        }
+        std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+            return a.trapped > b.trapped;
+        });
+
+        auto scans = cur.scans - prev.scans;
+        auto scan_ns = cur.total_scan_ns - prev.total_scan_ns;
+
+        if (clear) printf("\033[H\033[2J");
+        printf(
+            "pid %d  threads %lu  scans %lu (last %.1fus, avg %.1fus)\n",
+            pid,
+            cur.threads,
+            cur.scans,
+            cur.last_scan_ns / 1e3,
+            scans ? scan_ns / 1e3 / scans : 0.0);
+        printf(
+            "trapped %.0f/s  injected %.0f/s  delayed %.0f/s\n\n",
+            trapped,
+            injected,
+            delayed);
+        printf(
+            "%8s %12s %12s %12s %12s %12s %14s\n",
+            "SYSCALL",
+            "TRAPPED/s",
+            "INJECTED/s",
+            "DELAYED/s",
+            "DELAY-ERR-us",
+            "QUEUE-us",
+            "INJECTED");
+        for (const auto& r : rows) {
+            printf(
+                "%8u %12.0f %12.0f %12.0f %12.1f %12.1f %14lu\n",
+                r.call,
+                r.trapped,
+                r.injected,
+                r.delayed,
+                r.wait_error,
+                r.queue_wait,
+                r.injected_total);
+        }
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char** argv) {
+    auto interval = 1000ms;
+    long iterations = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                interval = std::chrono::milliseconds(std::stol(optarg));
+                break;
+            case 'n':
+                iterations = std::stol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || interval.count() <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    pid_t pid = std::stoi(argv[optind]);
+
+    auto name = stats::region_name(pid);
+    auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(
+            stderr,
+            "No live stats for pid %d (%s: %s), is observe::LiveStats on?\n",
+            pid,
+            name.c_str(),
+            strerror(errno));
+        return 1;
+    }
+    auto addr = mmap(nullptr, sizeof(stats::Region), PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    const auto& region = *static_cast<const stats::Region*>(addr);
+    if (region.hdr.magic != stats::magic ||
+        region.hdr.version != stats::version ||
+        region.hdr.max_syscall != stats::max_syscall) {
+        fprintf(stderr, "Incompatible stats layout in %s\n", name.c_str());
+        return 1;
+    }
+
+    auto prev = std::make_unique<stats::Snapshot>();
+    auto cur = std::make_unique<stats::Snapshot>();
+    stats::read(region, *prev);
+    auto prev_at = std::chrono::steady_clock::now();
+    auto clear = isatty(STDOUT_FILENO);
+    for (long i = 0; iterations < 0 || i < iterations; i++) {
+        std::this_thread::sleep_for(interval);
+
+        // session removes the segment when it ends
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_nlink == 0) {
+            fprintf(stderr, "Session in pid %d ended\n", pid);
+            return 0;
+        }
+
+        stats::read(region, *cur);
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> secs = now - prev_at;
+        show(pid, *prev, *cur, secs.count(), clear);
+        std::swap(prev, cur);
+        prev_at = now;
+    }
+    return 0;
+}